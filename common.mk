@@ -2,10 +2,14 @@
 FRONTENDS = null sdl2
 DEFAULT_FRONTEND = sdl2
 
+# Tools (make aot)
+TOOLS = aot
+
 # Directories
 SRC_DIR = src
 INCLUDE_DIR = include
 FRONTEND_DIR = frontend
+TOOL_DIR = tools
 BUILD_DIR = build
 LIB = libboyo.a
 BIN = boyo
@@ -23,3 +27,17 @@ endif
 ifeq ($(CGB), 1)
 	CFLAGS += -DCGB
 endif
+
+ifeq ($(CPU_REFERENCE), 1)
+	CFLAGS += -DCPU_REFERENCE
+endif
+
+ifeq ($(JIT), 1)
+	CFLAGS += -DJIT -pthread
+	LDFLAGS += -pthread
+endif
+
+# Path to C generated by boyo-aot, only the null frontend links it
+ifdef AOT
+	CFLAGS += -DAOT
+endif
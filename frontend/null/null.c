@@ -7,14 +7,14 @@
 #include "emu.h"
 
 #ifdef CGB
-void frame_callback(uint16_t *buffer) {
+void frame_callback(gb_t *gb, uint16_t *buffer) {
 #else
-void frame_callback(uint8_t *buffer) {
+void frame_callback(gb_t *gb, uint8_t *buffer) {
 #endif
     //printf("NEW FRAME\n");
 }
 
-void audio_callback(int16_t *buffer, int len) {
+void audio_callback(gb_t *gb, int16_t *buffer, int len) {
     //printf("NEW AUDIO\n");
 }
 
@@ -88,36 +88,49 @@ int main(int argc, char *argv[]) {
     // Open SAV (if it exists)
     open_file(save_path, sav, EMU_SAV_SIZE_MAX);
 
-    emu_load_bootrom(bootrom, EMU_BOOTROM_SIZE_MAX);
-    emu_load_rom(rom, EMU_ROM_SIZE_MAX);
-    emu_load_sav(sav, EMU_SAV_SIZE_MAX);
+    // Create the emulator instance
+    gb_t *gb = emu_create();
+    if (!gb) {
+        printf("Could not create emulator instance\n");
+        return 1;
+    }
+    gb_emu_t *emu = emu_get(gb);
+
+    emu_load_bootrom(gb, bootrom, EMU_BOOTROM_SIZE_MAX);
+    emu_load_rom(gb, rom, EMU_ROM_SIZE_MAX);
+    emu_load_sav(gb, sav, EMU_SAV_SIZE_MAX);
 
     // Get the game title out of the cartridge header
-    emu_get_title(title);
+    emu_get_title(gb, title);
     printf("%s %s\n","Cartridge Header Title:", title);
 
     // Attach callbacks
-    emu.frame_callback = frame_callback;
-    emu.audio_callback = audio_callback;
+    emu->frame_callback = frame_callback;
+    emu->audio_callback = audio_callback;
 
-    emu.running = true;
+    // Nothing is played, skip synthesis
+    emu_set_audio(gb, false);
+
+    emu->running = true;
 
     // Main loop
-    while (emu.running) {
-        if (emu.ppu_enabled) {
-            emu_run_to(EMU_EVENT_FRAME);
-        } else if (emu.apu_enabled) {
-            emu_run_to(EMU_EVENT_AUDIO);
+    while (emu->running) {
+        if (emu->ppu_enabled) {
+            emu_run_to(gb, EMU_EVENT_FRAME);
+        } else if (emu->apu_enabled) {
+            emu_run_to(gb, EMU_EVENT_AUDIO);
         } else {
-            emu_run_to(EMU_EVENT_ANY);
+            emu_run_to(gb, EMU_EVENT_ANY);
         }
     }
 
     // Save cartridge ram
     printf("Saving cartridge ram\n");
-    if (!save_file(save_path, sav, emu_get_sav_size())) {
+    if (!save_file(save_path, sav, emu_get_sav_size(gb))) {
         printf("Could not open cartridge save %s\n", save_path);
     };
 
+    emu_destroy(gb);
+
     return 0;
 }
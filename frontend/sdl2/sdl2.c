@@ -11,6 +11,9 @@ SDL_AudioSpec audiospec_want;
 SDL_AudioSpec audiospec_have;
 SDL_AudioDeviceID audio_dev;
 
+gb_t *gb;
+gb_emu_t *emu;
+
 uint32_t sdl_col[4];
 
 uint64_t perf_count_freq = 0;
@@ -20,63 +23,63 @@ const double target_frametime = 1000.0/60.0;
 
 void emu_halt(int sig) {
     printf("Emulation halting: %i\n", sig);
-    emu.running = 0;
+    emu->running = 0;
 }
 
 void process_events() {
     SDL_Event e;
     while (SDL_PollEvent(&e)) {
         switch (e.type) {
-            case SDL_QUIT: emu.running = 0; break;
+            case SDL_QUIT: emu->running = 0; break;
             case SDL_KEYDOWN:
                 switch (e.key.keysym.sym) {
-                    case SDLK_l: emu_joypad_down(EMU_JOYPAD_BUTTON_A); break;
-                    case SDLK_k: emu_joypad_down(EMU_JOYPAD_BUTTON_B); break;
-                    case SDLK_h: emu_joypad_down(EMU_JOYPAD_BUTTON_START); break;
-                    case SDLK_g: emu_joypad_down(EMU_JOYPAD_BUTTON_SELECT); break;
-                    case SDLK_w: emu_joypad_down(EMU_JOYPAD_DPAD_UP); break;
-                    case SDLK_s: emu_joypad_down(EMU_JOYPAD_DPAD_DOWN); break;
-                    case SDLK_a: emu_joypad_down(EMU_JOYPAD_DPAD_LEFT); break;
-                    case SDLK_d: emu_joypad_down(EMU_JOYPAD_DPAD_RIGHT); break;
+                    case SDLK_l: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_A); break;
+                    case SDLK_k: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_B); break;
+                    case SDLK_h: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_START); break;
+                    case SDLK_g: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_SELECT); break;
+                    case SDLK_w: emu_joypad_down(gb, EMU_JOYPAD_DPAD_UP); break;
+                    case SDLK_s: emu_joypad_down(gb, EMU_JOYPAD_DPAD_DOWN); break;
+                    case SDLK_a: emu_joypad_down(gb, EMU_JOYPAD_DPAD_LEFT); break;
+                    case SDLK_d: emu_joypad_down(gb, EMU_JOYPAD_DPAD_RIGHT); break;
                     default: break;
                 }
                 break;
             case SDL_KEYUP:
                 switch (e.key.keysym.sym) {
-                    case SDLK_l: emu_joypad_up(EMU_JOYPAD_BUTTON_A); break;
-                    case SDLK_k: emu_joypad_up(EMU_JOYPAD_BUTTON_B); break;
-                    case SDLK_h: emu_joypad_up(EMU_JOYPAD_BUTTON_START); break;
-                    case SDLK_g: emu_joypad_up(EMU_JOYPAD_BUTTON_SELECT); break;
-                    case SDLK_w: emu_joypad_up(EMU_JOYPAD_DPAD_UP); break;
-                    case SDLK_s: emu_joypad_up(EMU_JOYPAD_DPAD_DOWN); break;
-                    case SDLK_a: emu_joypad_up(EMU_JOYPAD_DPAD_LEFT); break;
-                    case SDLK_d: emu_joypad_up(EMU_JOYPAD_DPAD_RIGHT); break;
-                    case SDLK_ESCAPE: emu.running = 0;
+                    case SDLK_l: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_A); break;
+                    case SDLK_k: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_B); break;
+                    case SDLK_h: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_START); break;
+                    case SDLK_g: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_SELECT); break;
+                    case SDLK_w: emu_joypad_up(gb, EMU_JOYPAD_DPAD_UP); break;
+                    case SDLK_s: emu_joypad_up(gb, EMU_JOYPAD_DPAD_DOWN); break;
+                    case SDLK_a: emu_joypad_up(gb, EMU_JOYPAD_DPAD_LEFT); break;
+                    case SDLK_d: emu_joypad_up(gb, EMU_JOYPAD_DPAD_RIGHT); break;
+                    case SDLK_ESCAPE: emu->running = 0;
                     default: break;
                 }
                 break;
             case SDL_CONTROLLERBUTTONDOWN:
                 switch (e.cbutton.button) {
-                    case SDL_CONTROLLER_BUTTON_A: emu_joypad_down(EMU_JOYPAD_BUTTON_A); break;
-                    case SDL_CONTROLLER_BUTTON_B: emu_joypad_down(EMU_JOYPAD_BUTTON_B); break;
-                    case SDL_CONTROLLER_BUTTON_START: emu_joypad_down(EMU_JOYPAD_BUTTON_START); break;
-                    case SDL_CONTROLLER_BUTTON_BACK: emu_joypad_down(EMU_JOYPAD_BUTTON_SELECT); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_UP: emu_joypad_down(EMU_JOYPAD_DPAD_UP); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_DOWN: emu_joypad_down(EMU_JOYPAD_DPAD_DOWN); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_LEFT: emu_joypad_down(EMU_JOYPAD_DPAD_LEFT); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: emu_joypad_down(EMU_JOYPAD_DPAD_RIGHT); break;
+                    case SDL_CONTROLLER_BUTTON_A: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_A); break;
+                    case SDL_CONTROLLER_BUTTON_B: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_B); break;
+                    case SDL_CONTROLLER_BUTTON_START: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_START); break;
+                    case SDL_CONTROLLER_BUTTON_BACK: emu_joypad_down(gb, EMU_JOYPAD_BUTTON_SELECT); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_UP: emu_joypad_down(gb, EMU_JOYPAD_DPAD_UP); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_DOWN: emu_joypad_down(gb, EMU_JOYPAD_DPAD_DOWN); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_LEFT: emu_joypad_down(gb, EMU_JOYPAD_DPAD_LEFT); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: emu_joypad_down(gb, EMU_JOYPAD_DPAD_RIGHT); break;
                 }
                 break;
             case SDL_CONTROLLERBUTTONUP:
                 switch (e.cbutton.button) {
-                    case SDL_CONTROLLER_BUTTON_A: emu_joypad_up(EMU_JOYPAD_BUTTON_A); break;
-                    case SDL_CONTROLLER_BUTTON_B: emu_joypad_up(EMU_JOYPAD_BUTTON_B); break;
-                    case SDL_CONTROLLER_BUTTON_START: emu_joypad_up(EMU_JOYPAD_BUTTON_START); break;
-                    case SDL_CONTROLLER_BUTTON_BACK: emu_joypad_up(EMU_JOYPAD_BUTTON_SELECT); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_UP: emu_joypad_up(EMU_JOYPAD_DPAD_UP); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_DOWN: emu_joypad_up(EMU_JOYPAD_DPAD_DOWN); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_LEFT: emu_joypad_up(EMU_JOYPAD_DPAD_LEFT); break;
-                    case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: emu_joypad_up(EMU_JOYPAD_DPAD_RIGHT); break;
+                    case SDL_CONTROLLER_BUTTON_A: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_A); break;
+                    case SDL_CONTROLLER_BUTTON_B: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_B); break;
+                    case SDL_CONTROLLER_BUTTON_START: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_START); break;
+                    case SDL_CONTROLLER_BUTTON_BACK: emu_joypad_up(gb, EMU_JOYPAD_BUTTON_SELECT); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_UP: emu_joypad_up(gb, EMU_JOYPAD_DPAD_UP); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_DOWN: emu_joypad_up(gb, EMU_JOYPAD_DPAD_DOWN); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_LEFT: emu_joypad_up(gb, EMU_JOYPAD_DPAD_LEFT); break;
+                    case SDL_CONTROLLER_BUTTON_DPAD_RIGHT: emu_joypad_up(gb, EMU_JOYPAD_DPAD_RIGHT); break;
                 }
             default: break;
         }
@@ -101,7 +104,7 @@ void limit_framerate(double target_frametime) {
 }
 
 #ifdef CGB
-void frame_callback(uint16_t *buffer) {
+void frame_callback(gb_t *gb, uint16_t *buffer) {
     // Convert RGB555 color to SDL 32-bit
     SDL_ConvertPixels(160, 144,
                       SDL_PIXELFORMAT_BGR555, buffer, 160 * 2,
@@ -115,7 +118,7 @@ void frame_callback(uint16_t *buffer) {
     }
 }
 #else
-void frame_callback(uint8_t *buffer) {
+void frame_callback(gb_t *gb, uint8_t *buffer) {
     static uint32_t sdl_fb[160*144];
 
     // Convert GB color to SDL 32-bit
@@ -134,7 +137,7 @@ void frame_callback(uint8_t *buffer) {
 }
 #endif
 
-void audio_callback(int16_t *buffer, int len) {
+void audio_callback(gb_t *gb, int16_t *buffer, int len) {
     bool underrun = SDL_GetQueuedAudioSize(audio_dev) < (len * sizeof(int16_t));
     bool overrun = SDL_GetQueuedAudioSize(audio_dev) > (len * sizeof(int16_t) * 8);
 
@@ -151,7 +154,7 @@ void audio_callback(int16_t *buffer, int len) {
         skip_frame = true;
     }
 
-    if (!underrun && !emu.ppu_enabled) {
+    if (!underrun && !emu_get(gb)->ppu_enabled) {
         limit_framerate(1000 * (len/2.0)/(double)audiospec_have.freq);
     }
 }
@@ -260,12 +263,20 @@ int main(int argc, char *argv[]) {
     // Open SAV (if it exists)
     open_file(save_path, sav, EMU_SAV_SIZE_MAX);
 
-    emu_load_bootrom(bootrom, EMU_BOOTROM_SIZE_MAX);
-    emu_load_rom(rom, EMU_ROM_SIZE_MAX);
-    emu_load_sav(sav, EMU_SAV_SIZE_MAX);
+    // Create the emulator instance
+    gb = emu_create();
+    if (!gb) {
+        fprintf(stderr, "Could not create emulator instance\n");
+        return 1;
+    }
+    emu = emu_get(gb);
+
+    emu_load_bootrom(gb, bootrom, EMU_BOOTROM_SIZE_MAX);
+    emu_load_rom(gb, rom, EMU_ROM_SIZE_MAX);
+    emu_load_sav(gb, sav, EMU_SAV_SIZE_MAX);
 
     // Get the game title out of the cartridge header
-    emu_get_title(title);
+    emu_get_title(gb, title);
     printf("%s %s\n","Cartridge Header Title:", title);
 
     // Initialize the framerate limiter
@@ -274,20 +285,20 @@ int main(int argc, char *argv[]) {
     perf_count_target = SDL_GetPerformanceCounter();
 
     // Attach callbacks
-    emu.frame_callback = frame_callback;
-    emu.audio_callback = audio_callback;
+    emu->frame_callback = frame_callback;
+    emu->audio_callback = audio_callback;
 
-    emu.running = true;
+    emu->running = true;
 
     // Main loop
-    while (emu.running) {
-        if (emu.ppu_enabled) {
-            emu_run_to(EMU_EVENT_FRAME);
+    while (emu->running) {
+        if (emu->ppu_enabled) {
+            emu_run_to(gb, EMU_EVENT_FRAME);
 
-        } else if (emu.apu_enabled) {
-            emu_run_to(EMU_EVENT_AUDIO);
+        } else if (emu->apu_enabled) {
+            emu_run_to(gb, EMU_EVENT_AUDIO);
         } else {
-            emu_run_to(EMU_EVENT_ANY);
+            emu_run_to(gb, EMU_EVENT_ANY);
         }
 
         process_events();
@@ -295,10 +306,12 @@ int main(int argc, char *argv[]) {
 
     // Save cartridge ram
     printf("Saving cartridge ram\n");
-    if (!save_file(save_path, sav, emu_get_sav_size())) {
+    if (!save_file(save_path, sav, emu_get_sav_size(gb))) {
         printf("Could not open cartridge save %s\n", save_path);
     };
 
+    emu_destroy(gb);
+
     SDL_DestroyWindow(win);
     SDL_CloseAudioDevice(audio_dev);
     if (controller) SDL_GameControllerClose(controller);
@@ -0,0 +1,26 @@
+#ifndef AOT_H
+#define AOT_H
+
+#include <stdint.h>
+
+#include "emu.h"
+
+// Code generated ahead of time by boyo-aot for a single ROM, see tools/aot
+
+// Global checksum from the header of the ROM the code was generated from
+extern const uint16_t aot_checksum;
+
+// Run the generated code at PC in a ROM bank, returns the last instruction run or -1 if there is no code for PC
+int aot_execute(gb_t *gb, int bank);
+
+bool aot_run(gb_t *gb, uint16_t *pc);
+
+// Building blocks of the generated code, last is the address of the instruction just run
+#define AOT_OP(op, imm16) gb->sched.cycles += cpu_execute_op(gb, op, imm16)
+#define AOT_NEXT(last, length, t) gb->cpu.pc = (last) + (length); gb->sched.cycles += (t)
+#define AOT_MAPPED(last, bank) \
+    if (gb->mem.read_page[(last) >> 8] != &gb->cartridge.rom[((bank) * 0x4000) | ((last) & 0x3F00)]) return (last)
+#define AOT_INTERRUPT(last) if (gb->cpu.ime && (gb->mem.ie & gb->mem.iflag)) return (last)
+#define AOT_DEADLINE(last) if (gb->sched.cycles >= gb->sched.next) return (last)
+
+#endif
@@ -2,6 +2,8 @@
 #define APU_H
 
 #include "emu.h"
+#include "blip.h"
+#include "mix.h"
 
 typedef struct {
     uint8_t sweep;
@@ -28,6 +30,7 @@ typedef struct {
     int period;
     uint8_t control;
     uint8_t wave[16];
+    uint8_t samples[32]; // Wave RAM, one entry per step
 
     uint8_t length_timer;
     int period_timer;
@@ -62,9 +65,18 @@ typedef struct {
     uint8_t panning;
     uint8_t control;
 
+    uint32_t blip_pos; // Position of the next M cycle in the buffer being synthesised
+    int mixed; // Samples of the buffer already mixed
+    float gain_left[MIX_CHANNELS]; // Set from NR50 and NR51
+    float gain_right[MIX_CHANNELS];
+    gb_blip_t blip; // One lane per channel
+    float mix[EMU_AUDIO_BUFFER_SIZE*2]; // Mixed buffer in 16 bit sample units
     int16_t buffer[EMU_AUDIO_BUFFER_SIZE*2];
-    int buffer_index;
-    float buffer_index_timer;
+    float buffer_float[EMU_AUDIO_BUFFER_SIZE*2]; // Only filled for an audio_float_callback
+
+#ifdef CGB
+    bool half_timer;
+#endif
 
     int div_apu;
     bool div_clock;
@@ -75,15 +87,20 @@ typedef struct {
     bool sweep_clock_last;
     bool envelope_clock;
     bool envelope_clock_last;
-} gb_apu_t;
 
-extern gb_apu_t apu;
+    bool silent; // Audio off, see apu_set_audio
+
+    uint64_t cycles; // Master clock cycle caught up to
+} gb_apu_t;
 
-bool apu_execute(uint8_t t);
-bool apu_enabled();
-uint8_t apu_io_read(uint16_t addr);
-void apu_io_write(uint16_t addr, uint8_t data);
-uint8_t apu_wave_read(uint16_t addr);
-void apu_wave_write(uint16_t addr, uint8_t data);
+bool apu_execute(gb_t *gb, int t);
+void apu_sync(gb_t *gb);
+void apu_schedule(gb_t *gb);
+bool apu_enabled(gb_t *gb);
+void apu_set_audio(gb_t *gb, bool enabled);
+uint8_t apu_io_read(gb_t *gb, uint16_t addr);
+void apu_io_write(gb_t *gb, uint16_t addr, uint8_t data);
+uint8_t apu_wave_read(gb_t *gb, uint16_t addr);
+void apu_wave_write(gb_t *gb, uint16_t addr, uint8_t data);
 
 #endif
@@ -0,0 +1,33 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "emu.h"
+
+// Many instances of one ROM, e.g. environments for training
+// Lanes share the bootrom and ROM, everything else including cartridge RAM is their own
+// This is not a lockstep or SIMD runner. Lanes are ordinary scalar instances run one after
+// another, so a batch costs about as much as its lanes would on their own. A structure of
+// arrays CPU with lanes in vector registers does not fit this core: every instance also
+// has its own PPU, APU, timer, MBC and memory map, and the CPU calls into them mid
+// instruction. Use one batch per thread to spread lanes over cores.
+// With JIT=1 the lanes share blocks. A batch can move between threads between calls, a lane
+// that finds the blocks in use by another thread runs in the interpreter until it returns.
+typedef struct {
+    gb_t **gb;
+    uint8_t *ram; // EMU_SAV_SIZE_MAX per lane
+    int *events; // What each lane stopped on in the last batch_run_to
+    int *order; // Lanes in the order they run, grouped by the code they are in
+    uintptr_t *key;
+    int count;
+} gb_batch_t;
+
+gb_batch_t *batch_create(int count);
+void batch_destroy(gb_batch_t *batch);
+void batch_load(gb_batch_t *batch, uint8_t *bootrom, size_t bootrom_size, uint8_t *rom, size_t rom_size);
+gb_t *batch_get(gb_batch_t *batch, int lane);
+int batch_run_to(gb_batch_t *batch, int mask);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef BLIP_H
+#define BLIP_H
+
+#include <stdint.h>
+
+#include "emu.h"
+
+// Band-limited step synthesis, an output's level changes are recorded as steps at the exact
+// time they happen and turned into samples at the host rate when they are read
+
+#define BLIP_WIDTH 16 // Output samples a step is spread over
+#define BLIP_PHASE_BITS 5 // A step starts at one of 32 positions between two output samples
+#define BLIP_KERNEL_BITS 12 // Every kernel phase sums to 1 << BLIP_KERNEL_BITS
+
+// Positions are in output samples with this many fraction bits
+// The APU is clocked at 2^20 M cycles per second, so each of them is EMU_AUDIO_SAMPLE_RATE apart
+#define BLIP_FRAC_BITS 20
+
+#define BLIP_LANES 4 // Outputs kept side by side, integrated together
+
+typedef struct {
+    int32_t delta[EMU_AUDIO_BUFFER_SIZE + BLIP_WIDTH][BLIP_LANES];
+    int32_t sum[BLIP_LANES]; // Running level of the samples already read
+    int level[BLIP_LANES]; // Level after the last step
+} gb_blip_t;
+
+void blip_add(gb_blip_t *blip, int lane, uint32_t pos, int level);
+void blip_read(gb_blip_t *blip, int32_t (*out)[BLIP_LANES], int start, int end);
+void blip_next(gb_blip_t *blip);
+
+#endif
@@ -3,9 +3,19 @@
 
 #include <stddef.h>
 
+#include "emu.h"
+
+// Memory bank controller, picked once when the ROM is loaded
+typedef struct {
+    void (*write)(gb_t *gb, uint16_t addr, uint8_t data); // Registers, 0x0000-0x7FFF
+    uint8_t (*ram_read)(gb_t *gb, uint16_t addr);
+    void (*ram_write)(gb_t *gb, uint16_t addr, uint8_t data);
+} gb_mbc_t;
+
 typedef struct {
     uint8_t *rom;
     uint8_t *ram;
+    const gb_mbc_t *mbc;
 
     uint8_t type;
     uint8_t rom_size;
@@ -15,15 +25,20 @@ typedef struct {
     uint16_t rom_bank;
     uint16_t ram_bank;
     bool bank_mode;
-} gb_cartridge_t;
 
-extern gb_cartridge_t cartridge;
+    // Bank masks from the header, base pointers are kept masked to them
+    uint16_t rom_bank_mask;
+    uint16_t ram_bank_mask;
+    uint8_t *rom_bank_base;
+    uint8_t *ram_bank_base; // NULL when disabled or absent
+} gb_cartridge_t;
 
-void cartridge_load_rom(uint8_t *data, size_t size);
-void cartridge_load_ram(uint8_t *data, size_t size);
-size_t cartridge_get_ram_size();
-size_t cartridge_get_title(char *title);
-uint8_t cartridge_read(uint16_t addr);
-void cartridge_write(uint16_t addr, uint8_t data);
+void cartridge_load_rom(gb_t *gb, uint8_t *data, size_t size);
+void cartridge_map(gb_t *gb);
+void cartridge_load_ram(gb_t *gb, uint8_t *data, size_t size);
+size_t cartridge_get_ram_size(gb_t *gb);
+size_t cartridge_get_title(gb_t *gb, char *title);
+uint8_t cartridge_read(gb_t *gb, uint16_t addr);
+void cartridge_write(gb_t *gb, uint16_t addr, uint8_t data);
 
 #endif
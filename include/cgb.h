@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "emu.h"
+
 #define CGB_SPEED_NORMAL 0
 #define CGB_SPEED_DOUBLE 1
 
@@ -10,9 +12,9 @@ typedef struct {
     uint8_t speed;
 } gb_cgb_t;
 
-void cgb_execute(uint8_t t);
-uint8_t cgb_io_read(uint16_t addr);
-void cgb_io_write(uint16_t addr, uint8_t data);
-bool cgb_speed();
+void cgb_execute(gb_t *gb, uint8_t t);
+uint8_t cgb_io_read(gb_t *gb, uint16_t addr);
+void cgb_io_write(gb_t *gb, uint16_t addr, uint8_t data);
+bool cgb_speed(gb_t *gb);
 
 #endif
@@ -3,10 +3,12 @@
 
 #include <stdint.h>
 
+#include "emu.h"
+
 typedef struct {
     // Registers
     uint8_t a;
-    uint8_t f;
+    uint8_t f; // Only up to date after cpu_snapshot
     uint8_t b;
     uint8_t c;
     uint8_t d;
@@ -17,6 +19,12 @@ typedef struct {
     uint16_t pc;
     bool ime; // Interrupt handling enable
 
+    // Flags, kept the way instructions produce them and only packed into F when it is read
+    uint8_t flag_z; // Z is set when this is 0
+    bool flag_n;
+    uint8_t flag_h; // H is bit 4
+    bool flag_c;
+
     // Internal State
     bool halt;
     bool stop;
@@ -24,9 +32,36 @@ typedef struct {
     uint8_t op;
 } cpu_t;
 
-void cpu_reset();
-uint8_t cpu_execute();
-void cpu_writeback();
-void cpu_continue();
+// Instruction metadata, shared by the interpreter and everything that decodes without executing
+#define CPU_OP_READ         0b0001 // Reads memory besides its operands
+#define CPU_OP_WRITE        0b0010 // Writes memory, any write may switch banks
+#define CPU_OP_END          0b0100 // Ends a translated block: jumps, calls, returns, RST and EI
+#define CPU_OP_INTERPRET    0b1000 // Left to the interpreter: HALT, STOP and unused opcodes
+
+typedef struct {
+    const char *mnemonic;
+    uint8_t length; // Bytes, 0 for unused opcodes
+    uint8_t cycles; // T cycles, for conditional instructions when the condition fails
+    uint8_t taken; // T cycles when the condition holds, the same as cycles otherwise
+    uint8_t flags;
+} cpu_op_t;
+
+// Indexed by opcode, CB prefixed instructions follow at 0x100 + their second byte
+extern const cpu_op_t cpu_ops[512];
+const cpu_op_t *cpu_op_decode(uint8_t op, uint8_t next);
+
+void cpu_reset(gb_t *gb);
+uint8_t cpu_execute(gb_t *gb);
+uint8_t cpu_execute_op(gb_t *gb, uint8_t op, uint16_t imm16);
+#ifndef CPU_REFERENCE
+extern const bool cpu_op_fuses[256];
+bool cpu_execute_fused(gb_t *gb, uint16_t *pc);
+#endif
+#ifdef CPU_REFERENCE
+void cpu_writeback(gb_t *gb);
+#endif
+int cpu_poll_loop(gb_t *gb, uint16_t start, uint16_t end);
+void cpu_continue(gb_t *gb);
+void cpu_snapshot(gb_t *gb);
 
 #endif
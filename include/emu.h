@@ -1,8 +1,12 @@
 #ifndef EMU_H
 #define EMU_H
 
+#include <stdint.h>
 #include <stddef.h>
 
+// Emulator instance, all state lives here
+typedef struct gb_t gb_t;
+
 // Core
 #define EMU_EVENT_NONE  0b00
 #define EMU_EVENT_FRAME 0b01
@@ -10,32 +14,37 @@
 #define EMU_EVENT_ANY   0b11
 
 #ifdef CGB
-typedef void (*emu_frame_callback_t)(uint16_t *buffer);
+typedef void (*emu_frame_callback_t)(gb_t *gb, uint16_t *buffer);
 #else
-typedef void (*emu_frame_callback_t)(uint8_t *buffer);
+typedef void (*emu_frame_callback_t)(gb_t *gb, uint8_t *buffer);
 #endif
 
-typedef void (*emu_audio_callback_t)(int16_t *buffer, int len);
+typedef void (*emu_audio_callback_t)(gb_t *gb, int16_t *buffer, int len);
+typedef void (*emu_audio_float_callback_t)(gb_t *gb, float *buffer, int len);
 
 typedef struct {
     emu_frame_callback_t frame_callback;
     emu_audio_callback_t audio_callback;
+    emu_audio_float_callback_t audio_float_callback; // The same samples from -1 to 1, only converted when set
+    void *userdata; // Owned by the frontend, never touched by the core
 
     bool running;
     bool ppu_enabled;
     bool apu_enabled;
 } gb_emu_t;
 
-extern gb_emu_t emu;
-
-int emu_run_to(int mask);
+gb_t *emu_create();
+void emu_destroy(gb_t *gb);
+gb_emu_t *emu_get(gb_t *gb);
+int emu_run_to(gb_t *gb, int mask);
+void emu_set_audio(gb_t *gb, bool enabled);
 
 // BOOTROM/ROM/SAV
-void emu_load_bootrom(uint8_t *data, size_t size);
-void emu_load_rom(uint8_t *data, size_t size);
-void emu_load_sav(uint8_t *data, size_t size);
-size_t emu_get_sav_size();
-size_t emu_get_title(char *title);
+void emu_load_bootrom(gb_t *gb, uint8_t *data, size_t size);
+void emu_load_rom(gb_t *gb, uint8_t *data, size_t size);
+void emu_load_sav(gb_t *gb, uint8_t *data, size_t size);
+size_t emu_get_sav_size(gb_t *gb);
+size_t emu_get_title(gb_t *gb, char *title);
 
 #define EMU_ROM_SIZE_MIN    32768
 #define EMU_ROM_SIZE_MAX    8388608
@@ -49,8 +58,8 @@ size_t emu_get_title(char *title);
 #endif
 
 // Joypad
-void emu_joypad_down(uint8_t mask);
-void emu_joypad_up(uint8_t mask);
+void emu_joypad_down(gb_t *gb, uint8_t mask);
+void emu_joypad_up(gb_t *gb, uint8_t mask);
 
 #define EMU_JOYPAD_BUTTON_A             0b11011110
 #define EMU_JOYPAD_BUTTON_B             0b11011101
@@ -0,0 +1,54 @@
+#ifndef GB_H
+#define GB_H
+
+#include "emu.h"
+#include "sched.h"
+#include "cpu.h"
+#include "mem.h"
+#include "ppu.h"
+#include "apu.h"
+#include "timer.h"
+#include "serial.h"
+#include "joypad.h"
+#include "cartridge.h"
+
+#ifdef CGB
+#include "cgb.h"
+#include "vdma.h"
+#endif
+
+#ifdef JIT
+#include "jit.h"
+#endif
+
+struct gb_t {
+    gb_emu_t emu;
+    gb_sched_t sched;
+
+    cpu_t cpu;
+#ifdef CPU_REFERENCE
+    // CPU state is mutated here to be written back once t = 0
+    // This ensures things are mostly accurate
+    // Reads are always at fetch, writes always at end of instruction
+    cpu_t cpu_next;
+#endif
+
+    mem_t mem;
+    ppu_t ppu;
+    gb_apu_t apu;
+    gb_timer_t timer;
+    gb_serial_t serial;
+    gb_joypad_t joypad;
+    gb_cartridge_t cartridge;
+
+#ifdef CGB
+    gb_cgb_t cgb;
+    gb_vdma_t vdma;
+#endif
+
+#ifdef JIT
+    gb_jit_t jit;
+#endif
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+#include "emu.h"
+
+// Blocks are looked up by a hash of their address, a colliding block replaces the old one
+#define JIT_BLOCKS 4096
+
+// Runs through the interpreter before a block is compiled
+#define JIT_HOT 16
+
+// Native code runs with gb as its only argument and returns the address of the last instruction it ran
+typedef uint16_t (*jit_code_t)(gb_t *gb);
+
+typedef struct {
+    const uint8_t *host; // Cartridge ROM behind the first instruction
+    uint16_t pc;
+    uint16_t hits;
+    bool interpret; // Starts with an instruction only the interpreter runs
+    jit_code_t code; // NULL until hot
+} jit_block_t;
+
+typedef struct gb_jit_t gb_jit_t;
+struct gb_jit_t {
+    uint8_t *buffer; // NULL when executable memory was not available
+    size_t used;
+    jit_block_t blocks[JIT_BLOCKS];
+    gb_jit_t *cache; // Where blocks are looked up, this one or another instance's with the same ROM
+    atomic_bool busy; // An instance is running from this cache
+    bool claimed; // This instance holds its cache for the current emu_run_to
+};
+
+void jit_init(gb_t *gb);
+void jit_share(gb_t *gb, gb_t *owner);
+void jit_destroy(gb_t *gb);
+void jit_claim(gb_t *gb);
+void jit_release(gb_t *gb);
+bool jit_run(gb_t *gb, uint16_t *pc);
+
+#endif
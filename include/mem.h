@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#include "emu.h"
+
 // Interrupt masks
 #define INT_VBLANK  0b00000001
 #define INT_STAT    0b00000010
@@ -17,6 +19,18 @@
     #define WRAM_SIZE 0x2000
 #endif
 
+#define MEM_PAGE_SIZE 0x100
+#define MEM_PAGES 0x100
+
+#ifdef CPU_REFERENCE
+#define MEM_WRITE_NEXT_LEN 4
+
+typedef struct {
+    uint16_t addr;
+    uint8_t data;
+} mem_write_t;
+#endif
+
 typedef struct {
     uint8_t *bootrom;
     uint8_t wram[WRAM_SIZE];
@@ -30,22 +44,29 @@ typedef struct {
 #endif
 
     bool bootrom_disable;
-} mem_t;
 
-typedef struct {
-    uint16_t addr;
-    uint8_t data;
-} mem_write_t;
+    // Host memory behind each 256 byte page, NULL pages go through the slow path
+    uint8_t *read_page[MEM_PAGES];
+    uint8_t *write_page[MEM_PAGES];
 
-uint8_t mem_read(uint16_t addr);
-void mem_write(uint16_t addr, uint8_t data);
-uint16_t mem_read16(uint16_t addr);
-void mem_write16(uint16_t addr, uint16_t data);
-void mem_load_bootrom(uint8_t *data, size_t size);
-void mem_write_next(uint16_t addr, uint8_t data);
-void mem_write_next16(uint16_t addr, uint16_t data);
-void mem_writeback();
+#ifdef CPU_REFERENCE
+    // Memory write log, to be commited at t = 0
+    mem_write_t writes[MEM_WRITE_NEXT_LEN];
+    int writes_i;
+#endif
+} mem_t;
 
-extern mem_t mem;
+void mem_init(gb_t *gb);
+void mem_map(gb_t *gb, int page, int count, uint8_t *read, uint8_t *write);
+uint8_t mem_read(gb_t *gb, uint16_t addr);
+void mem_write(gb_t *gb, uint16_t addr, uint8_t data);
+uint16_t mem_read16(gb_t *gb, uint16_t addr);
+void mem_write16(gb_t *gb, uint16_t addr, uint16_t data);
+void mem_load_bootrom(gb_t *gb, uint8_t *data, size_t size);
+#ifdef CPU_REFERENCE
+void mem_write_next(gb_t *gb, uint16_t addr, uint8_t data);
+void mem_write_next16(gb_t *gb, uint16_t addr, uint16_t data);
+void mem_writeback(gb_t *gb);
+#endif
 
 #endif
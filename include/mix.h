@@ -0,0 +1,17 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <stdint.h>
+
+// Audio mixing kernels, SIMD versions are picked at load time
+
+#define MIX_CHANNELS 4
+
+// Scale count samples of channel levels by per channel gains into interleaved stereo
+void mix_stereo(float *out, const int32_t (*levels)[MIX_CHANNELS], int count, const float *gain_left, const float *gain_right);
+
+// Convert count mixed values to the output formats, saturating
+void mix_to_s16(int16_t *out, const float *mix, int count);
+void mix_to_f32(float *out, const float *mix, int count);
+
+#endif
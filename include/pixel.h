@@ -0,0 +1,17 @@
+#ifndef PIXEL_H
+#define PIXEL_H
+
+#include <stdint.h>
+
+// Pixel kernels shared by the PPUs, SIMD versions are picked at load time
+
+// Decode a tile's bitplanes into color indices, as stored and X flipped
+void pixel_decode(uint8_t *out, uint8_t *out_flip, const uint8_t *data);
+
+// Map color indices through a DMG palette register
+void pixel_map_dmg(uint8_t *out, const uint8_t *index, int count, uint8_t palette);
+
+// Map palette * 4 + color indices through CGB palette data
+void pixel_map_cgb(uint16_t *out, const uint8_t *index, int count, const uint8_t *palette_data);
+
+#endif
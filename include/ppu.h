@@ -3,12 +3,25 @@
 
 #include <stdint.h>
 
+#include "emu.h"
+
 #ifdef CGB
 #define VRAM_SIZE 0x4000
 #else
 #define VRAM_SIZE 0x2000
 #endif
 
+#define PPU_LINE_OBJS 10 // Objects per line
+#define PPU_TILES 384 // Tiles per VRAM bank
+#define PPU_TILE_BANKS (VRAM_SIZE / 0x2000)
+
+typedef struct {
+    uint8_t x;
+    uint8_t tile; // 8x16 masking applied
+    uint8_t row; // Object row on this line, Y flip applied
+    uint8_t flags;
+} ppu_obj_t;
+
 typedef struct {
     // MMIO Registers
     uint8_t lcdc; // LCD control
@@ -34,10 +47,21 @@ typedef struct {
 
     uint8_t vram[VRAM_SIZE];
 
+    // Decoded tiles, a color index per pixel as stored and X flipped
+    // Re-decoded on first use after a write to their VRAM
+    uint8_t tile_cache[PPU_TILE_BANKS * PPU_TILES][2][8][8];
+    bool tile_dirty[PPU_TILE_BANKS * PPU_TILES];
+
     int dot; // Current dot in frame
     uint8_t mode;
     uint8_t lx; // Virtual lx for decoupling with dot while rendering
     bool stat_int;
+
+    // Objects on the current line in priority order, picked by the OAM scan
+    ppu_obj_t objs[PPU_LINE_OBJS];
+    uint8_t obj_count;
+
+    uint64_t cycles; // Master clock cycle caught up to
 #ifdef CGB
     uint16_t fb[160*144];
 #else
@@ -45,13 +69,14 @@ typedef struct {
 #endif
 } ppu_t;
 
-extern ppu_t ppu;
-
-bool ppu_execute(uint8_t t);
-bool ppu_enabled();
-uint8_t ppu_io_read(uint8_t addr);
-void ppu_io_write(uint8_t addr, uint8_t data);
-uint8_t ppu_vram_read(uint16_t addr);
-void ppu_vram_write(uint16_t addr, uint8_t data);
+bool ppu_execute(gb_t *gb, int t);
+void ppu_sync(gb_t *gb);
+void ppu_schedule(gb_t *gb);
+bool ppu_enabled(gb_t *gb);
+uint8_t ppu_io_read(gb_t *gb, uint8_t addr);
+void ppu_io_write(gb_t *gb, uint8_t addr, uint8_t data);
+uint8_t ppu_vram_read(gb_t *gb, uint16_t addr);
+void ppu_vram_write(gb_t *gb, uint16_t addr, uint8_t data);
+void ppu_tile_dirty(gb_t *gb, uint16_t index);
 
 #endif
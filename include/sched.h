@@ -0,0 +1,36 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+#include "emu.h"
+
+#define SCHED_NEVER UINT64_MAX
+
+// Longest span a unit is left behind the master clock, keeps catch-up counts in an int
+#define SCHED_SPAN_MAX 0x100000
+
+typedef enum {
+    SCHED_PPU, // Mode change, LY change or end of frame
+    SCHED_APU, // Audio buffer full
+    SCHED_TIMER, // TIMA overflow
+    SCHED_SERIAL, // Transfer complete
+#ifdef CGB
+    SCHED_VDMA, // Transfer requested
+#endif
+    SCHED_EMU, // Frontend events pending
+    SCHED_COUNT
+} sched_event_t;
+
+typedef struct {
+    uint64_t cycles; // Master clock (T cycles)
+    uint64_t deadline[SCHED_COUNT];
+    uint64_t next; // Earliest deadline
+    int events; // Frontend events raised since the last dispatch
+} gb_sched_t;
+
+void sched_init(gb_t *gb);
+void sched_set(gb_t *gb, sched_event_t event, uint64_t cycles);
+void sched_raise(gb_t *gb, int event);
+
+#endif
@@ -1,15 +1,21 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
+#include "emu.h"
+
 typedef struct {
     uint8_t sb;
     uint8_t sc;
 
     int counter;
+    uint64_t cycles; // Master clock cycle caught up to
 } gb_serial_t;
 
-void serial_execute(uint8_t t);
-uint8_t serial_io_read(uint8_t addr);
-void serial_io_write(uint8_t addr, uint8_t data);
+void serial_init(gb_t *gb);
+void serial_execute(gb_t *gb, int t);
+void serial_sync(gb_t *gb);
+void serial_schedule(gb_t *gb);
+uint8_t serial_io_read(gb_t *gb, uint8_t addr);
+void serial_io_write(gb_t *gb, uint8_t addr, uint8_t data);
 
 #endif
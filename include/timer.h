@@ -3,6 +3,8 @@
 
 #include <stdint.h>
 
+#include "emu.h"
+
 typedef struct {
     uint8_t div;
     uint8_t tima;
@@ -12,12 +14,13 @@ typedef struct {
     // Internal state
     uint16_t counter;
     bool clock_last;
+    uint64_t cycles; // Master clock cycle caught up to
 } gb_timer_t;
 
-extern gb_timer_t timer;
-
-void timer_execute(uint8_t t);
-uint8_t timer_io_read(uint8_t addr);
-void timer_io_write(uint8_t addr, uint8_t data);
+void timer_execute(gb_t *gb, int t);
+void timer_sync(gb_t *gb);
+void timer_schedule(gb_t *gb);
+uint8_t timer_io_read(gb_t *gb, uint8_t addr);
+void timer_io_write(gb_t *gb, uint8_t addr, uint8_t data);
 
 #endif
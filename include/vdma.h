@@ -1,6 +1,8 @@
 #ifndef VDMA_H
 #define VDMA_H
 
+#include "emu.h"
+
 typedef struct {
     uint16_t source;
     uint16_t destination;
@@ -9,8 +11,8 @@ typedef struct {
     bool start;
 } gb_vdma_t;
 
-void vdma_execute(uint8_t t);
-uint8_t vdma_io_read(uint8_t addr);
-void vdma_io_write(uint8_t addr, uint8_t data);
+void vdma_execute(gb_t *gb);
+uint8_t vdma_io_read(gb_t *gb, uint8_t addr);
+void vdma_io_write(gb_t *gb, uint8_t addr, uint8_t data);
 
 #endif
@@ -0,0 +1,39 @@
+#ifdef AOT
+
+#include <stdint.h>
+
+#include "aot.h"
+#include "cpu.h"
+#include "mem.h"
+#include "gb.h"
+
+// Run generated code from PC if there is any, pc is set to the last instruction it ran
+// Like a JIT block it stops at the deadline, when an interrupt is due or when it jumps
+bool aot_run(gb_t *gb, uint16_t *pc) {
+    cpu_t *cpu = &gb->cpu;
+
+    // Generated code only starts where the interpreter would run a plain instruction
+    if (cpu->halt || cpu->stop || cpu->ime_pending || (cpu->ime && (gb->mem.ie & gb->mem.iflag))) {
+        return false;
+    }
+
+    uint8_t *page = gb->mem.read_page[cpu->pc >> 8];
+    if (cpu->pc >= 0x8000 || page == NULL) {
+        return false;
+    }
+
+    // The code only fits the ROM it was generated from
+    if (((gb->cartridge.rom[0x14E] << 8) | gb->cartridge.rom[0x14F]) != aot_checksum) {
+        return false;
+    }
+
+    int last = aot_execute(gb, (page - gb->cartridge.rom) / 0x4000);
+    if (last < 0) {
+        return false;
+    }
+
+    *pc = last;
+    return true;
+}
+
+#endif
@@ -4,8 +4,11 @@
 
 #include "apu.h"
 #include "timer.h"
+#include "sched.h"
+#include "mix.h"
 #include "log.h"
 #include "emu.h"
+#include "gb.h"
 
 #ifdef CGB
 #include "cgb.h"
@@ -71,16 +74,45 @@
 #define APU_CH4_RAND_CLK_SEL        0b11110000
 #define APU_CH4_RAND_CLK_SEL_SHIFT  4
 
-const uint8_t APU_PULSE_SAMPLES[] = {
-    0b11111110,
-    0b01111110,
-    0b01111000,
-    0b10000001
+// Duty cycles, one output bit per step
+const uint8_t APU_PULSE_SAMPLES[4][8] = {
+    {0, 1, 1, 1, 1, 1, 1, 1},
+    {0, 1, 1, 1, 1, 1, 1, 0},
+    {0, 0, 0, 1, 1, 1, 1, 0},
+    {1, 0, 0, 0, 0, 0, 0, 1}
 };
 
-gb_apu_t apu = {};
+// One M cycle in blip positions, see BLIP_FRAC_BITS
+#define APU_BLIP_STEP EMU_AUDIO_SAMPLE_RATE
+#define APU_BLIP_END (EMU_AUDIO_BUFFER_SIZE << BLIP_FRAC_BITS)
 
-void pulse_execute(gb_apu_pulse_t *ch, int ch_num) {
+// Longest span apu_sync catches up on at once with audio off, about a second
+#define APU_SILENT_SPAN (1 << 22)
+
+// Level a channel adds to the mix, centered on its volume so an idle channel is silent
+static void apu_output(gb_t *gb, int lane, uint32_t pos, uint8_t sample, uint8_t volume) {
+    blip_add(&gb->apu.blip, lane, pos, sample - (volume / 2));
+}
+
+// Run the period timer for count M cycles from pos, every overflow moves to the next duty step
+static void pulse_run(gb_t *gb, gb_apu_pulse_t *ch, int ch_num, uint32_t pos, int count) {
+    const uint8_t *duty = APU_PULSE_SAMPLES[(ch->length_duty & APU_CH_LD_DUTY) >> APU_CH_LD_DUTY_SHIFT];
+    int interval = (ch->period <= 0b11111111111) ? 0b100000000000 - ch->period : 1;
+    int first = 0b100000000000 - ch->period_timer;
+
+    int last = 0;
+    for (int m = (first > 1) ? first : 1; m <= count; m += interval) {
+        ch->sample = duty[ch->pulse_index] * ch->volume;
+        ch->pulse_index = (ch->pulse_index + 1) % 8;
+        apu_output(gb, ch_num - 1, pos + ((m - 1) * APU_BLIP_STEP), ch->sample, ch->volume);
+
+        ch->period_timer = ch->period;
+        last = m;
+    }
+    ch->period_timer += count - last;
+}
+
+void pulse_execute(gb_t *gb, gb_apu_pulse_t *ch, int ch_num, uint32_t pos) {
     uint8_t ch_control = (ch_num == 1) ? APU_CONTROL_CH1 : APU_CONTROL_CH2;
 
     // Trigger
@@ -97,31 +129,18 @@ void pulse_execute(gb_apu_pulse_t *ch, int ch_num) {
 
         ch->control &= ~APU_CH_CONTROL_TRIGGER;
 
-        apu.control |= ch_control;
+        gb->apu.control |= ch_control;
 
         DEBUG_PRINTF_APU("CH%d ON!\n", ch_num);
     }
 
     // Execute
-    if (apu.control & ch_control) {
-        ch->period_timer++;
-        // If period timer overflows, execute
-        if (ch->period_timer > 0b11111111111) {
-            // Get the duty sample byte and extract the current bit
-            uint8_t wave_duty = (ch->length_duty & APU_CH_LD_DUTY) >> APU_CH_LD_DUTY_SHIFT;
-            uint8_t pulse_samples = APU_PULSE_SAMPLES[wave_duty];
-            ch->sample = (pulse_samples >> ch->pulse_index) & 1;
-            ch->pulse_index = (ch->pulse_index + 1) % 8;
-
-            // Volume
-            ch->sample *= ch->volume;
-
-            ch->period_timer = ch->period;
-        }
+    if (gb->apu.control & ch_control) {
+        if (!gb->apu.silent) { pulse_run(gb, ch, ch_num, pos, 1); }
 
         // Sweep (CH1)
         if (ch_num == 1) {
-            if (ch->sweep & APU_CH1_SWEEP_PACE && apu.sweep_clock) {
+            if (ch->sweep & APU_CH1_SWEEP_PACE && gb->apu.sweep_clock) {
                 if (ch->sweep_timer <= 0) {
                     uint8_t step = ch->sweep & APU_CH1_SWEEP_STEP;
                     bool direction = ch->sweep & APU_CH1_SWEEP_DIRECTION;
@@ -148,13 +167,13 @@ void pulse_execute(gb_apu_pulse_t *ch, int ch_num) {
 
             // Always turn of channel if period overflows
             if (!(ch->sweep & APU_CH1_SWEEP_DIRECTION) && (ch->period > 0b11111111111)) {
-                apu.control &= ~ch_control;
+                gb->apu.control &= ~ch_control;
                 DEBUG_PRINTF_APU("CH%d SWEEP OFF!\n", ch_num);
             }
         }
 
         // Envelope
-        if (ch->envelope_pace && apu.envelope_clock) {
+        if (ch->envelope_pace && gb->apu.envelope_clock) {
             ch->envelope_timer -= 1;
             if (ch->envelope_timer <= 0) {
                 if (ch->envelope_dir) {
@@ -169,23 +188,50 @@ void pulse_execute(gb_apu_pulse_t *ch, int ch_num) {
 
         // Envelope DAC disable
         if (!(ch->envelope & (APU_CH_ENVELOPE_VOL | APU_CH_ENVELOPE_DIR))) {
-            apu.control &= ~ch_control;
+            gb->apu.control &= ~ch_control;
             DEBUG_PRINTF_APU("CH%d DAC OFF!\n", ch_num);
         }
 
         // Length
         bool length_enable = ch->control & APU_CH_CONTROL_LENGTH;
-        ch->length_timer -= apu.length_clock && length_enable;
+        ch->length_timer -= gb->apu.length_clock && length_enable;
         if (ch->length_timer == 0 && length_enable) {
-            apu.control &= ~ch_control;
+            gb->apu.control &= ~ch_control;
             DEBUG_PRINTF_APU("CH%d TIMER OFF!\n", ch_num);
         }
     } else {
         ch->sample = ch->volume / 2;
     }
+
+    if (!gb->apu.silent) { apu_output(gb, ch_num - 1, pos, ch->sample, ch->volume); }
 }
 
-void wave_execute(gb_apu_wave_t *ch) {
+// Run the period timer for count M cycles from pos, it counts in 2s and steps through wave RAM
+static void wave_run(gb_t *gb, gb_apu_wave_t *ch, uint32_t pos, int count) {
+    uint8_t volume = (ch->level & APU_CH3_LEVEL_OUTPUT) >> APU_CH3_LEVEL_OUTPUT_SHIFT;
+    int interval = (0b100000000001 - ch->period) / 2;
+    int first = (0b100000000001 - ch->period_timer) / 2;
+
+    int last = 0;
+    for (int m = (first > 1) ? first : 1; m <= count; m += interval) {
+        // Volume/level
+        if (volume) {
+            ch->volume = 15 >> (volume-1);
+            ch->sample = ch->samples[ch->wave_index] >> (volume-1);
+        } else {
+            ch->volume = 0;
+            ch->sample = 0;
+        }
+        ch->wave_index = (ch->wave_index + 1) % 32;
+        apu_output(gb, 2, pos + ((m - 1) * APU_BLIP_STEP), ch->sample, ch->volume);
+
+        ch->period_timer = ch->period;
+        last = m;
+    }
+    ch->period_timer += (count - last) * 2;
+}
+
+void wave_execute(gb_t *gb, gb_apu_wave_t *ch, uint32_t pos) {
     // Trigger
     if (ch->control & APU_CH_CONTROL_TRIGGER) {
         ch->length_timer = 255 - ch->length;
@@ -196,54 +242,70 @@ void wave_execute(gb_apu_wave_t *ch) {
 
         ch->control &= ~APU_CH_CONTROL_TRIGGER;
 
-        apu.control |= APU_CONTROL_CH3;
+        gb->apu.control |= APU_CONTROL_CH3;
 
         DEBUG_PRINTF_APU("CH3 ON!\n");
     }
 
     // Execute
-    if (apu.control & APU_CONTROL_CH3) {
-        ch->period_timer += 2;
-        // If period timer overflows, execute
-        if (ch->period_timer > 0b11111111111) {
-            // Get the duty sample byte and extract the current bit
-            uint8_t wave_samples = ch->wave[ch->wave_index/2];
-            int wave_shift = (ch->wave_index & 1) * 4;
-            ch->sample = (wave_samples >> wave_shift) & 0b00001111;
-            ch->wave_index = (ch->wave_index + 1) % 32;
-
-            // Volume/level
-            uint8_t volume = (ch->level & APU_CH3_LEVEL_OUTPUT) >> APU_CH3_LEVEL_OUTPUT_SHIFT;
-            if (volume) {
-                ch->volume = 15 >> (volume-1);
-                ch->sample = ch->sample >> (volume-1);
-            } else {
-                ch->volume = 0;
-                ch->sample = 0;
-            }
-
-            ch->period_timer = ch->period;
-        }
+    if (gb->apu.control & APU_CONTROL_CH3) {
+        if (!gb->apu.silent) { wave_run(gb, ch, pos, 1); }
 
         // Length
         bool length_enable = ch->control & APU_CH_CONTROL_LENGTH;
-        ch->length_timer -= apu.length_clock && length_enable;
+        ch->length_timer -= gb->apu.length_clock && length_enable;
         if (ch->length_timer == 0 && length_enable) {
-            apu.control &= ~APU_CONTROL_CH3;
+            gb->apu.control &= ~APU_CONTROL_CH3;
             DEBUG_PRINTF_APU("CH3 TIMER OFF!\n");
         }
 
         // DAC enable
         if (!ch->dac) {
-            apu.control &= ~APU_CONTROL_CH3;
+            gb->apu.control &= ~APU_CONTROL_CH3;
             DEBUG_PRINTF_APU("CH3 DAC OFF!\n");
         }
     } else {
         ch->sample = ch->volume / 2;
     }
+
+    if (!gb->apu.silent) { apu_output(gb, 2, pos, ch->sample, ch->volume); }
+}
+
+// M cycles between LFSR clocks
+static int noise_timer_target(gb_apu_noise_t *ch) {
+    uint8_t clock_div = ch->rand & APU_CH4_RAND_CLK_DIV;
+    uint8_t clock_shift = (ch->rand & APU_CH4_RAND_CLK_SEL) >> APU_CH4_RAND_CLK_SEL_SHIFT;
+
+    if (clock_div == 0) {
+        return 2 << clock_shift;
+    } else {
+        return (4 * clock_div) << clock_shift;
+    }
+}
+
+// Run the LFSR timer for count M cycles from pos, the LFSR shifts out a bit on every clock
+// The register already holds its next 15 output bits, so there is nothing to gain from a table
+static void noise_run(gb_t *gb, gb_apu_noise_t *ch, uint32_t pos, int count) {
+    int interval = noise_timer_target(ch);
+    int first = interval - ch->lfsr_timer + 1;
+    uint16_t feedback = (ch->rand & APU_CH4_RAND_LFSR_WIDTH) ? (1 << 15) | (1 << 7) : (1 << 15);
+
+    int last = 0;
+    for (int m = (first > 1) ? first : 1; m <= count; m += interval) {
+        // Bit 15 (and 7 in short mode) become bit 0 == bit 1
+        bool result = (ch->lfsr & 1) == ((ch->lfsr & 0b10) >> 1);
+        ch->lfsr = (ch->lfsr & ~feedback) | (result ? feedback : 0);
+
+        ch->sample = (ch->lfsr & 1) * ch->volume;
+        ch->lfsr = ch->lfsr >> 1;
+        apu_output(gb, 3, pos + ((m - 1) * APU_BLIP_STEP), ch->sample, ch->volume);
+
+        last = m;
+    }
+    ch->lfsr_timer = last ? 1 + (count - last) : ch->lfsr_timer + count;
 }
 
-void noise_execute(gb_apu_noise_t *ch) {
+void noise_execute(gb_t *gb, gb_apu_noise_t *ch, uint32_t pos) {
     // Trigger
     if (ch->control & APU_CH_CONTROL_TRIGGER) {
         ch->length_timer = 63 - (ch->length & APU_CH_LD_LENGTH);
@@ -255,53 +317,17 @@ void noise_execute(gb_apu_noise_t *ch) {
         ch->lfsr = 0;
 
         ch->control &= ~APU_CH_CONTROL_TRIGGER;
-        apu.control |= APU_CONTROL_CH4;
+        gb->apu.control |= APU_CONTROL_CH4;
 
         DEBUG_PRINTF_APU("CH4 ON!\n");
     }
 
     // Execute
-    if (apu.control & APU_CONTROL_CH4) {
-        // LFSR clock
-        uint8_t clock_div = ch->rand & APU_CH4_RAND_CLK_DIV;
-        uint8_t clock_shift = (ch->rand & APU_CH4_RAND_CLK_SEL) >> APU_CH4_RAND_CLK_SEL_SHIFT;
-
-        int timer_target;
-        if (clock_div == 0) {
-            timer_target = 2 << clock_shift;
-        } else {
-            timer_target = (4 * clock_div) << clock_shift;
-        }
-
-        bool lfsr_clock = false;
-
-        if (ch->lfsr_timer >= timer_target) {
-            ch->lfsr_timer = 0;
-            lfsr_clock = true;
-        }
-
-        ch->lfsr_timer++;
-
-        // LFSR
-        if (lfsr_clock) {
-            bool bit0 = ch->lfsr & 1;
-            bool bit1 = (ch->lfsr & 0b10) >> 1;
-            bool result = bit0 == bit1;
-
-            ch->lfsr &= ~(1 << 15); // Clear bit
-            ch->lfsr |= (1 << 15) * result; // Set bit
-            if (ch->rand & APU_CH4_RAND_LFSR_WIDTH) { // Short mode
-                ch->lfsr &= ~(1 << 7); // Clear bit
-                ch->lfsr |= (1 << 7) * result; // Set bit
-            }
-
-            ch->sample = (ch->lfsr & 1) * ch->volume;
-
-            ch->lfsr = ch->lfsr >> 1;
-        }
+    if (gb->apu.control & APU_CONTROL_CH4) {
+        if (!gb->apu.silent) { noise_run(gb, ch, pos, 1); }
 
         // Envelope
-        if (ch->envelope_pace && apu.envelope_clock) {
+        if (ch->envelope_pace && gb->apu.envelope_clock) {
             ch->envelope_timer -= 1;
             if (ch->envelope_timer <= 0) {
                 if (ch->envelope_dir) {
@@ -316,184 +342,346 @@ void noise_execute(gb_apu_noise_t *ch) {
 
         // Envelope DAC disable
         if (!(ch->envelope & (APU_CH_ENVELOPE_VOL | APU_CH_ENVELOPE_DIR))) {
-            apu.control &= ~APU_CONTROL_CH4;
+            gb->apu.control &= ~APU_CONTROL_CH4;
             DEBUG_PRINTF_APU("CH4 DAC OFF!\n");
         }
 
         // Length
         bool length_enable = ch->control & APU_CH_CONTROL_LENGTH;
-        ch->length_timer -= apu.length_clock && length_enable;
+        ch->length_timer -= gb->apu.length_clock && length_enable;
         if (ch->length_timer == 0 && length_enable) {
-            apu.control &= ~APU_CONTROL_CH4;
+            gb->apu.control &= ~APU_CONTROL_CH4;
             DEBUG_PRINTF_APU("CH4 TIMER OFF!\n");
         }
     } else {
         ch->sample = ch->volume / 2;
     }
+
+    if (!gb->apu.silent) { apu_output(gb, 3, pos, ch->sample, ch->volume); }
 }
 
-bool apu_execute(uint8_t t) {
-    bool new_buffer = false;
+// Per channel gains for the mixer, NR51 panning masks out channels and NR50 scales the rest
+static void apu_gains(gb_t *gb) {
+    // Levels come out of the blip buffer scaled by 1 << BLIP_KERNEL_BITS
+    float unit = (float)(APU_SAMPLE_HIGH / 15) / (1 << BLIP_KERNEL_BITS);
+
+    // Master volume
+    uint8_t volume_left = (gb->apu.volume_vin & APU_VOLUME_LEFT) >> APU_VOLUME_LEFT_SHIFT;
+    uint8_t volume_right = gb->apu.volume_vin & APU_VOLUME_RIGHT;
+    float scale_left = unit / (16 - ((volume_left * 2) + 1));
+    float scale_right = unit / (16 - ((volume_right * 2) + 1));
+
+    // Pan
+    for (int ch = 0; ch < MIX_CHANNELS; ch++) {
+        gb->apu.gain_left[ch] = (gb->apu.panning & (APU_PAN_LEFT_CH1 << ch)) ? scale_left : 0.0f;
+        gb->apu.gain_right[ch] = (gb->apu.panning & (APU_PAN_RIGHT_CH1 << ch)) ? scale_right : 0.0f;
+    }
+}
 
-    // Step on M cycles
-    for (int m = 0; m < t/4; m++) {
+// Mix the buffer up to sample end with the current panning and master volume
+static void apu_mix_to(gb_t *gb, int end) {
+    int32_t levels[EMU_AUDIO_BUFFER_SIZE][BLIP_LANES];
+    int start = gb->apu.mixed;
+
+    blip_read(&gb->apu.blip, levels, start, end);
+    mix_stereo(&gb->apu.mix[start * 2], &levels[start], end - start, gb->apu.gain_left, gb->apu.gain_right);
+    gb->apu.mixed = end;
+}
+
+// DIV bit whose falling edge clocks DIV_APU
+static int apu_div_bit(gb_t *gb) {
 #ifdef CGB
-        static bool half_timer = false;
-        if (cgb_speed() == CGB_SPEED_DOUBLE) {
-            half_timer = !half_timer;
-        } else {
-            half_timer = true;
-        }
-        if (half_timer && (apu.control & APU_CONTROL_AUDIO)) {
+    if (cgb_speed(gb) == CGB_SPEED_DOUBLE) {
+        return 8 + 5;
+    }
 #else
-        if (apu.control & APU_CONTROL_AUDIO) {
+    (void)gb;
 #endif
-            // Clocks
+    return 8 + 4;
+}
+
+// One APU M cycle with the DIV counter at counter, returns true if it finished a buffer
+static bool apu_step(gb_t *gb, uint16_t counter) {
+    bool new_buffer = false;
+
+    // Clocks
+
+    // DIV_APU is updated on DIV bit 4 going low
+    gb->apu.div_clock = (counter >> apu_div_bit(gb)) & 1;
+    gb->apu.div_apu += !gb->apu.div_clock && gb->apu.div_clock_last;
+    gb->apu.div_clock_last = gb->apu.div_clock;
+
+    gb->apu.length_clock = (!(gb->apu.div_apu & 1)) && gb->apu.length_clock_last;
+    gb->apu.length_clock_last = gb->apu.div_apu & 1;
 
-            // DIV_APU is updated on DIV bit 4 going low
-            int div_shift = 4;
+    gb->apu.sweep_clock = (!(gb->apu.div_apu & 0b10)) && gb->apu.sweep_clock_last;
+    gb->apu.sweep_clock_last = gb->apu.div_apu & 0b10;
+
+    gb->apu.envelope_clock = (!(gb->apu.div_apu & 0b100)) && gb->apu.envelope_clock_last;
+    gb->apu.envelope_clock_last = gb->apu.div_apu & 0b100;
+
+    // Channel execute
+    pulse_execute(gb, &gb->apu.ch1, 1, gb->apu.blip_pos);
+    pulse_execute(gb, &gb->apu.ch2, 2, gb->apu.blip_pos);
+    wave_execute(gb, &gb->apu.ch3, gb->apu.blip_pos);
+    noise_execute(gb, &gb->apu.ch4, gb->apu.blip_pos);
+
+    if (gb->apu.silent) {
+        return false;
+    }
+
+    gb->apu.blip_pos += APU_BLIP_STEP;
+    if (gb->apu.blip_pos >= APU_BLIP_END) {
+        apu_mix_to(gb, EMU_AUDIO_BUFFER_SIZE);
+        mix_to_s16(gb->apu.buffer, gb->apu.mix, EMU_AUDIO_BUFFER_SIZE*2);
+        if (gb->emu.audio_float_callback != NULL) {
+            mix_to_f32(gb->apu.buffer_float, gb->apu.mix, EMU_AUDIO_BUFFER_SIZE*2);
+        }
+        blip_next(&gb->apu.blip);
+        gb->apu.mixed = 0;
+        gb->apu.blip_pos -= APU_BLIP_END;
+        new_buffer = true;
+    }
+
+    return new_buffer;
+}
+
+// APU M cycles after a step in which the frame sequencer does nothing and the buffer is not done
+// Triggers, register writes and DAC or length cut-offs have all been seen by the step, the
+// channels run on their own until then
+static int apu_quiet(gb_t *gb, uint16_t counter, int stride) {
+    int bit = apu_div_bit(gb);
+    int quiet = (((1 << bit) - (counter & ((1 << bit) - 1))) - 1) / (4 * stride);
+    if (gb->apu.silent) {
+        return quiet;
+    }
+
+    int buffer = (APU_BLIP_END - 1 - gb->apu.blip_pos) / APU_BLIP_STEP;
+
+    // A channel that was just turned off still has to settle on its off sample
+    if ((!(gb->apu.control & APU_CONTROL_CH1) && gb->apu.ch1.sample != gb->apu.ch1.volume / 2) ||
+        (!(gb->apu.control & APU_CONTROL_CH2) && gb->apu.ch2.sample != gb->apu.ch2.volume / 2) ||
+        (!(gb->apu.control & APU_CONTROL_CH3) && gb->apu.ch3.sample != gb->apu.ch3.volume / 2) ||
+        (!(gb->apu.control & APU_CONTROL_CH4) && gb->apu.ch4.sample != gb->apu.ch4.volume / 2)) {
+        return 0;
+    }
+
+    return (buffer < quiet) ? buffer : quiet;
+}
+
+// Run quiet APU M cycles at once, each channel generates the whole run in one go
+static void apu_skip(gb_t *gb, int count) {
+    if (gb->apu.silent) {
+        return;
+    }
+
+    uint32_t pos = gb->apu.blip_pos;
+
+    if (gb->apu.control & APU_CONTROL_CH1) { pulse_run(gb, &gb->apu.ch1, 1, pos, count); }
+    if (gb->apu.control & APU_CONTROL_CH2) { pulse_run(gb, &gb->apu.ch2, 2, pos, count); }
+    if (gb->apu.control & APU_CONTROL_CH3) { wave_run(gb, &gb->apu.ch3, pos, count); }
+    if (gb->apu.control & APU_CONTROL_CH4) { noise_run(gb, &gb->apu.ch4, pos, count); }
+
+    gb->apu.blip_pos += count * APU_BLIP_STEP;
+}
+
+bool apu_execute(gb_t *gb, int t) {
+    bool new_buffer = false;
+
+    // The timer has already been caught up, rewind to the DIV counter at the start of this span
+    uint16_t counter = gb->timer.counter - t;
+    int count = t/4;
+
+    // CPU M cycles per APU M cycle
+    int stride = 1;
 #ifdef CGB
-            if (cgb_speed() == CGB_SPEED_DOUBLE) {
-                div_shift = 5;
-            }
+    if (cgb_speed(gb) == CGB_SPEED_DOUBLE) {
+        stride = 2;
+    }
 #endif
-            apu.div_clock = (timer.div >> div_shift) & 1;
-            apu.div_apu += !apu.div_clock && apu.div_clock_last;
-            apu.div_clock_last = apu.div_clock;
-
-            apu.length_clock = (!(apu.div_apu & 1)) && apu.length_clock_last;
-            apu.length_clock_last = apu.div_apu & 1;
-
-            apu.sweep_clock = (!(apu.div_apu & 0b10)) && apu.sweep_clock_last;
-            apu.sweep_clock_last = apu.div_apu & 0b10;
-
-            apu.envelope_clock = (!(apu.div_apu & 0b100)) && apu.envelope_clock_last;
-            apu.envelope_clock_last = apu.div_apu & 0b100;
-
-            // Channel execute
-            pulse_execute(&apu.ch1, 1);
-            pulse_execute(&apu.ch2, 2);
-            wave_execute(&apu.ch3);
-            noise_execute(&apu.ch4);
-
-            // Mix
-            float timer_target = (float)1048576 / (float)EMU_AUDIO_SAMPLE_RATE; // (M cycles)/(audio samples) per second
-            timer_target *= 0.963; // WHAT IS THIS MAGIC NUMBER???
-            if (apu.buffer_index_timer >= timer_target) {
-                // Get samples and convert to output format
-                int16_t sample_unit = (APU_SAMPLE_HIGH / 15);
-                int16_t ch1_sample = (apu.ch1.sample - (apu.ch1.volume / 2)) * sample_unit;
-                int16_t ch2_sample = (apu.ch2.sample - (apu.ch2.volume / 2)) * sample_unit;
-                int16_t ch3_sample = (apu.ch3.sample - (apu.ch3.volume / 2)) * sample_unit;
-                int16_t ch4_sample = (apu.ch4.sample - (apu.ch4.volume / 2)) * sample_unit;
-
-                // Write out samples and pan
-                int16_t *left = &apu.buffer[apu.buffer_index];
-                int16_t *right = &apu.buffer[apu.buffer_index+1];
-                *left = 0;
-                *right = 0;
-
-                *left += (apu.panning & APU_PAN_LEFT_CH1) ? ch1_sample : 0;
-                *right += (apu.panning & APU_PAN_RIGHT_CH1) ? ch1_sample : 0;
-                *left += (apu.panning & APU_PAN_LEFT_CH2) ? ch2_sample : 0;
-                *right += (apu.panning & APU_PAN_RIGHT_CH2) ? ch2_sample : 0;
-                *left += (apu.panning & APU_PAN_LEFT_CH3) ? ch3_sample : 0;
-                *right += (apu.panning & APU_PAN_RIGHT_CH3) ? ch3_sample : 0;
-                *left += (apu.panning & APU_PAN_LEFT_CH4) ? ch4_sample : 0;
-                *right += (apu.panning & APU_PAN_RIGHT_CH4) ? ch4_sample : 0;
-
-                // Master volume
-                uint8_t volume_left = (apu.volume_vin & APU_VOLUME_LEFT) >> APU_VOLUME_LEFT_SHIFT;
-                uint8_t volume_right = apu.volume_vin & APU_VOLUME_RIGHT;
-                *left /= 16 - ((volume_left * 2) + 1);
-                *right /= 16 - ((volume_right * 2) + 1);
-
-                apu.buffer_index_timer -= timer_target;
-                apu.buffer_index += 2;
-                if (apu.buffer_index >= EMU_AUDIO_BUFFER_SIZE*2) {
-                    apu.buffer_index = 0;
-                    new_buffer = true;
-                }
-            } else {
-                apu.buffer_index_timer++;
-            }
+
+    if (!(gb->apu.control & APU_CONTROL_AUDIO)) {
+#ifdef CGB
+        // Only the half timer keeps going
+        gb->apu.half_timer = (stride == 1) || (gb->apu.half_timer ^ (count & 1));
+#endif
+        return false;
+    }
+
+    // Step only where the frame sequencer or the buffer needs it, the channels run in between
+    for (int m = 0; m < count; m++) {
+#ifdef CGB
+        if (stride == 2) {
+            gb->apu.half_timer = !gb->apu.half_timer;
+        } else {
+            gb->apu.half_timer = true;
+        }
+        if (!gb->apu.half_timer) {
+            counter += 4;
+            continue;
+        }
+#endif
+        new_buffer |= apu_step(gb, counter);
+
+        // The half timer is set again after the last skipped cycle
+        int skip = apu_quiet(gb, counter, stride);
+        int left = (count - 1 - m) / stride;
+        if (left < skip) {
+            skip = left;
         }
+        apu_skip(gb, skip);
+        m += skip * stride;
+        counter += (skip * stride + 1) * 4;
     }
 
     return new_buffer;
 }
 
-bool apu_enabled() {
-    return apu.control | APU_CONTROL_AUDIO;
+void apu_sync(gb_t *gb) {
+    int t = gb->sched.cycles - gb->apu.cycles;
+    if (t == 0) {
+        return;
+    }
+    gb->apu.cycles = gb->sched.cycles;
+
+    // The frame sequencer follows DIV
+    timer_sync(gb);
+
+    if (apu_execute(gb, t)) {
+        sched_raise(gb, EMU_EVENT_AUDIO);
+    }
+}
+
+void apu_schedule(gb_t *gb) {
+    if (!(gb->apu.control & APU_CONTROL_AUDIO)) {
+        sched_set(gb, SCHED_APU, SCHED_NEVER);
+        return;
+    }
+
+    // No buffer to fill, only keep the span apu_sync catches up on in range
+    if (gb->apu.silent) {
+        sched_set(gb, SCHED_APU, gb->apu.cycles + APU_SILENT_SPAN);
+        return;
+    }
+
+    // Earliest the buffer can fill up, exact unless double speed halves the APU clock
+    uint64_t m = (APU_BLIP_END - gb->apu.blip_pos + APU_BLIP_STEP - 1) / APU_BLIP_STEP;
+    sched_set(gb, SCHED_APU, gb->apu.cycles + (m * 4));
+}
+
+// Whether audio buffers, and with them EMU_EVENT_AUDIO, are coming
+bool apu_enabled(gb_t *gb) {
+    return !gb->apu.silent && (gb->apu.control & APU_CONTROL_AUDIO);
+}
+
+// Turn synthesis and mixing on or off, with it off only what the game can read is kept up
+// to date: the NR52 channel bits with triggers, length counters, sweep and DAC cut-offs,
+// and wave RAM. PCM12/PCM34 keep their last samples.
+void apu_set_audio(gb_t *gb, bool enabled) {
+    apu_sync(gb);
+    gb->apu.silent = !enabled;
+    apu_schedule(gb);
 }
 
-uint8_t apu_io_read(uint16_t addr) {
+#ifdef CGB
+// Digital output of a channel for PCM12/PCM34
+static uint8_t apu_pcm(gb_t *gb, uint8_t sample, uint8_t ch_control) {
+    return (gb->apu.control & ch_control) ? sample : 0;
+}
+#endif
+
+uint8_t apu_io_read(gb_t *gb, uint16_t addr) {
+    apu_sync(gb);
+
     switch (addr) {
-        case 0x10: return apu.ch1.sweep | APU_CH1_SWEEP_UNUSED; break;
-        case 0x11: return apu.ch1.length_duty | APU_CH_LD_LENGTH; break;
-        case 0x12: return apu.ch1.envelope; break;
-        case 0x14: return (apu.ch1.control & APU_CH_CONTROL_LENGTH) | ~APU_CH_CONTROL_LENGTH; break;
-        case 0x16: return apu.ch2.length_duty | APU_CH_LD_LENGTH; break;
-        case 0x17: return apu.ch2.envelope; break;
-        case 0x19: return (apu.ch2.control & APU_CH_CONTROL_LENGTH) | ~APU_CH_CONTROL_LENGTH; break;
-        case 0x1A: return apu.ch3.dac | APU_CH3_DAC_UNUSED; break;
-        case 0x1C: return apu.ch3.level; break;
-        case 0x1E: return (apu.ch3.control & APU_CH_CONTROL_LENGTH) | ~APU_CH_CONTROL_LENGTH; break;
-        case 0x21: return apu.ch4.envelope; break;
-        case 0x22: return apu.ch4.rand; break;
-        case 0x23: return apu.ch4.control | APU_CH_CONTROL_PERIOD | APU_CH_CONTROL_UNUSED; break;
-        case 0x24: return apu.volume_vin; break;
-        case 0x25: return apu.panning; break;
-        case 0x26: return apu.control | APU_CONTROL_UNUSED; break;
+        case 0x10: return gb->apu.ch1.sweep | APU_CH1_SWEEP_UNUSED; break;
+        case 0x11: return gb->apu.ch1.length_duty | APU_CH_LD_LENGTH; break;
+        case 0x12: return gb->apu.ch1.envelope; break;
+        case 0x14: return (gb->apu.ch1.control & APU_CH_CONTROL_LENGTH) | ~APU_CH_CONTROL_LENGTH; break;
+        case 0x16: return gb->apu.ch2.length_duty | APU_CH_LD_LENGTH; break;
+        case 0x17: return gb->apu.ch2.envelope; break;
+        case 0x19: return (gb->apu.ch2.control & APU_CH_CONTROL_LENGTH) | ~APU_CH_CONTROL_LENGTH; break;
+        case 0x1A: return gb->apu.ch3.dac | APU_CH3_DAC_UNUSED; break;
+        case 0x1C: return gb->apu.ch3.level; break;
+        case 0x1E: return (gb->apu.ch3.control & APU_CH_CONTROL_LENGTH) | ~APU_CH_CONTROL_LENGTH; break;
+        case 0x21: return gb->apu.ch4.envelope; break;
+        case 0x22: return gb->apu.ch4.rand; break;
+        case 0x23: return gb->apu.ch4.control | APU_CH_CONTROL_PERIOD | APU_CH_CONTROL_UNUSED; break;
+        case 0x24: return gb->apu.volume_vin; break;
+        case 0x25: return gb->apu.panning; break;
+        case 0x26: return gb->apu.control | APU_CONTROL_UNUSED; break;
+#ifdef CGB
+        case 0x76: return apu_pcm(gb, gb->apu.ch1.sample, APU_CONTROL_CH1) | (apu_pcm(gb, gb->apu.ch2.sample, APU_CONTROL_CH2) << 4); break;
+        case 0x77: return apu_pcm(gb, gb->apu.ch3.sample, APU_CONTROL_CH3) | (apu_pcm(gb, gb->apu.ch4.sample, APU_CONTROL_CH4) << 4); break;
+#endif
         default:
             return 0xFF;
             break;
     }
 }
 
-void apu_io_write(uint16_t addr, uint8_t data) {
+void apu_io_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    apu_sync(gb);
+
     switch (addr) {
-        case 0x10: apu.ch1.sweep = data; break;
-        case 0x11: apu.ch1.length_duty = data; break;
-        case 0x12: apu.ch1.envelope = data; break;
-        case 0x13: apu.ch1.period = (apu.ch1.period & APU_CH_PERIOD_HIGH) | data; break;
+        case 0x10: gb->apu.ch1.sweep = data; break;
+        case 0x11: gb->apu.ch1.length_duty = data; break;
+        case 0x12: gb->apu.ch1.envelope = data; break;
+        case 0x13: gb->apu.ch1.period = (gb->apu.ch1.period & APU_CH_PERIOD_HIGH) | data; break;
         case 0x14:
             uint16_t period_high = ((data & APU_CH_CONTROL_PERIOD) << APU_CH_PERIOD_HIGH_SHIFT);
-            apu.ch1.period = (apu.ch1.period & APU_CH_PERIOD_LOW) | period_high;
-            apu.ch1.control = data;
+            gb->apu.ch1.period = (gb->apu.ch1.period & APU_CH_PERIOD_LOW) | period_high;
+            gb->apu.ch1.control = data;
             break;
-        case 0x16: apu.ch2.length_duty = data; break;
-        case 0x17: apu.ch2.envelope = data; break;
-        case 0x18: apu.ch2.period = (apu.ch2.period & APU_CH_PERIOD_HIGH) | data; break;
+        case 0x16: gb->apu.ch2.length_duty = data; break;
+        case 0x17: gb->apu.ch2.envelope = data; break;
+        case 0x18: gb->apu.ch2.period = (gb->apu.ch2.period & APU_CH_PERIOD_HIGH) | data; break;
         case 0x19:
             period_high = ((data & APU_CH_CONTROL_PERIOD) << APU_CH_PERIOD_HIGH_SHIFT);
-            apu.ch2.period = (apu.ch2.period & APU_CH_PERIOD_LOW) | period_high;
-            apu.ch2.control = data;
+            gb->apu.ch2.period = (gb->apu.ch2.period & APU_CH_PERIOD_LOW) | period_high;
+            gb->apu.ch2.control = data;
             break;
-        case 0x1A: apu.ch3.dac = data; break;
-        case 0x1B: apu.ch3.length = data; break;
-        case 0x1C: apu.ch3.level = data; break;
-        case 0x1D: apu.ch3.period = (apu.ch3.period & APU_CH_PERIOD_HIGH) | data; break;
+        case 0x1A: gb->apu.ch3.dac = data; break;
+        case 0x1B: gb->apu.ch3.length = data; break;
+        case 0x1C: gb->apu.ch3.level = data; break;
+        case 0x1D: gb->apu.ch3.period = (gb->apu.ch3.period & APU_CH_PERIOD_HIGH) | data; break;
         case 0x1E:
             period_high = ((data & APU_CH_CONTROL_PERIOD) << APU_CH_PERIOD_HIGH_SHIFT);
-            apu.ch3.period = (apu.ch3.period & APU_CH_PERIOD_LOW) | period_high;
-            apu.ch3.control = data;
+            gb->apu.ch3.period = (gb->apu.ch3.period & APU_CH_PERIOD_LOW) | period_high;
+            gb->apu.ch3.control = data;
+            break;
+        case 0x20: gb->apu.ch4.length = data; break;
+        case 0x21: gb->apu.ch4.envelope = data; break;
+        case 0x22: gb->apu.ch4.rand = data; break;
+        case 0x23: gb->apu.ch4.control = data; break;
+        case 0x24:
+            apu_mix_to(gb, gb->apu.blip_pos >> BLIP_FRAC_BITS);
+            gb->apu.volume_vin = data;
+            apu_gains(gb);
+            break;
+        case 0x25:
+            apu_mix_to(gb, gb->apu.blip_pos >> BLIP_FRAC_BITS);
+            gb->apu.panning = data;
+            apu_gains(gb);
+            break;
+        case 0x26:
+            gb->apu.control = (gb->apu.control & ~APU_CONTROL_AUDIO) | (data & APU_CONTROL_AUDIO);
+            apu_schedule(gb);
             break;
-        case 0x20: apu.ch4.length = data; break;
-        case 0x21: apu.ch4.envelope = data; break;
-        case 0x22: apu.ch4.rand = data; break;
-        case 0x23: apu.ch4.control = data; break;
-        case 0x24: apu.volume_vin = data; break;
-        case 0x25: apu.panning = data; break;
-        case 0x26: apu.control = (apu.control & ~APU_CONTROL_AUDIO) | (data & APU_CONTROL_AUDIO); break;
         default: break;
     }
 }
 
-uint8_t apu_wave_read(uint16_t addr) {
-    return apu.ch3.wave[addr-0x30];
+uint8_t apu_wave_read(gb_t *gb, uint16_t addr) {
+    apu_sync(gb);
+    return gb->apu.ch3.wave[addr-0x30];
 }
 
-void apu_wave_write(uint16_t addr, uint8_t data) {
-    apu.ch3.wave[addr-0x30] = data;
+void apu_wave_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    apu_sync(gb);
+    gb->apu.ch3.wave[addr-0x30] = data;
+
+    // Low nibble first
+    gb->apu.ch3.samples[(addr-0x30) * 2] = data & 0b00001111;
+    gb->apu.ch3.samples[((addr-0x30) * 2) + 1] = data >> 4;
 }
@@ -0,0 +1,103 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "batch.h"
+#include "gb.h"
+
+gb_batch_t *batch_create(int count) {
+    gb_batch_t *batch = calloc(1, sizeof(gb_batch_t));
+    if (batch == NULL) {
+        return NULL;
+    }
+
+    batch->gb = calloc(count, sizeof(gb_t *));
+    batch->ram = calloc(count, EMU_SAV_SIZE_MAX);
+    batch->events = calloc(count, sizeof(int));
+    batch->order = calloc(count, sizeof(int));
+    batch->key = calloc(count, sizeof(uintptr_t));
+    if (batch->gb == NULL || batch->ram == NULL || batch->events == NULL || batch->order == NULL || batch->key == NULL) {
+        batch_destroy(batch);
+        return NULL;
+    }
+
+    for (int i = 0; i < count; i++) {
+        batch->gb[i] = emu_create();
+        if (batch->gb[i] == NULL) {
+            batch_destroy(batch);
+            return NULL;
+        }
+        batch->count++;
+        batch->order[i] = i;
+
+#ifdef JIT
+        // Every lane runs the same ROM, so a block compiled for one serves them all
+        if (i > 0) {
+            jit_share(batch->gb[i], batch->gb[0]);
+        }
+#endif
+    }
+
+    return batch;
+}
+
+void batch_destroy(gb_batch_t *batch) {
+    // Lane 0 goes last, the others may share its JIT blocks
+    for (int i = batch->count - 1; i >= 0; i--) {
+        emu_destroy(batch->gb[i]);
+    }
+    free(batch->gb);
+    free(batch->ram);
+    free(batch->events);
+    free(batch->order);
+    free(batch->key);
+    free(batch);
+}
+
+void batch_load(gb_batch_t *batch, uint8_t *bootrom, size_t bootrom_size, uint8_t *rom, size_t rom_size) {
+    for (int i = 0; i < batch->count; i++) {
+        emu_load_bootrom(batch->gb[i], bootrom, bootrom_size);
+        emu_load_rom(batch->gb[i], rom, rom_size);
+        emu_load_sav(batch->gb[i], &batch->ram[i * EMU_SAV_SIZE_MAX], EMU_SAV_SIZE_MAX);
+    }
+}
+
+gb_t *batch_get(gb_batch_t *batch, int lane) {
+    return batch->gb[lane];
+}
+
+// Order lanes by the host address of the code they are about to run
+// Lanes share the ROM, so lanes at the same place in the same bank end up next to each other
+static void batch_regroup(gb_batch_t *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        gb_t *gb = batch->gb[i];
+        uint8_t *page = gb->mem.read_page[gb->cpu.pc >> 8];
+        batch->key[i] = page != NULL ? (uintptr_t)&page[gb->cpu.pc & 0xFF] : gb->cpu.pc;
+    }
+
+    // Lanes mostly stay where they were since the last run, so this is close to one pass
+    for (int i = 1; i < batch->count; i++) {
+        int lane = batch->order[i];
+        int j = i;
+        while (j > 0 && batch->key[batch->order[j - 1]] > batch->key[lane]) {
+            batch->order[j] = batch->order[j - 1];
+            j--;
+        }
+        batch->order[j] = lane;
+    }
+}
+
+// Run every running lane until one of the events in mask, the events of all lanes are returned
+// Lanes in the same code run back to back, finding it and the handlers it needs still in cache
+int batch_run_to(gb_batch_t *batch, int mask) {
+    batch_regroup(batch);
+
+    int result = EMU_EVENT_NONE;
+    for (int i = 0; i < batch->count; i++) {
+        int lane = batch->order[i];
+        gb_t *gb = batch->gb[lane];
+        batch->events[lane] = gb->emu.running ? emu_run_to(gb, mask) : EMU_EVENT_NONE;
+        result |= batch->events[lane];
+    }
+
+    return result;
+}
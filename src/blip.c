@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "blip.h"
+
+// Blackman windowed sinc cut off at 0.9 of the host Nyquist rate, one row per phase
+// Each row is the share of a step every output sample gets, so a level is reached exactly
+static const int16_t BLIP_KERNEL[1 << BLIP_PHASE_BITS][BLIP_WIDTH] = {
+    {2, -14, 45, -105, 195, -296, 378, 3686, 378, -296, 195, -105, 45, -14, 2, 0},
+    {2, -14, 43, -99, 178, -253, 265, 3681, 497, -339, 212, -111, 46, -14, 2, 0},
+    {2, -13, 41, -93, 160, -210, 157, 3667, 620, -381, 227, -116, 47, -14, 2, 0},
+    {2, -13, 39, -86, 141, -167, 54, 3642, 748, -422, 242, -120, 48, -14, 2, 0},
+    {2, -12, 37, -78, 122, -125, -42, 3607, 879, -462, 254, -123, 48, -13, 2, 0},
+    {2, -12, 35, -71, 103, -83, -132, 3563, 1013, -499, 266, -125, 47, -13, 2, 0},
+    {2, -11, 32, -63, 84, -43, -215, 3508, 1150, -534, 276, -126, 46, -12, 2, 0},
+    {2, -10, 29, -55, 65, -4, -292, 3445, 1290, -566, 283, -126, 45, -11, 1, 0},
+    {1, -9, 26, -47, 47, 33, -361, 3374, 1430, -596, 289, -125, 43, -10, 1, 0},
+    {1, -9, 24, -39, 29, 68, -424, 3293, 1572, -621, 292, -123, 41, -9, 1, 0},
+    {1, -8, 21, -31, 11, 101, -480, 3206, 1714, -643, 294, -120, 38, -8, 0, 0},
+    {1, -7, 18, -23, -5, 131, -529, 3109, 1856, -660, 292, -116, 35, -6, 0, 0},
+    {1, -6, 15, -16, -21, 160, -571, 3007, 1996, -673, 288, -110, 31, -4, -1, 0},
+    {1, -5, 12, -8, -36, 185, -606, 2897, 2135, -681, 282, -103, 27, -3, -1, 0},
+    {1, -5, 9, -1, -50, 208, -634, 2781, 2272, -683, 273, -95, 22, 0, -2, 0},
+    {1, -4, 7, 5, -63, 229, -656, 2660, 2405, -680, 261, -86, 17, 2, -2, 0},
+    {0, -3, 4, 11, -75, 246, -671, 2537, 2535, -671, 246, -75, 11, 4, -3, 0},
+    {0, -2, 2, 17, -86, 261, -680, 2405, 2660, -656, 229, -63, 5, 7, -4, 1},
+    {0, -2, 0, 22, -95, 273, -683, 2272, 2781, -634, 208, -50, -1, 9, -5, 1},
+    {0, -1, -3, 27, -103, 282, -681, 2135, 2897, -606, 185, -36, -8, 12, -5, 1},
+    {0, -1, -4, 31, -110, 288, -673, 1996, 3007, -571, 160, -21, -16, 15, -6, 1},
+    {0, 0, -6, 35, -116, 292, -660, 1856, 3109, -529, 131, -5, -23, 18, -7, 1},
+    {0, 0, -8, 38, -120, 294, -643, 1714, 3206, -480, 101, 11, -31, 21, -8, 1},
+    {0, 1, -9, 41, -123, 292, -621, 1572, 3293, -424, 68, 29, -39, 24, -9, 1},
+    {0, 1, -10, 43, -125, 289, -596, 1430, 3374, -361, 33, 47, -47, 26, -9, 1},
+    {0, 1, -11, 45, -126, 283, -566, 1290, 3445, -292, -4, 65, -55, 29, -10, 2},
+    {0, 2, -12, 46, -126, 276, -534, 1150, 3508, -215, -43, 84, -63, 32, -11, 2},
+    {0, 2, -13, 47, -125, 266, -499, 1013, 3563, -132, -83, 103, -71, 35, -12, 2},
+    {0, 2, -13, 48, -123, 254, -462, 879, 3607, -42, -125, 122, -78, 37, -12, 2},
+    {0, 2, -14, 48, -120, 242, -422, 748, 3642, 54, -167, 141, -86, 39, -13, 2},
+    {0, 2, -14, 47, -116, 227, -381, 620, 3667, 157, -210, 160, -93, 41, -13, 2},
+    {0, 2, -14, 46, -111, 212, -339, 497, 3681, 265, -253, 178, -99, 43, -14, 2},
+};
+
+// Step lane to level at pos, which must be before the end of the buffer
+void blip_add(gb_blip_t *blip, int lane, uint32_t pos, int level) {
+    int delta = level - blip->level[lane];
+    if (delta == 0) {
+        return;
+    }
+    blip->level[lane] = level;
+
+    int phase = (pos >> (BLIP_FRAC_BITS - BLIP_PHASE_BITS)) & ((1 << BLIP_PHASE_BITS) - 1);
+    const int16_t *kernel = BLIP_KERNEL[phase];
+    int32_t (*out)[BLIP_LANES] = &blip->delta[pos >> BLIP_FRAC_BITS];
+    for (int i = 0; i < BLIP_WIDTH; i++) {
+        out[i][lane] += delta * kernel[i];
+    }
+}
+
+// Integrate samples start to end of every lane into out, scaled by 1 << BLIP_KERNEL_BITS
+// Steps can only land at or after the last position added, samples before it are final
+void blip_read(gb_blip_t *blip, int32_t (*out)[BLIP_LANES], int start, int end) {
+    int32_t sum[BLIP_LANES];
+    memcpy(sum, blip->sum, sizeof(sum));
+
+    for (int i = start; i < end; i++) {
+        for (int lane = 0; lane < BLIP_LANES; lane++) {
+            sum[lane] += blip->delta[i][lane];
+            out[i][lane] = sum[lane];
+        }
+    }
+
+    memcpy(blip->sum, sum, sizeof(sum));
+}
+
+// The whole buffer has been read, steps spilling past its end carry over into the next one
+void blip_next(gb_blip_t *blip) {
+    memmove(blip->delta, &blip->delta[EMU_AUDIO_BUFFER_SIZE], sizeof(blip->delta[0]) * BLIP_WIDTH);
+    memset(&blip->delta[BLIP_WIDTH], 0, sizeof(blip->delta[0]) * EMU_AUDIO_BUFFER_SIZE);
+}
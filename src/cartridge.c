@@ -3,7 +3,9 @@
 #include <stdio.h>
 
 #include "cartridge.h"
+#include "mem.h"
 #include "emu.h"
+#include "gb.h"
 
 #define HEADER_TITLE_OFFSET     0x134
 #define HEADER_TITLE_SIZE       0x10
@@ -11,135 +13,184 @@
 #define HEADER_ROM_SIZE_OFFSET  0x148
 #define HEADER_RAM_SIZE_OFFSET  0x149
 
-gb_cartridge_t cartridge = {};
+// Point the switchable ROM window at a bank, wrapped to the real ROM size
+static void set_rom_bank(gb_t *gb, uint16_t bank) {
+    bank &= gb->cartridge.rom_bank_mask;
+    gb->cartridge.rom_bank_base = &gb->cartridge.rom[0x4000 * bank];
+    mem_map(gb, 0x40, 0x40, gb->cartridge.rom_bank_base, NULL);
+}
 
-void cartridge_load_rom(uint8_t *data, size_t size) {
-    if (size < EMU_ROM_SIZE_MIN) {
-        printf("CARTRIDGE: Loaded ROM size smaller than minimum!\n");
-        exit(1);
+// Point the RAM window at the selected bank, wrapped to the real RAM size
+// Disabled or absent RAM is left to the slow path
+static void set_ram_bank(gb_t *gb) {
+    gb->cartridge.ram_bank_base = NULL;
+    if (gb->cartridge.ram_enable && gb->cartridge.ram != NULL && gb->cartridge.ram_bank_mask != 0xFFFF) {
+        uint16_t bank = gb->cartridge.ram_bank & gb->cartridge.ram_bank_mask;
+        gb->cartridge.ram_bank_base = &gb->cartridge.ram[0x2000 * bank];
     }
+    mem_map(gb, 0xA0, 0x20, gb->cartridge.ram_bank_base, gb->cartridge.ram_bank_base);
+}
 
-    cartridge.rom = data;
-    cartridge.type = cartridge.rom[HEADER_TYPE_OFFSET];
-    cartridge.rom_size = cartridge.rom[HEADER_ROM_SIZE_OFFSET];
-    cartridge.ram_size = cartridge.rom[HEADER_RAM_SIZE_OFFSET];
+// Common RAM access for controllers with plain banked RAM
+static uint8_t ram_read(gb_t *gb, uint16_t addr) {
+    if (gb->cartridge.ram_bank_base != NULL) {
+        return gb->cartridge.ram_bank_base[addr - 0xA000];
+    }
+    return 0xFF;
 }
 
-size_t cartridge_get_ram_size() {
-    size_t size = 0;
-    switch (cartridge.type) {
-        case 0x03: // MBC1+RAM+BATTERY
-        case 0x10: // MBC3+TIMER+RAM+BATTERY
-        case 0x13: // MBC3+RAM+BATTERY
-        case 0x1B: // MBC5+RAM+BATTERY
-        case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
-            switch (cartridge.ram_size) {
-                case 0x02: size = 0x2000; break;
-                case 0x03: size = 0x8000; break;
-                case 0x04: size = 0x20000; break;
-                case 0x05: size = 0x10000; break;
-            }
-            break;
-        case 0x06: size = 0x200; break; // MBC2+BATTERY
+static void ram_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (gb->cartridge.ram_bank_base != NULL) {
+        gb->cartridge.ram_bank_base[addr - 0xA000] = data;
     }
+}
 
-    return size;
+// ROM ONLY, no registers
+static const gb_mbc_t mbc_rom = {
+    .write = NULL,
+    .ram_read = ram_read,
+    .ram_write = ram_write
+};
+
+// MBC1
+static void mbc1_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (addr <= 0x1FFF) { // RAM Enable
+        gb->cartridge.ram_enable = (data & 0b00001111) == 0xA;
+        set_ram_bank(gb);
+    } else if (addr <= 0x3FFF) { // ROM Bank Number
+        gb->cartridge.rom_bank = data & 0b00011111;
+        set_rom_bank(gb, gb->cartridge.rom_bank ? gb->cartridge.rom_bank : 1);
+    } else if (addr <= 0x5FFF) { // RAM Bank Number
+        gb->cartridge.ram_bank = data & 0b00000011;
+        set_ram_bank(gb);
+    } else { // Bank Mode Select
+        gb->cartridge.bank_mode = data & 0b00000001;
+    }
 }
 
-void cartridge_load_ram(uint8_t *data, size_t size) {
-    cartridge.ram = data;
+static const gb_mbc_t mbc1 = {
+    .write = mbc1_write,
+    .ram_read = ram_read,
+    .ram_write = ram_write
+};
 
-    size_t sav_size = cartridge_get_ram_size();
-    if (size < sav_size) {
-        printf("CARTRIDGE: Loaded RAM size smaller than cartridge spec, continuing anyways\n");
+// MBC2
+static void mbc2_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (addr <= 0x3FFF) { // RAM Enable/ROM Bank Number
+        bool rom_mode = addr & 0b100000000;
+        if (rom_mode) {
+            gb->cartridge.rom_bank = data & 0b00001111;
+            set_rom_bank(gb, gb->cartridge.rom_bank ? gb->cartridge.rom_bank : 1);
+        } else {
+            gb->cartridge.ram_enable = (data & 0b00001111) == 0xA;
+        }
     }
 }
 
-size_t cartridge_get_title(char *title) {
-    size_t i = 0;
+// Built-in 512 half-byte RAM, never mapped directly
+static uint8_t mbc2_ram_read(gb_t *gb, uint16_t addr) {
+    if (gb->cartridge.ram_enable) {
+        return gb->cartridge.ram[(addr - 0xA000) % 0x200] | 0xF0;
+    }
+    return 0xFF;
+}
 
-    do {
-        title[i] = cartridge.rom[i+HEADER_TITLE_OFFSET];
-        i++;
-    } while (title[i-1] != 0 && i < EMU_TITLE_SIZE_MAX);
+static void mbc2_ram_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (gb->cartridge.ram_enable) {
+        gb->cartridge.ram[(addr - 0xA000) % 0x200] = data;
+    }
+}
 
-    return i;
+static const gb_mbc_t mbc2 = {
+    .write = mbc2_write,
+    .ram_read = mbc2_ram_read,
+    .ram_write = mbc2_ram_write
+};
+
+// MBC3
+static void mbc3_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (addr <= 0x1FFF) { // RAM Enable
+        gb->cartridge.ram_enable = (data & 0b00001111) == 0xA;
+        set_ram_bank(gb);
+    } else if (addr <= 0x3FFF) { // ROM Bank Number
+        gb->cartridge.rom_bank = data & 0b01111111;
+        set_rom_bank(gb, gb->cartridge.rom_bank ? gb->cartridge.rom_bank : 1);
+    } else if (addr <= 0x5FFF) { // RAM Bank Number
+        gb->cartridge.ram_bank = data & 0b00000011;
+        set_ram_bank(gb);
+    } else { // Bank Mode Select
+        gb->cartridge.bank_mode = data & 0b00000001;
+    }
+}
+
+static const gb_mbc_t mbc3 = {
+    .write = mbc3_write,
+    .ram_read = ram_read,
+    .ram_write = ram_write
+};
+
+// MBC5
+static void mbc5_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (addr <= 0x1FFF) { // RAM Enable
+        gb->cartridge.ram_enable = (data & 0b00001111) == 0xA;
+        set_ram_bank(gb);
+    } else if (addr <= 0x2FFF) { // ROM Bank Number (8 LSB)
+        gb->cartridge.rom_bank &= 0b100000000;
+        gb->cartridge.rom_bank |= data;
+        set_rom_bank(gb, gb->cartridge.rom_bank);
+    } else if (addr <= 0x3FFF) { // ROM Bank Number (MSB)
+        gb->cartridge.rom_bank &= 0b011111111;
+        gb->cartridge.rom_bank |= (data & 1) << 8;
+        set_rom_bank(gb, gb->cartridge.rom_bank);
+    } else if (addr <= 0x5FFF) { // RAM Bank Number
+        gb->cartridge.ram_bank = data & 0b00001111;
+        set_ram_bank(gb);
+    } else { // Bank Mode Select
+        gb->cartridge.bank_mode = data & 0b00000001;
+    }
 }
 
-uint8_t cartridge_read(uint16_t addr) {
-    switch (cartridge.type) {
+static const gb_mbc_t mbc5 = {
+    .write = mbc5_write,
+    .ram_read = ram_read,
+    .ram_write = ram_write
+};
+
+void cartridge_map(gb_t *gb) {
+    mem_map(gb, 0x00, 0x40, gb->cartridge.rom, NULL);
+    mem_map(gb, 0x40, 0x40, gb->cartridge.rom_bank_base, NULL);
+    mem_map(gb, 0xA0, 0x20, gb->cartridge.ram_bank_base, gb->cartridge.ram_bank_base);
+}
+
+void cartridge_load_rom(gb_t *gb, uint8_t *data, size_t size) {
+    if (size < EMU_ROM_SIZE_MIN) {
+        printf("CARTRIDGE: Loaded ROM size smaller than minimum!\n");
+        exit(1);
+    }
+
+    gb->cartridge.rom = data;
+    gb->cartridge.type = gb->cartridge.rom[HEADER_TYPE_OFFSET];
+    gb->cartridge.rom_size = gb->cartridge.rom[HEADER_ROM_SIZE_OFFSET];
+    gb->cartridge.ram_size = gb->cartridge.rom[HEADER_RAM_SIZE_OFFSET];
+
+    switch (gb->cartridge.type) {
         case 0x00: // ROM ONLY
-            return cartridge.rom[addr];
+            gb->cartridge.mbc = &mbc_rom;
             break;
         case 0x01: // MBC1
         case 0x02: // MBC1+RAM
         case 0x03: // MBC1+RAM+BATTERY
-            if (addr <= 0x3FFF) { // ROM Bank 0
-                return cartridge.rom[addr];
-            } else if (addr <= 0x7FFF) { // ROM bank 1+
-                uint8_t bank = cartridge.rom_bank;
-                if (bank == 0) { bank = 1; }
-
-                int bank_addr = 0x4000 * (bank - 1);
-                return cartridge.rom[addr+bank_addr];
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    switch (cartridge.ram_size) {
-                        case 0x02: // 8KB Unbanked
-                            return cartridge.ram[ram_addr];
-                            break;
-                        case 0x03: // 32KB Banked
-                            uint16_t bank_addr = 0x2000 * cartridge.ram_bank;
-                            return cartridge.ram[ram_addr+bank_addr];
-                            break;
-                    }
-                }
-            }
+            gb->cartridge.mbc = &mbc1;
             break;
         case 0x05: // MBC2
         case 0x06: // MBC2+BATTERY
-            if (addr <= 0x3FFF) { // ROM Bank 0
-                return cartridge.rom[addr];
-            } else if (addr <= 0x7FFF) { // ROM bank 1+
-                uint8_t bank = cartridge.rom_bank;
-                if (bank == 0) { bank = 1; }
-
-                int bank_addr = 0x4000 * (bank - 1);
-                return cartridge.rom[addr+bank_addr];
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    return cartridge.ram[ram_addr % 0x200] | 0xF0;
-                }
-            }
+            gb->cartridge.mbc = &mbc2;
             break;
         case 0x10: // MBC3+TIMER+RAM+BATTERY
         case 0x11: // MBC3
         case 0x12: // MBC3+RAM
         case 0x13: // MBC3+RAM+BATTERY
-            if (addr <= 0x3FFF) { // ROM Bank 0
-                return cartridge.rom[addr];
-            } else if (addr <= 0x7FFF) { // ROM bank 1+
-                uint8_t bank = cartridge.rom_bank;
-                if (bank == 0) { bank = 1; }
-
-                int bank_addr = 0x4000 * (bank - 1);
-                return cartridge.rom[addr+bank_addr];
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    switch (cartridge.ram_size) {
-                        case 0x02: // 8KB Unbanked
-                            return cartridge.ram[ram_addr];
-                            break;
-                        case 0x03: // 32KB Banked
-                            uint16_t bank_addr = 0x2000 * cartridge.ram_bank;
-                            return cartridge.ram[ram_addr+bank_addr];
-                            break;
-                    }
-                }
-            }
+            gb->cartridge.mbc = &mbc3;
             break;
         case 0x19: // MBC5
         case 0x1A: // MBC5+RAM
@@ -147,147 +198,99 @@ uint8_t cartridge_read(uint16_t addr) {
         case 0x1C: // MBC5+RUMBLE
         case 0x1D: // MBC5+RUMBLE+RAM
         case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
-            if (addr <= 0x3FFF) { // ROM Bank 0
-                return cartridge.rom[addr];
-            } else if (addr <= 0x7FFF) { // ROM bank *
-                uint16_t bank = cartridge.rom_bank;
-                int bank_addr = 0x4000 * (bank - 1);
-                return cartridge.rom[addr+bank_addr];
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    switch (cartridge.ram_size) {
-                        case 0x02: // 8KB Unbanked
-                            return cartridge.ram[ram_addr];
-                            break;
-                        case 0x03: // 32KB Banked
-                        case 0x04: // 128KB Banked
-                            uint16_t bank_addr = 0x2000 * cartridge.ram_bank;
-                            return cartridge.ram[ram_addr+bank_addr];
-                            break;
-                    }
-                }
-            }
+            gb->cartridge.mbc = &mbc5;
             break;
         default:
-            printf("Unknown cartridge type on read: 0x%X\n", cartridge.type);
+            printf("CARTRIDGE: Unknown cartridge type 0x%X\n", gb->cartridge.type);
             exit(1);
             break;
     }
 
-    return 0xFF;
+    // 32KB << n
+    if (gb->cartridge.rom_size > 0x08) {
+        printf("CARTRIDGE: Unknown ROM size 0x%X\n", gb->cartridge.rom_size);
+        exit(1);
+    }
+    // Bank bases are masked once and then used as is, every bank has to be in the buffer
+    if (((size_t)0x8000 << gb->cartridge.rom_size) > size) {
+        printf("CARTRIDGE: ROM header claims 0x%zX bytes, only 0x%zX loaded\n", (size_t)0x8000 << gb->cartridge.rom_size, size);
+        exit(1);
+    }
+    gb->cartridge.rom_bank_mask = (2 << gb->cartridge.rom_size) - 1;
+
+    // 0xFFFF for no RAM
+    switch (gb->cartridge.ram_size) {
+        case 0x02: gb->cartridge.ram_bank_mask = 0x00; break; // 8KB
+        case 0x03: gb->cartridge.ram_bank_mask = 0x03; break; // 32KB
+        case 0x04: gb->cartridge.ram_bank_mask = 0x0F; break; // 128KB
+        case 0x05: gb->cartridge.ram_bank_mask = 0x07; break; // 64KB
+        default: gb->cartridge.ram_bank_mask = 0xFFFF; break;
+    }
+
+    gb->cartridge.rom_bank = 1;
+    mem_map(gb, 0x00, 0x40, gb->cartridge.rom, NULL);
+    set_rom_bank(gb, 1);
+    set_ram_bank(gb);
 }
 
-void cartridge_write(uint16_t addr, uint8_t data) {
-    switch (cartridge.type) {
-        case 0x00: // ROM ONLY
-            break; // Do nothing
-        case 0x01: // MBC1
-        case 0x02: // MBC1+RAM
+size_t cartridge_get_ram_size(gb_t *gb) {
+    size_t size = 0;
+    switch (gb->cartridge.type) {
         case 0x03: // MBC1+RAM+BATTERY
-            if (addr <= 0x1FFF) { // RAM Enable
-                cartridge.ram_enable = (data & 0b00001111) == 0xA;
-            } else if (addr <= 0x3FFF) { // ROM Bank Number
-                cartridge.rom_bank = data & 0b00011111;
-            } else if (addr <= 0x5FFF) { // RAM Bank Number
-                cartridge.ram_bank = data & 0b00000011;
-            } else if (addr <= 0x7FFF) { // Bank Mode Select
-                cartridge.bank_mode = data & 0b00000001;
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    switch (cartridge.ram_size) {
-                        case 0x02: // 8KB Unbanked
-                            cartridge.ram[ram_addr] = data;
-                            break;
-                        case 0x03: // 32KB Banked
-                            uint16_t bank_addr = 0x2000 * cartridge.ram_bank;
-                            cartridge.ram[ram_addr+bank_addr] = data;
-                            break;
-                    }
-                }
-            }
-            break;
-        case 0x05: // MBC2
-        case 0x06: // MBC2+BATTERY
-            if (addr <= 0x3FFF) { // RAM Enable/ROM Bank Number
-                bool rom_mode = addr & 0b100000000;
-                if (rom_mode) {
-                    cartridge.rom_bank = data & 0b00001111;
-                } else {
-                    cartridge.ram_enable = (data & 0b00001111) == 0xA;
-                }
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    cartridge.ram[ram_addr % 0x200] = data;
-                }
-            }
-            break;
         case 0x10: // MBC3+TIMER+RAM+BATTERY
-        case 0x11: // MBC3
-        case 0x12: // MBC3+RAM
         case 0x13: // MBC3+RAM+BATTERY
-            if (addr <= 0x1FFF) { // RAM Enable
-                cartridge.ram_enable = (data & 0b00001111) == 0xA;
-            } else if (addr <= 0x3FFF) { // ROM Bank Number
-                cartridge.rom_bank = data & 0b01111111;
-            } else if (addr <= 0x5FFF) { // RAM Bank Number
-                cartridge.ram_bank = data & 0b00000011;
-            } else if (addr <= 0x7FFF) { // Bank Mode Select
-                cartridge.bank_mode = data & 0b00000001;
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM/RTC Register
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    switch (cartridge.ram_size) {
-                        case 0x02: // 8KB Unbanked
-                            cartridge.ram[ram_addr] = data;
-                            break;
-                        case 0x03: // 32KB Banked
-                            uint16_t bank_addr = 0x2000 * cartridge.ram_bank;
-                            cartridge.ram[ram_addr+bank_addr] = data;
-                            break;
-                    }
-                }
-            }
-            break;
-        case 0x19: // MBC5
-        case 0x1A: // MBC5+RAM
         case 0x1B: // MBC5+RAM+BATTERY
-        case 0x1C: // MBC5+RUMBLE
-        case 0x1D: // MBC5+RUMBLE+RAM
         case 0x1E: // MBC5+RUMBLE+RAM+BATTERY
-            if (addr <= 0x1FFF) { // RAM Enable
-                cartridge.ram_enable = (data & 0b00001111) == 0xA;
-            } else if (addr <= 0x2FFF) { // ROM Bank Number (8 LSB)
-                cartridge.rom_bank &= 0b100000000;
-                cartridge.rom_bank |= data;
-            } else if (addr <= 0x3FFF) { // ROM Bank Number (MSB)
-                cartridge.rom_bank &= 0b011111111;
-                cartridge.rom_bank |= (data & 1) << 8;
-            } else if (addr <= 0x5FFF) { // RAM Bank Number
-                cartridge.ram_bank = data & 0b00001111;
-            } else if (addr <= 0x7FFF) { // Bank Mode Select
-                cartridge.bank_mode = data & 0b00000001;
-            } else if (addr >= 0xA000 && addr <= 0xBFFF) { // RAM
-                if (cartridge.ram_enable) {
-                    uint16_t ram_addr = addr - 0xA000;
-                    switch (cartridge.ram_size) {
-                        case 0x02: // 8KB Unbanked
-                            cartridge.ram[ram_addr] = data;
-                            break;
-                        case 0x03: // 32KB Banked
-                        case 0x04: // 128KB Banked
-                            uint16_t bank_addr = 0x2000 * cartridge.ram_bank;
-                            cartridge.ram[ram_addr+bank_addr] = data;
-                            break;
-                    }
-                }
+            switch (gb->cartridge.ram_size) {
+                case 0x02: size = 0x2000; break;
+                case 0x03: size = 0x8000; break;
+                case 0x04: size = 0x20000; break;
+                case 0x05: size = 0x10000; break;
             }
             break;
-        default:
-            printf("Unknown cartridge type on write: 0x%X\n", cartridge.type);
-            exit(1);
-            break;
+        case 0x06: size = 0x200; break; // MBC2+BATTERY
+    }
+
+    return size;
+}
+
+void cartridge_load_ram(gb_t *gb, uint8_t *data, size_t size) {
+    gb->cartridge.ram = data;
+    set_ram_bank(gb);
+
+    size_t sav_size = cartridge_get_ram_size(gb);
+    if (size < sav_size) {
+        printf("CARTRIDGE: Loaded RAM size smaller than cartridge spec, continuing anyways\n");
+    }
+}
+
+size_t cartridge_get_title(gb_t *gb, char *title) {
+    size_t i = 0;
+
+    do {
+        title[i] = gb->cartridge.rom[i+HEADER_TITLE_OFFSET];
+        i++;
+    } while (title[i-1] != 0 && i < EMU_TITLE_SIZE_MAX);
+
+    return i;
+}
+
+uint8_t cartridge_read(gb_t *gb, uint16_t addr) {
+    if (addr <= 0x3FFF) { // ROM Bank 0
+        return gb->cartridge.rom[addr];
+    } else if (addr <= 0x7FFF) { // ROM bank 1+
+        return gb->cartridge.rom_bank_base[addr - 0x4000];
+    } else { // RAM
+        return gb->cartridge.mbc->ram_read(gb, addr);
+    }
+}
+
+void cartridge_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (addr <= 0x7FFF) {
+        if (gb->cartridge.mbc->write != NULL) {
+            gb->cartridge.mbc->write(gb, addr, data);
+        }
+    } else { // RAM
+        gb->cartridge.mbc->ram_write(gb, addr, data);
     }
 }
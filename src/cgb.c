@@ -1,40 +1,43 @@
+#ifdef CGB
+
 #include <stdint.h>
 
 #include "cgb.h"
 #include "mem.h"
 #include "cpu.h"
 #include "log.h"
+#include "gb.h"
 
 #define CGB_SPEED_ARMED     0b00000001
 #define CGB_SPEED_UNUSED    0b01111110
 #define CGB_SPEED_CURRENT   0b10000000
 
-gb_cgb_t cgb = {};
-
-void cgb_execute(uint8_t t) {
+void cgb_execute(gb_t *gb, uint8_t t) {
     // If the CPU is stopped (t == 0) and speed change is armed,
     // wipe the speed register and set the inverse of the previous speed
-    if ((t == 0) && (cgb.speed & CGB_SPEED_ARMED)) {
-        bool speed_current = cgb.speed & CGB_SPEED_CURRENT;
-        cgb.speed = CGB_SPEED_CURRENT * !speed_current;
-        cpu_continue();
+    if ((t == 0) && (gb->cgb.speed & CGB_SPEED_ARMED)) {
+        bool speed_current = gb->cgb.speed & CGB_SPEED_CURRENT;
+        gb->cgb.speed = CGB_SPEED_CURRENT * !speed_current;
+        cpu_continue(gb);
         DEBUG_PRINTF("CGB SPEED CHANGED: %s\n", speed_current ? "NORMAL" : "DOUBLE");
     }
 }
 
-uint8_t cgb_io_read(uint16_t addr) {
+uint8_t cgb_io_read(gb_t *gb, uint16_t addr) {
     switch (addr) {
-        case 0x4D: return cgb.speed | CGB_SPEED_UNUSED; break;
+        case 0x4D: return gb->cgb.speed | CGB_SPEED_UNUSED; break;
         default: return 0xFF; break;
     }
 }
 
-void cgb_io_write(uint16_t addr, uint8_t data) {
+void cgb_io_write(gb_t *gb, uint16_t addr, uint8_t data) {
     switch (addr) {
-        case 0x4D: cgb.speed = data; break;
+        case 0x4D: gb->cgb.speed = data; break;
     }
 }
 
-bool cgb_speed() {
-    return cgb.speed & CGB_SPEED_CURRENT;
+bool cgb_speed(gb_t *gb) {
+    return gb->cgb.speed & CGB_SPEED_CURRENT;
 }
+
+#endif
@@ -4,17 +4,45 @@
 #include "cpu.h"
 #include "mem.h"
 #include "log.h"
+#include "gb.h"
 
-cpu_t cpu = {};
+// Instructions read registers from cpu and write them to CPU_NEXT
+// A CPU_REFERENCE build keeps cpu_next apart and commits it, along with a log of memory writes,
+// once the instruction is done. Otherwise registers are updated in place and memory is written
+// as the instruction goes, so every handler reads what it needs before writing anything.
+#ifdef CPU_REFERENCE
+#define CPU_NEXT cpu_next
+#else
+#define CPU_NEXT cpu
+#endif
 
-// CPU state is mutated here to be written back once t = 0
-// This ensures things are mostly accurate
-// Reads are always at fetch, writes always at end of instruction
-cpu_t cpu_next;
+void cpu_reset(gb_t *gb) {
+    gb->cpu.pc = 0x00;
+    gb->cpu.flag_z = 1;
+#ifdef CPU_REFERENCE
+    gb->cpu_next = gb->cpu;
+#endif
+}
+
+static void cpu_write(gb_t *gb, uint16_t addr, uint8_t data) {
+#ifdef CPU_REFERENCE
+    mem_write_next(gb, addr, data);
+#else
+    mem_write(gb, addr, data);
+#endif
+}
 
-void cpu_reset() {
-    cpu.pc = 0x00;
-    cpu_next = cpu;
+static void cpu_write16(gb_t *gb, uint16_t addr, uint16_t data) {
+    cpu_write(gb, addr, data & 0x00FF);
+    cpu_write(gb, addr + 1, (data & 0xFF00) >> 8);
+}
+
+// Pushes write the high byte first
+static void cpu_push(gb_t *gb, uint16_t data) {
+    gb->CPU_NEXT.sp -= 1;
+    cpu_write(gb, gb->CPU_NEXT.sp, (data & 0xFF00) >> 8);
+    gb->CPU_NEXT.sp -= 1;
+    cpu_write(gb, gb->CPU_NEXT.sp, data & 0x00FF);
 }
 
 // Flag helper functions
@@ -23,52 +51,53 @@ static const uint8_t CPU_FLAG_N = 0b01000000;
 static const uint8_t CPU_FLAG_H = 0b00100000;
 static const uint8_t CPU_FLAG_C = 0b00010000;
 
-static bool flag_get_z() {
-    return (cpu.f & CPU_FLAG_Z) != 0;
+static bool flag_get_z(gb_t *gb) {
+    return gb->cpu.flag_z == 0;
 }
 
-static void flag_set_z(uint8_t value) {
-    if (value == 0) {
-        cpu_next.f |= CPU_FLAG_Z;
-    } else {
-        cpu_next.f &= ~CPU_FLAG_Z;
-    }
+static void flag_set_z(gb_t *gb, uint8_t value) {
+    gb->CPU_NEXT.flag_z = value;
 }
 
-static bool flag_get_n() {
-    return (cpu.f & CPU_FLAG_N) != 0;
+static bool flag_get_n(gb_t *gb) {
+    return gb->cpu.flag_n;
 }
 
-static void flag_set_n(bool value) {
-    if (value) {
-        cpu_next.f |= CPU_FLAG_N;
-    } else {
-        cpu_next.f &= ~CPU_FLAG_N;
-    }
+static void flag_set_n(gb_t *gb, bool value) {
+    gb->CPU_NEXT.flag_n = value;
 }
 
-static bool flag_get_h() {
-    return (cpu.f & CPU_FLAG_H) != 0;
+static bool flag_get_h(gb_t *gb) {
+    return (gb->cpu.flag_h & 0x10) != 0;
 }
 
-static void flag_set_h(bool value) {
-    if (value) {
-        cpu_next.f |= CPU_FLAG_H;
-    } else {
-        cpu_next.f &= ~CPU_FLAG_H;
-    }
+static void flag_set_h(gb_t *gb, bool value) {
+    gb->CPU_NEXT.flag_h = value << 4;
 }
 
-static bool flag_get_c() {
-    return (cpu.f & CPU_FLAG_C) != 0;
+// Half carry of an 8 bit add or subtract, the carry or borrow into bit 4 of the result
+static void flag_set_h_add(gb_t *gb, uint8_t x, uint8_t y, uint8_t result) {
+    gb->CPU_NEXT.flag_h = x ^ y ^ result;
 }
 
-static void flag_set_c(bool value) {
-    if (value) {
-        cpu_next.f |= CPU_FLAG_C;
-    } else {
-        cpu_next.f &= ~CPU_FLAG_C;
-    }
+static bool flag_get_c(gb_t *gb) {
+    return gb->cpu.flag_c;
+}
+
+static void flag_set_c(gb_t *gb, bool value) {
+    gb->CPU_NEXT.flag_c = value;
+}
+
+static uint8_t flags_pack(cpu_t *cpu) {
+    return (cpu->flag_z == 0 ? CPU_FLAG_Z : 0) | (cpu->flag_n ? CPU_FLAG_N : 0) |
+           ((cpu->flag_h & 0x10) ? CPU_FLAG_H : 0) | (cpu->flag_c ? CPU_FLAG_C : 0);
+}
+
+static void flags_unpack(cpu_t *cpu, uint8_t f) {
+    cpu->flag_z = !(f & CPU_FLAG_Z);
+    cpu->flag_n = f & CPU_FLAG_N;
+    cpu->flag_h = (f & CPU_FLAG_H) ? 0x10 : 0;
+    cpu->flag_c = f & CPU_FLAG_C;
 }
 
 // Register helper functions
@@ -77,120 +106,120 @@ static inline uint16_t bytes_to_16(uint8_t high, uint8_t low) {
     return ((uint16_t)high << 8) + (uint16_t)low;
 }
 
-static inline uint16_t reg_af_read() {
-    return bytes_to_16(cpu.a, cpu.f);
+static inline uint16_t reg_af_read(gb_t *gb) {
+    return bytes_to_16(gb->cpu.a, flags_pack(&gb->cpu));
 }
 
-static inline void reg_af_write(uint16_t value) {
-    cpu_next.a = value >> 8;
-    cpu_next.f = value & 0x00FF;
+static inline void reg_af_write(gb_t *gb, uint16_t value) {
+    gb->CPU_NEXT.a = value >> 8;
+    flags_unpack(&gb->CPU_NEXT, value & 0x00FF);
 }
 
-static inline uint16_t reg_bc_read() {
-    return bytes_to_16(cpu.b, cpu.c);
+static inline uint16_t reg_bc_read(gb_t *gb) {
+    return bytes_to_16(gb->cpu.b, gb->cpu.c);
 }
 
-static inline void reg_bc_write(uint16_t value) {
-    cpu_next.b = value >> 8;
-    cpu_next.c = value & 0x00FF;
+static inline void reg_bc_write(gb_t *gb, uint16_t value) {
+    gb->CPU_NEXT.b = value >> 8;
+    gb->CPU_NEXT.c = value & 0x00FF;
 }
 
-static inline uint16_t reg_de_read() {
-    return bytes_to_16(cpu.d, cpu.e);
+static inline uint16_t reg_de_read(gb_t *gb) {
+    return bytes_to_16(gb->cpu.d, gb->cpu.e);
 }
 
-static inline void reg_de_write(uint16_t value) {
-    cpu_next.d = value >> 8;
-    cpu_next.e = value & 0x00FF;
+static inline void reg_de_write(gb_t *gb, uint16_t value) {
+    gb->CPU_NEXT.d = value >> 8;
+    gb->CPU_NEXT.e = value & 0x00FF;
 }
 
-static inline uint16_t reg_hl_read() {
-    return bytes_to_16(cpu.h, cpu.l);
+static inline uint16_t reg_hl_read(gb_t *gb) {
+    return bytes_to_16(gb->cpu.h, gb->cpu.l);
 }
 
-static inline void reg_hl_write(uint16_t value) {
-    cpu_next.h = value >> 8;
-    cpu_next.l = value & 0x00FF;
+static inline void reg_hl_write(gb_t *gb, uint16_t value) {
+    gb->CPU_NEXT.h = value >> 8;
+    gb->CPU_NEXT.l = value & 0x00FF;
 }
 
 // Prefixed instruction helper functions
-static void prefix_rlc(uint8_t *reg) {
+static void prefix_rlc(gb_t *gb, uint8_t *reg) {
     uint8_t result = (*reg << 1) | (*reg >> 7);
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg >> 7);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg >> 7);
     *reg = result;
 }
 
-static void prefix_rrc(uint8_t *reg) {
+static void prefix_rrc(gb_t *gb, uint8_t *reg) {
     uint8_t result = (*reg >> 1) | (*reg << 7);
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg & 1);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg & 1);
     *reg = result;
 }
 
-static void prefix_rl(uint8_t *reg) {
-    uint8_t result = (*reg << 1) | flag_get_c();
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg >> 7);
+static void prefix_rl(gb_t *gb, uint8_t *reg) {
+    uint8_t result = (*reg << 1) | flag_get_c(gb);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg >> 7);
     *reg = result;
 }
 
-static void prefix_rr(uint8_t *reg) {
-    uint8_t result = (*reg >> 1) + ((uint8_t)flag_get_c() << 7);
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg & 1);
+static void prefix_rr(gb_t *gb, uint8_t *reg) {
+    uint8_t result = (*reg >> 1) + ((uint8_t)flag_get_c(gb) << 7);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg & 1);
     *reg = result;
 }
 
-static void prefix_sla(uint8_t *reg) {
+static void prefix_sla(gb_t *gb, uint8_t *reg) {
     uint8_t result = (*reg << 1);
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg >> 7);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg >> 7);
     *reg = result;
 }
 
-static void prefix_sra(uint8_t *reg) {
+static void prefix_sra(gb_t *gb, uint8_t *reg) {
     uint8_t result = (*reg >> 1) | (*reg & 0b10000000);
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg & 1);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg & 1);
     *reg = result;
 }
 
-static void prefix_swap(uint8_t *reg) {
+static void prefix_swap(gb_t *gb, uint8_t *reg) {
     uint8_t result = (*reg >> 4) | (*reg << 4);
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(0);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, 0);
     *reg = result;
 }
 
-static void prefix_srl(uint8_t *reg) {
+static void prefix_srl(gb_t *gb, uint8_t *reg) {
     uint8_t result = *reg >> 1;
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(*reg & 1);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, *reg & 1);
     *reg = result;
 }
 
-static void prefix_bit(uint8_t bit, uint8_t *reg) {
+static void prefix_bit(gb_t *gb, uint8_t bit, uint8_t *reg) {
     bool result = (*reg >> bit) & 1;
-    flag_set_z(result);
-    flag_set_n(0);
-    flag_set_h(1);
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 1);
 }
 
 static void prefix_res(uint8_t bit, uint8_t *reg) {
@@ -201,1685 +230,1285 @@ static void prefix_set(uint8_t bit, uint8_t *reg) {
     *reg |= (1 << bit);
 }
 
+// Opcode handlers are named by the opcode's hex digits, OP(C, B) handles 0xCB
+// GCC and Clang jump to them through a table of label addresses, other compilers get a switch
+#ifdef __GNUC__
+#define DISPATCH_TABLE
+#endif
+
+#ifdef DISPATCH_TABLE
+#define HANDLER(name, hi, lo) name##_##hi##lo:
+#define DISPATCH(table, op) goto *table[op];
+#define DISPATCH_END
+#else
+#define HANDLER(name, hi, lo) case 0x##hi##lo:
+#define DISPATCH(table, op) switch (op) {
+#define DISPATCH_END }
+#endif
+
+#define HANDLER_ROW(name, hi) \
+    &&name##_##hi##0, &&name##_##hi##1, &&name##_##hi##2, &&name##_##hi##3, \
+    &&name##_##hi##4, &&name##_##hi##5, &&name##_##hi##6, &&name##_##hi##7, \
+    &&name##_##hi##8, &&name##_##hi##9, &&name##_##hi##A, &&name##_##hi##B, \
+    &&name##_##hi##C, &&name##_##hi##D, &&name##_##hi##E, &&name##_##hi##F
+#define HANDLER_TABLE(name) { \
+    HANDLER_ROW(name, 0), HANDLER_ROW(name, 1), HANDLER_ROW(name, 2), HANDLER_ROW(name, 3), \
+    HANDLER_ROW(name, 4), HANDLER_ROW(name, 5), HANDLER_ROW(name, 6), HANDLER_ROW(name, 7), \
+    HANDLER_ROW(name, 8), HANDLER_ROW(name, 9), HANDLER_ROW(name, A), HANDLER_ROW(name, B), \
+    HANDLER_ROW(name, C), HANDLER_ROW(name, D), HANDLER_ROW(name, E), HANDLER_ROW(name, F) }
+
+#define NEXT goto next
+
+// Low digits of the left and right half of an opcode row
+// Within a half, the low 3 bits of the opcode pick B, C, D, E, H, L, [HL], A
+#define LO_0 0, 1, 2, 3, 4, 5, 6, 7
+#define LO_8 8, 9, A, B, C, D, E, F
+
+#define CB(hi, lo) HANDLER(cb, hi, lo)
+
+// Rotate, shift, RES and SET on each register of a half row, [HL] is written back
+#define PREFIX_R(hi, half, fn, ...) PREFIX_R_(hi, half, fn, __VA_ARGS__)
+#define PREFIX_R_(hi, l0, l1, l2, l3, l4, l5, l6, l7, fn, ...) \
+    CB(hi, l0) fn(__VA_ARGS__, &gb->CPU_NEXT.b); NEXT; \
+    CB(hi, l1) fn(__VA_ARGS__, &gb->CPU_NEXT.c); NEXT; \
+    CB(hi, l2) fn(__VA_ARGS__, &gb->CPU_NEXT.d); NEXT; \
+    CB(hi, l3) fn(__VA_ARGS__, &gb->CPU_NEXT.e); NEXT; \
+    CB(hi, l4) fn(__VA_ARGS__, &gb->CPU_NEXT.h); NEXT; \
+    CB(hi, l5) fn(__VA_ARGS__, &gb->CPU_NEXT.l); NEXT; \
+    CB(hi, l6) \
+        n8 = mem_read(gb, reg_hl_read(gb)); \
+        fn(__VA_ARGS__, &n8); \
+        cpu_write(gb, reg_hl_read(gb), n8); \
+        NEXT; \
+    CB(hi, l7) fn(__VA_ARGS__, &gb->CPU_NEXT.a); NEXT;
+
+// BIT on each register of a half row, [HL] is only read
+#define PREFIX_BIT(hi, half, bit) PREFIX_BIT_(hi, half, bit)
+#define PREFIX_BIT_(hi, l0, l1, l2, l3, l4, l5, l6, l7, bit) \
+    CB(hi, l0) prefix_bit(gb, bit, &gb->CPU_NEXT.b); NEXT; \
+    CB(hi, l1) prefix_bit(gb, bit, &gb->CPU_NEXT.c); NEXT; \
+    CB(hi, l2) prefix_bit(gb, bit, &gb->CPU_NEXT.d); NEXT; \
+    CB(hi, l3) prefix_bit(gb, bit, &gb->CPU_NEXT.e); NEXT; \
+    CB(hi, l4) prefix_bit(gb, bit, &gb->CPU_NEXT.h); NEXT; \
+    CB(hi, l5) prefix_bit(gb, bit, &gb->CPU_NEXT.l); NEXT; \
+    CB(hi, l6) \
+        n8 = mem_read(gb, reg_hl_read(gb)); \
+        prefix_bit(gb, bit, &n8); \
+        NEXT; \
+    CB(hi, l7) prefix_bit(gb, bit, &gb->CPU_NEXT.a); NEXT;
+
 // Execute prefixed instructions
-int execute_prefix(uint8_t op) {
-    uint8_t op_high = op >> 4;
-    uint8_t op_low = op & 0xF;
+int execute_prefix(gb_t *gb, uint8_t op) {
+#ifdef DISPATCH_TABLE
+    static void *const handlers[256] = HANDLER_TABLE(cb);
+#endif
 
-    uint8_t *reg;
+    int t = cpu_ops[0x100 | op].cycles;
     uint8_t n8;
-    bool hl_mem = 0;
-    switch(op_low%8) {
-        case 0: reg = &cpu_next.b; break;
-        case 1: reg = &cpu_next.c; break;
-        case 2: reg = &cpu_next.d; break;
-        case 3: reg = &cpu_next.e; break;
-        case 4: reg = &cpu_next.h; break;
-        case 5: reg = &cpu_next.l; break;
-        case 6:
-            n8 = mem_read(reg_hl_read());
-            reg = &n8;
-            hl_mem = 1;
-            break;
-        case 7: reg = &cpu_next.a; break;
-    }
 
-    bool bank = op_low / 8;
-    switch(((uint8_t)bank << 4) | op_high) {
-        case 0x00: prefix_rlc(reg); break;
-        case 0x10: prefix_rrc(reg); break;
-        case 0x01: prefix_rl(reg); break;
-        case 0x11: prefix_rr(reg); break;
-        case 0x02: prefix_sla(reg); break;
-        case 0x12: prefix_sra(reg); break;
-        case 0x03: prefix_swap(reg); break;
-        case 0x13: prefix_srl(reg); break;
-        case 0x04: prefix_bit(0, reg); break;
-        case 0x14: prefix_bit(1, reg); break;
-        case 0x05: prefix_bit(2, reg); break;
-        case 0x15: prefix_bit(3, reg); break;
-        case 0x06: prefix_bit(4, reg); break;
-        case 0x16: prefix_bit(5, reg); break;
-        case 0x07: prefix_bit(6, reg); break;
-        case 0x17: prefix_bit(7, reg); break;
-        case 0x08: prefix_res(0, reg); break;
-        case 0x18: prefix_res(1, reg); break;
-        case 0x09: prefix_res(2, reg); break;
-        case 0x19: prefix_res(3, reg); break;
-        case 0x0A: prefix_res(4, reg); break;
-        case 0x1A: prefix_res(5, reg); break;
-        case 0x0B: prefix_res(6, reg); break;
-        case 0x1B: prefix_res(7, reg); break;
-        case 0x0C: prefix_set(0, reg); break;
-        case 0x1C: prefix_set(1, reg); break;
-        case 0x0D: prefix_set(2, reg); break;
-        case 0x1D: prefix_set(3, reg); break;
-        case 0x0E: prefix_set(4, reg); break;
-        case 0x1E: prefix_set(5, reg); break;
-        case 0x0F: prefix_set(6, reg); break;
-        case 0x1F: prefix_set(7, reg); break;
-        default:
-            printf("Unknown PREFIX OP:0x%X\n", op);
-            exit(1);
-    }
-
-    int t = 8;
-    if (hl_mem && ((op_high < 4) || (op_high > 7))) {
-        t = 16; // Non-bit HL instruction
-        mem_write_next(reg_hl_read(), n8);
-    } else if (hl_mem) {
-        t = 12; // Bit HL instruction
-    }
+    DISPATCH(handlers, op)
+        PREFIX_R(0, LO_0, prefix_rlc, gb)
+        PREFIX_R(0, LO_8, prefix_rrc, gb)
+        PREFIX_R(1, LO_0, prefix_rl, gb)
+        PREFIX_R(1, LO_8, prefix_rr, gb)
+        PREFIX_R(2, LO_0, prefix_sla, gb)
+        PREFIX_R(2, LO_8, prefix_sra, gb)
+        PREFIX_R(3, LO_0, prefix_swap, gb)
+        PREFIX_R(3, LO_8, prefix_srl, gb)
+        PREFIX_BIT(4, LO_0, 0)
+        PREFIX_BIT(4, LO_8, 1)
+        PREFIX_BIT(5, LO_0, 2)
+        PREFIX_BIT(5, LO_8, 3)
+        PREFIX_BIT(6, LO_0, 4)
+        PREFIX_BIT(6, LO_8, 5)
+        PREFIX_BIT(7, LO_0, 6)
+        PREFIX_BIT(7, LO_8, 7)
+        PREFIX_R(8, LO_0, prefix_res, 0)
+        PREFIX_R(8, LO_8, prefix_res, 1)
+        PREFIX_R(9, LO_0, prefix_res, 2)
+        PREFIX_R(9, LO_8, prefix_res, 3)
+        PREFIX_R(A, LO_0, prefix_res, 4)
+        PREFIX_R(A, LO_8, prefix_res, 5)
+        PREFIX_R(B, LO_0, prefix_res, 6)
+        PREFIX_R(B, LO_8, prefix_res, 7)
+        PREFIX_R(C, LO_0, prefix_set, 0)
+        PREFIX_R(C, LO_8, prefix_set, 1)
+        PREFIX_R(D, LO_0, prefix_set, 2)
+        PREFIX_R(D, LO_8, prefix_set, 3)
+        PREFIX_R(E, LO_0, prefix_set, 4)
+        PREFIX_R(E, LO_8, prefix_set, 5)
+        PREFIX_R(F, LO_0, prefix_set, 6)
+        PREFIX_R(F, LO_8, prefix_set, 7)
+    DISPATCH_END
 
+next:
     return t;
 }
 
 // Opcode helper functions
-static void add_a(uint8_t *reg) {
-    cpu_next.a += *reg;
-    flag_set_z(cpu_next.a);
-    flag_set_n(0);
-    flag_set_h(((cpu.a & 0x0F) + (*reg & 0x0F)) > 0x0F);
-    flag_set_c(cpu_next.a < cpu.a);
+// Flags are worked out from the old A before it is replaced
+static void add_a(gb_t *gb, uint8_t value) {
+    uint8_t result = gb->cpu.a + value;
+    flag_set_z(gb, result);
+    flag_set_n(gb, 0);
+    flag_set_h_add(gb, gb->cpu.a, value, result);
+    flag_set_c(gb, result < gb->cpu.a);
+    gb->CPU_NEXT.a = result;
 }
 
-static void adc_a(uint8_t *reg) {
-    uint8_t carry = flag_get_c();
-    uint16_t result = cpu.a + *reg + carry;
-    flag_set_z((uint8_t)result);
-    flag_set_n(0);
-    flag_set_h(((cpu.a & 0x0F) + (*reg & 0x0F) + carry) > 0x0F);
-    flag_set_c(result > 0xFF);
-    cpu_next.a = (uint8_t)result;
+static void adc_a(gb_t *gb, uint8_t value) {
+    uint8_t carry = flag_get_c(gb);
+    uint16_t result = gb->cpu.a + value + carry;
+    flag_set_z(gb, (uint8_t)result);
+    flag_set_n(gb, 0);
+    flag_set_h_add(gb, gb->cpu.a, value, result);
+    flag_set_c(gb, result > 0xFF);
+    gb->CPU_NEXT.a = (uint8_t)result;
 }
 
-static void sub_a(uint8_t *reg) {
-    cpu_next.a -= *reg;
-    flag_set_z(cpu_next.a);
-    flag_set_n(1);
-    flag_set_h((cpu.a & 0x0F) < (*reg & 0x0F));
-    flag_set_c(*reg > cpu.a);
+static void sub_a(gb_t *gb, uint8_t value) {
+    uint8_t result = gb->cpu.a - value;
+    flag_set_z(gb, result);
+    flag_set_n(gb, 1);
+    flag_set_h_add(gb, gb->cpu.a, value, result);
+    flag_set_c(gb, value > gb->cpu.a);
+    gb->CPU_NEXT.a = result;
 }
 
-static void sbc_a(uint8_t *reg) {
-    uint8_t carry = flag_get_c();
-    uint16_t result = cpu.a - *reg - carry;
-    flag_set_z((uint8_t)result);
-    flag_set_n(1);
-    flag_set_h((cpu.a & 0x0F) < ((*reg & 0x0F) + carry));
-    flag_set_c(result > 0xFF);
-    cpu_next.a = (uint8_t)result;
+static void sbc_a(gb_t *gb, uint8_t value) {
+    uint8_t carry = flag_get_c(gb);
+    uint16_t result = gb->cpu.a - value - carry;
+    flag_set_z(gb, (uint8_t)result);
+    flag_set_n(gb, 1);
+    flag_set_h_add(gb, gb->cpu.a, value, result);
+    flag_set_c(gb, result > 0xFF);
+    gb->CPU_NEXT.a = (uint8_t)result;
 }
 
-static void and_a(uint8_t *reg) {
-    cpu_next.a &= *reg;
-    flag_set_z(cpu_next.a);
-    flag_set_n(0);
-    flag_set_h(1);
-    flag_set_c(0);
+static void and_a(gb_t *gb, uint8_t value) {
+    gb->CPU_NEXT.a = gb->cpu.a & value;
+    flag_set_z(gb, gb->CPU_NEXT.a);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 1);
+    flag_set_c(gb, 0);
 }
 
-static void xor_a(uint8_t *reg) {
-    cpu_next.a ^= *reg;
-    flag_set_z(cpu_next.a);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(0);
+static void xor_a(gb_t *gb, uint8_t value) {
+    gb->CPU_NEXT.a = gb->cpu.a ^ value;
+    flag_set_z(gb, gb->CPU_NEXT.a);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, 0);
 }
 
-static void or_a(uint8_t *reg) {
-    cpu_next.a |= *reg;
-    flag_set_z(cpu_next.a);
-    flag_set_n(0);
-    flag_set_h(0);
-    flag_set_c(0);
+static void or_a(gb_t *gb, uint8_t value) {
+    gb->CPU_NEXT.a = gb->cpu.a | value;
+    flag_set_z(gb, gb->CPU_NEXT.a);
+    flag_set_n(gb, 0);
+    flag_set_h(gb, 0);
+    flag_set_c(gb, 0);
 }
 
-static void cp_a(uint8_t *reg) {
-    uint8_t result = cpu.a - *reg;
-    flag_set_z(result);
-    flag_set_n(1);
-    flag_set_h((*reg & 0x0F) > (cpu.a & 0x0F));
-    flag_set_c(*reg > cpu.a);
+static void cp_a(gb_t *gb, uint8_t value) {
+    uint8_t result = gb->cpu.a - value;
+    flag_set_z(gb, result);
+    flag_set_n(gb, 1);
+    flag_set_h_add(gb, gb->cpu.a, value, result);
+    flag_set_c(gb, value > gb->cpu.a);
 }
 
-uint8_t cpu_execute() {
-    uint8_t t = 0;
+#define OP(hi, lo) HANDLER(op, hi, lo)
+
+// LD r,r' and LD r,[HL] into one register for a half row
+#define LD_R(hi, half, dst) LD_R_(hi, half, dst)
+#define LD_R_(hi, l0, l1, l2, l3, l4, l5, l6, l7, dst) \
+    OP(hi, l0) gb->CPU_NEXT.dst = gb->cpu.b; NEXT; \
+    OP(hi, l1) gb->CPU_NEXT.dst = gb->cpu.c; NEXT; \
+    OP(hi, l2) gb->CPU_NEXT.dst = gb->cpu.d; NEXT; \
+    OP(hi, l3) gb->CPU_NEXT.dst = gb->cpu.e; NEXT; \
+    OP(hi, l4) gb->CPU_NEXT.dst = gb->cpu.h; NEXT; \
+    OP(hi, l5) gb->CPU_NEXT.dst = gb->cpu.l; NEXT; \
+    OP(hi, l6) gb->CPU_NEXT.dst = mem_read(gb, reg_hl_read(gb)); NEXT; \
+    OP(hi, l7) gb->CPU_NEXT.dst = gb->cpu.a; NEXT;
+
+// An ALU operation on A and each register of a half row
+#define ALU_R(hi, half, fn) ALU_R_(hi, half, fn)
+#define ALU_R_(hi, l0, l1, l2, l3, l4, l5, l6, l7, fn) \
+    OP(hi, l0) fn(gb, gb->cpu.b); NEXT; \
+    OP(hi, l1) fn(gb, gb->cpu.c); NEXT; \
+    OP(hi, l2) fn(gb, gb->cpu.d); NEXT; \
+    OP(hi, l3) fn(gb, gb->cpu.e); NEXT; \
+    OP(hi, l4) fn(gb, gb->cpu.h); NEXT; \
+    OP(hi, l5) fn(gb, gb->cpu.l); NEXT; \
+    OP(hi, l6) fn(gb, mem_read(gb, reg_hl_read(gb))); NEXT; \
+    OP(hi, l7) fn(gb, gb->cpu.a); NEXT;
 
-    // Fetch instruction
-    cpu.op = mem_read(cpu.pc);
+// Run the instruction at PC with its operands already fetched, t cycles are returned
+// The caller has made sure no interrupt is due and the CPU is neither halted nor stopped
+uint8_t cpu_execute_op(gb_t *gb, uint8_t op, uint16_t imm16) {
+#ifdef DISPATCH_TABLE
+    static void *const handlers[256] = HANDLER_TABLE(op);
+#endif
 
-    DEBUG_PRINTF_CPU("PC:0x%X OP:0x%X ", cpu.pc, cpu.op);
+    uint16_t pc = gb->cpu.pc;
+    uint8_t t = cpu_ops[op].cycles;
+    gb->CPU_NEXT.pc += cpu_ops[op].length;
 
     // Temporary variables
+    uint8_t imm8 = imm16;
     uint8_t n8;
     uint8_t result;
     uint16_t result16;
 
+    DISPATCH(handlers, op)
+        OP(0, 0) // NOP
+            NEXT;
+        OP(0, 1) // LD BC,n16
+            reg_bc_write(gb, imm16);
+            NEXT;
+        OP(0, 2) // LD [BC], A
+            cpu_write(gb, reg_bc_read(gb), gb->cpu.a);
+            NEXT;
+        OP(0, 3) // INC BC
+            reg_bc_write(gb, reg_bc_read(gb) + 1);
+            NEXT;
+        OP(0, 4) // INC B
+            result = gb->cpu.b + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.b, 1, result);
+            gb->CPU_NEXT.b = result;
+            NEXT;
+        OP(0, 5) // DEC B
+            result = gb->cpu.b - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.b, 1, result);
+            gb->CPU_NEXT.b = result;
+            NEXT;
+        OP(0, 6) // LD B,n8
+            gb->CPU_NEXT.b = imm8;
+            NEXT;
+        OP(0, 7) // RLCA
+            result = (gb->cpu.a << 1) | (gb->cpu.a >> 7);
+            flag_set_z(gb, 1);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, 0);
+            flag_set_c(gb, gb->cpu.a >> 7);
+            gb->CPU_NEXT.a = result;
+            NEXT;
+        OP(0, 8) // LD [a16],SP
+            cpu_write16(gb, imm16, gb->cpu.sp);
+            NEXT;
+        OP(0, 9) // ADD HL,BC
+            result16 = reg_hl_read(gb) + reg_bc_read(gb);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, ((reg_hl_read(gb) & 0x0FFF) + (reg_bc_read(gb) & 0x0FFF)) > 0x0FFF);
+            flag_set_c(gb, result16 < reg_hl_read(gb));
+            reg_hl_write(gb, result16);
+            NEXT;
+        OP(0, A) // LD A,[BC];
+            gb->CPU_NEXT.a = mem_read(gb, reg_bc_read(gb));
+            NEXT;
+        OP(0, B) // DEC BC
+            reg_bc_write(gb, reg_bc_read(gb) - 1);
+            NEXT;
+        OP(0, C) // INC C
+            result = gb->cpu.c + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.c, 1, result);
+            gb->CPU_NEXT.c = result;
+            NEXT;
+        OP(0, D) // DEC C
+            result = gb->cpu.c - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.c, 1, result);
+            gb->CPU_NEXT.c = result;
+            NEXT;
+        OP(0, E) // LD C,n8
+            gb->CPU_NEXT.c = imm8;
+            NEXT;
+        OP(0, F) // RRCA
+            result = (gb->cpu.a >> 1) | (gb->cpu.a << 7);
+            flag_set_z(gb, 1);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, 0);
+            flag_set_c(gb, gb->cpu.a & 1);
+            gb->CPU_NEXT.a = result;
+            NEXT;
+        OP(1, 0) // STOP
+            gb->CPU_NEXT.stop = 1;
+            NEXT;
+        OP(1, 1) // LD DE,n16
+            reg_de_write(gb, imm16);
+            NEXT;
+        OP(1, 2) // LD [DE], A
+            cpu_write(gb, reg_de_read(gb), gb->cpu.a);
+            NEXT;
+        OP(1, 3) // INC DE
+            reg_de_write(gb, reg_de_read(gb) + 1);
+            NEXT;
+        OP(1, 4) // INC D
+            result = gb->cpu.d + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.d, 1, result);
+            gb->CPU_NEXT.d = result;
+            NEXT;
+        OP(1, 5) // DEC D
+            result = gb->cpu.d - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.d, 1, result);
+            gb->CPU_NEXT.d = result;
+            NEXT;
+        OP(1, 6) // LD D,n8
+            gb->CPU_NEXT.d = imm8;
+            NEXT;
+        OP(1, 7) // RLA
+            result = (gb->cpu.a << 1) + flag_get_c(gb);
+            flag_set_z(gb, 1);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, 0);
+            flag_set_c(gb, gb->cpu.a >> 7);
+            gb->CPU_NEXT.a = result;
+            NEXT;
+        OP(1, 8) // JR e8
+            gb->CPU_NEXT.pc += (int8_t)imm8;
+            NEXT;
+        OP(1, 9) // ADD HL,DE
+            result16 = reg_hl_read(gb) + reg_de_read(gb);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, ((reg_hl_read(gb) & 0x0FFF) + (reg_de_read(gb) & 0x0FFF)) > 0x0FFF);
+            flag_set_c(gb, result16 < reg_hl_read(gb));
+            reg_hl_write(gb, result16);
+            NEXT;
+        OP(1, A) // LD A,[DE];
+            gb->CPU_NEXT.a = mem_read(gb, reg_de_read(gb));
+            NEXT;
+        OP(1, B) // DEC DE
+            reg_de_write(gb, reg_de_read(gb) - 1);
+            NEXT;
+        OP(1, C) // INC E
+            result = gb->cpu.e + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.e, 1, result);
+            gb->CPU_NEXT.e = result;
+            NEXT;
+        OP(1, D) // DEC E
+            result = gb->cpu.e - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.e, 1, result);
+            gb->CPU_NEXT.e = result;
+            NEXT;
+        OP(1, E) // LD E,n8
+            gb->CPU_NEXT.e = imm8;
+            NEXT;
+        OP(1, F) // RRA
+            result = (gb->cpu.a >> 1) + ((uint8_t)flag_get_c(gb) << 7);
+            flag_set_z(gb, 1);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, 0);
+            flag_set_c(gb, gb->cpu.a & 1);
+            gb->CPU_NEXT.a = result;
+            NEXT;
+        OP(2, 0) // JR NZ,e8
+            if (!flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc += (int8_t)imm8;
+            }
+            NEXT;
+        OP(2, 1) // LD HL,n16
+            reg_hl_write(gb, imm16);
+            NEXT;
+        OP(2, 2) // LD [HL+], A
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.a);
+            reg_hl_write(gb, reg_hl_read(gb) + 1);
+            NEXT;
+        OP(2, 3) // INC HL
+            reg_hl_write(gb, reg_hl_read(gb) + 1);
+            NEXT;
+        OP(2, 4) // INC H
+            result = gb->cpu.h + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.h, 1, result);
+            gb->CPU_NEXT.h = result;
+            NEXT;
+        OP(2, 5) // DEC H
+            result = gb->cpu.h - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.h, 1, result);
+            gb->CPU_NEXT.h = result;
+            NEXT;
+        OP(2, 6) // LD H,n8
+            gb->CPU_NEXT.h = imm8;
+            NEXT;
+        OP(2, 7) // DAA
+            uint8_t adj = 0;
+            if (flag_get_n(gb)) {
+                if (flag_get_h(gb)) { adj += 0x6; }
+                if (flag_get_c(gb)) { adj += 0x60; }
+                gb->CPU_NEXT.a -= adj;
+            } else {
+                if (flag_get_h(gb) || ((gb->cpu.a & 0xF) > 0x9)) { adj += 0x6; }
+                if (flag_get_c(gb) || (gb->cpu.a > 0x99)) {
+                    adj += 0x60;
+                    flag_set_c(gb, 1);
+                }
+                gb->CPU_NEXT.a += adj;
+            }
+            flag_set_z(gb, gb->CPU_NEXT.a);
+            flag_set_h(gb, 0);
+            NEXT;
+        OP(2, 8) // JR Z,e8
+            if (flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc += (int8_t)imm8;
+            }
+            NEXT;
+        OP(2, 9) // ADD HL,HL
+            result16 = reg_hl_read(gb) + reg_hl_read(gb);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, ((reg_hl_read(gb) & 0x0FFF) + (reg_hl_read(gb) & 0x0FFF)) > 0x0FFF);
+            flag_set_c(gb, result16 < reg_hl_read(gb));
+            reg_hl_write(gb, result16);
+            NEXT;
+        OP(2, A) // LD A,[HL+]
+            gb->CPU_NEXT.a = mem_read(gb, reg_hl_read(gb));
+            reg_hl_write(gb, reg_hl_read(gb)+1);
+            NEXT;
+        OP(2, B) // DEC HL
+            reg_hl_write(gb, reg_hl_read(gb) - 1);
+            NEXT;
+        OP(2, C) // INC L
+            result = gb->cpu.l + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.l, 1, result);
+            gb->CPU_NEXT.l = result;
+            NEXT;
+        OP(2, D) // DEC L
+            result = gb->cpu.l - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.l, 1, result);
+            gb->CPU_NEXT.l = result;
+            NEXT;
+        OP(2, E) // LD L,n8
+            gb->CPU_NEXT.l = imm8;
+            NEXT;
+        OP(2, F) // CPL
+            gb->CPU_NEXT.a = ~gb->cpu.a;
+            flag_set_n(gb, 1);
+            flag_set_h(gb, 1);
+            NEXT;
+        OP(3, 0) // JR NC,e8
+            if (!flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc += (int8_t)imm8;
+            }
+            NEXT;
+        OP(3, 1) // LD SP,n16
+            gb->CPU_NEXT.sp = imm16;
+            NEXT;
+        OP(3, 2) // LD [HL-],A
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.a);
+            reg_hl_write(gb, reg_hl_read(gb) - 1);
+            NEXT;
+        OP(3, 3) // INC SP
+            gb->CPU_NEXT.sp += 1;
+            NEXT;
+        OP(3, 4) // INC [HL]
+            n8 = mem_read(gb, reg_hl_read(gb));
+            result = n8 + 1;
+            cpu_write(gb, reg_hl_read(gb), result);
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, n8, 1, result);
+            NEXT;
+        OP(3, 5) // DEC [HL]
+            n8 = mem_read(gb, reg_hl_read(gb));
+            result = n8 - 1;
+            cpu_write(gb, reg_hl_read(gb), result);
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, n8, 1, result);
+            NEXT;
+        OP(3, 6) // LD [HL],n8
+            cpu_write(gb, reg_hl_read(gb), imm8);
+            NEXT;
+        OP(3, 7) // SCF
+            flag_set_n(gb, 0);
+            flag_set_h(gb, 0);
+            flag_set_c(gb, 1);
+            NEXT;
+        OP(3, 8) // JR C,e8
+            if (flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc += (int8_t)imm8;
+            }
+            NEXT;
+        OP(3, 9) // ADD HL,SP
+            result16 = reg_hl_read(gb) + gb->cpu.sp;
+            flag_set_n(gb, 0);
+            flag_set_h(gb, ((reg_hl_read(gb) & 0x0FFF) + (gb->cpu.sp & 0x0FFF)) > 0x0FFF);
+            flag_set_c(gb, result16 < reg_hl_read(gb));
+            reg_hl_write(gb, result16);
+            NEXT;
+        OP(3, A) // LD A,[HL-]
+            gb->CPU_NEXT.a = mem_read(gb, reg_hl_read(gb));
+            reg_hl_write(gb, reg_hl_read(gb)-1);
+            NEXT;
+        OP(3, B) // DEC SP
+            gb->CPU_NEXT.sp -= 1;
+            NEXT;
+        OP(3, C) // INC A
+            result = gb->cpu.a + 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 0);
+            flag_set_h_add(gb, gb->cpu.a, 1, result);
+            gb->CPU_NEXT.a = result;
+            NEXT;
+        OP(3, D) // DEC A
+            result = gb->cpu.a - 1;
+            flag_set_z(gb, result);
+            flag_set_n(gb, 1);
+            flag_set_h_add(gb, gb->cpu.a, 1, result);
+            gb->CPU_NEXT.a = result;
+            NEXT;
+        OP(3, E) // LD A,n8
+            gb->CPU_NEXT.a = imm8;
+            NEXT;
+        OP(3, F) // CCF
+            flag_set_n(gb, 0);
+            flag_set_h(gb, 0);
+            flag_set_c(gb, !flag_get_c(gb));
+            NEXT;
+        LD_R(4, LO_0, b)
+        LD_R(4, LO_8, c)
+        LD_R(5, LO_0, d)
+        LD_R(5, LO_8, e)
+        LD_R(6, LO_0, h)
+        LD_R(6, LO_8, l)
+        OP(7, 0) // LD [HL],B
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.b);
+            NEXT;
+        OP(7, 1) // LD [HL],C
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.c);
+            NEXT;
+        OP(7, 2) // LD [HL],D
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.d);
+            NEXT;
+        OP(7, 3) // LD [HL],E
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.e);
+            NEXT;
+        OP(7, 4) // LD [HL],H
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.h);
+            NEXT;
+        OP(7, 5) // LD [HL],L
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.l);
+            NEXT;
+        OP(7, 6) // HALT
+            gb->CPU_NEXT.halt = 1;
+            NEXT;
+        OP(7, 7) // LD [HL],A
+            cpu_write(gb, reg_hl_read(gb), gb->cpu.a);
+            NEXT;
+        LD_R(7, LO_8, a)
+        ALU_R(8, LO_0, add_a)
+        ALU_R(8, LO_8, adc_a)
+        ALU_R(9, LO_0, sub_a)
+        ALU_R(9, LO_8, sbc_a)
+        ALU_R(A, LO_0, and_a)
+        ALU_R(A, LO_8, xor_a)
+        ALU_R(B, LO_0, or_a)
+        ALU_R(B, LO_8, cp_a)
+        OP(C, 0) // RET NZ
+            if (!flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = mem_read16(gb, gb->cpu.sp);
+                gb->CPU_NEXT.sp += 2;
+            }
+            NEXT;
+        OP(C, 1) // POP BC
+            reg_bc_write(gb, mem_read16(gb, gb->cpu.sp));
+            gb->CPU_NEXT.sp += 2;
+            NEXT;
+        OP(C, 2) // JP NZ,a16
+            if (!flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+            }
+            NEXT;
+        OP(C, 3) // JP a16
+            gb->CPU_NEXT.pc = imm16;
+            NEXT;
+        OP(C, 4) // CALL NZ,a16
+            if (!flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+                cpu_push(gb, pc+3);
+            }
+            NEXT;
+        OP(C, 5) // PUSH BC
+            cpu_push(gb, reg_bc_read(gb));
+            NEXT;
+        OP(C, 6) // ADD A,n8
+            add_a(gb, imm8);
+            NEXT;
+        OP(C, 7) // RST $00
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0000;
+            NEXT;
+        OP(C, 8) // RET Z
+            if (flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = mem_read16(gb, gb->cpu.sp);
+                gb->CPU_NEXT.sp += 2;
+            }
+            NEXT;
+        OP(C, 9) // RET
+            gb->CPU_NEXT.pc = mem_read16(gb, gb->cpu.sp);
+            gb->CPU_NEXT.sp += 2;
+            NEXT;
+        OP(C, A) // JP Z,a16
+            if (flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+            }
+            NEXT;
+        OP(C, B) // PREFIX
+            t = execute_prefix(gb, imm8);
+            NEXT;
+        OP(C, C) // CALL Z,a16
+            if (flag_get_z(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+                cpu_push(gb, pc+3);
+            }
+            NEXT;
+        OP(C, D) // CALL a16
+            gb->CPU_NEXT.pc = imm16;
+            cpu_push(gb, pc+3);
+            NEXT;
+        OP(C, E) // ADC A,n8
+            adc_a(gb, imm8);
+            NEXT;
+        OP(C, F) // RST $08
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0008;
+            NEXT;
+        OP(D, 0) // RET NC
+            if (!flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = mem_read16(gb, gb->cpu.sp);
+                gb->CPU_NEXT.sp += 2;
+            }
+            NEXT;
+        OP(D, 1) // POP DE
+            reg_de_write(gb, mem_read16(gb, gb->cpu.sp));
+            gb->CPU_NEXT.sp += 2;
+            NEXT;
+        OP(D, 2) // JP NC,a16
+            if (!flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+            }
+            NEXT;
+        OP(D, 4) // CALL NC,a16
+            if (!flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+                cpu_push(gb, pc+3);
+            }
+            NEXT;
+        OP(D, 5) // PUSH DE
+            cpu_push(gb, reg_de_read(gb));
+            NEXT;
+        OP(D, 6) // SUB A,n8
+            sub_a(gb, imm8);
+            NEXT;
+        OP(D, 7) // RST $10
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0010;
+            NEXT;
+        OP(D, 8) // RET C
+            if (flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = mem_read16(gb, gb->cpu.sp);
+                gb->CPU_NEXT.sp += 2;
+            }
+            NEXT;
+        OP(D, 9) // RETI
+            gb->CPU_NEXT.pc = mem_read16(gb, gb->cpu.sp);
+            gb->CPU_NEXT.sp += 2;
+            gb->CPU_NEXT.ime = 1;
+            NEXT;
+        OP(D, A) // JP C,a16
+            if (flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+            }
+            NEXT;
+        OP(D, C) // CALL C,a16
+            if (flag_get_c(gb)) { // Taken
+                t = cpu_ops[op].taken;
+                gb->CPU_NEXT.pc = imm16;
+                cpu_push(gb, pc+3);
+            }
+            NEXT;
+        OP(D, E) // SBC A,n8
+            sbc_a(gb, imm8);
+            NEXT;
+        OP(D, F) // RST $18
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0018;
+            NEXT;
+        OP(E, 0) // LDH [a8],A
+            cpu_write(gb, 0xFF00+(uint16_t)imm8, gb->cpu.a);
+            NEXT;
+        OP(E, 1) // POP HL
+            reg_hl_write(gb, mem_read16(gb, gb->cpu.sp));
+            gb->CPU_NEXT.sp += 2;
+            NEXT;
+        OP(E, 2) // LDH [C],A
+            cpu_write(gb, 0xFF00+(uint16_t)gb->cpu.c, gb->cpu.a);
+            NEXT;
+        OP(E, 5) // PUSH HL
+            cpu_push(gb, reg_hl_read(gb));
+            NEXT;
+        OP(E, 6) // AND A,n8
+            and_a(gb, imm8);
+            NEXT;
+        OP(E, 7) // RST $20
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0020;
+            NEXT;
+        OP(E, 8) // ADD SP,e8
+            n8 = imm8;
+            flag_set_z(gb, 1);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, ((gb->cpu.sp & 0x0F) + (n8 & 0x0F)) > 0x0F);
+            flag_set_c(gb, ((gb->cpu.sp & 0xFF) + n8) > 0xFF);
+            gb->CPU_NEXT.sp += (int8_t)n8;
+            NEXT;
+        OP(E, 9) // JP HL
+            gb->CPU_NEXT.pc = reg_hl_read(gb);
+            NEXT;
+        OP(E, A) // LD [a16],A
+            cpu_write(gb, imm16, gb->cpu.a);
+            NEXT;
+        OP(E, E) // XOR A,n8
+            xor_a(gb, imm8);
+            NEXT;
+        OP(E, F) // RST $28
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0028;
+            NEXT;
+        OP(F, 0) // LDH A,[a8]
+            gb->CPU_NEXT.a = mem_read(gb, 0xFF00+(uint16_t)imm8);
+            NEXT;
+        OP(F, 1) // POP AF
+            reg_af_write(gb, mem_read16(gb, gb->cpu.sp) & 0xFFF0);
+            gb->CPU_NEXT.sp += 2;
+            NEXT;
+        OP(F, 2) // LDH A,[C]
+            gb->CPU_NEXT.a = mem_read(gb, 0xFF00+(uint16_t)gb->cpu.c);
+            NEXT;
+        OP(F, 3) // DI
+            gb->CPU_NEXT.ime = 0;
+            NEXT;
+        OP(F, 5) // PUSH AF
+            cpu_push(gb, reg_af_read(gb) & 0xFFF0);
+            NEXT;
+        OP(F, 6) // OR A,n8
+            or_a(gb, imm8);
+            NEXT;
+        OP(F, 7) // RST $30
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0030;
+            NEXT;
+        OP(F, 8) // LD HL,SP+e8
+            n8 = imm8;
+            reg_hl_write(gb, gb->cpu.sp + (int8_t)n8);
+            flag_set_z(gb, 1);
+            flag_set_n(gb, 0);
+            flag_set_h(gb, ((gb->cpu.sp & 0x0F) + (n8 & 0x0F)) > 0x0F);
+            flag_set_c(gb, ((gb->cpu.sp & 0xFF) + n8) > 0xFF);
+            NEXT;
+        OP(F, 9) // LD SP,HL
+            gb->CPU_NEXT.sp = reg_hl_read(gb);
+            NEXT;
+        OP(F, A) // LD A,[a16]
+            gb->CPU_NEXT.a = mem_read(gb, imm16);
+            NEXT;
+        OP(F, B) // EI
+            gb->CPU_NEXT.ime_pending = 1;
+            NEXT;
+        OP(F, E) // CP A,n8
+            cp_a(gb, imm8);
+            NEXT;
+        OP(F, F) // RST $38
+            cpu_push(gb, pc+1);
+            gb->CPU_NEXT.pc = 0x0038;
+            NEXT;
+        OP(D, 3) OP(D, B) OP(D, D) OP(E, 3) OP(E, 4) OP(E, B) OP(E, C) OP(E, D) OP(F, 4) OP(F, C) OP(F, D)
+            printf("Unknown OP 0x%X\n", op);
+            exit(1);
+    DISPATCH_END
+
+next:
+    DEBUG_PRINTF_CPU("AF:0x%02X%02X BC:0x%02X%02X ", gb->CPU_NEXT.a,flags_pack(&gb->CPU_NEXT),gb->CPU_NEXT.b,gb->CPU_NEXT.c);
+    DEBUG_PRINTF_CPU("DE:0x%02X%02X HL:0x%02X%02X ",gb->CPU_NEXT.d,gb->CPU_NEXT.e,gb->CPU_NEXT.h,gb->CPU_NEXT.l);
+    DEBUG_PRINTF_CPU("SP:0x%04X\n",gb->CPU_NEXT.sp);
+
+    return t;
+}
+
+uint8_t cpu_execute(gb_t *gb) {
+    uint8_t t = 0;
+
+    // Fetch instruction, straight from its page when that is mapped
+    // Pages follow the cartridge and WRAM banks, so nothing fetched here can go stale
+    uint16_t pc = gb->cpu.pc;
+    uint8_t *page = gb->mem.read_page[pc >> 8];
+    gb->cpu.op = page != NULL ? page[pc & 0xFF] : mem_read(gb, pc);
+
+    DEBUG_PRINTF_CPU("PC:0x%X OP:0x%X %s ", pc, gb->cpu.op, cpu_ops[gb->cpu.op].mnemonic);
+
     // Calculate if an interrupt should be handled
-    bool interrupt = cpu.ime && (mem.ie & mem.iflag);
+    bool interrupt = gb->cpu.ime && (gb->mem.ie & gb->mem.iflag);
+
+#ifndef CPU_REFERENCE
+    // EI lands once the next instruction is done, which may still DI
+    if (gb->cpu.ime_pending) {
+        gb->cpu.ime = 1;
+        gb->cpu.ime_pending = 0;
+    }
+#endif
 
     // Compute state mutation
-    if (!interrupt && !cpu.halt && !cpu.stop) { // No interrupt triggered
-        switch(cpu.op) {
-            case 0x00: // NOP
-                t = 4;
-                cpu_next.pc += 1;
-                break;
-            case 0x01: // LD BC,n16
-                t = 12;
-                cpu_next.pc += 3;
-                reg_bc_write(mem_read16(cpu.pc+1));
-                break;
-            case 0x02: // LD [BC], A
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_bc_read(), cpu.a);
-                break;
-            case 0x03: // INC BC
-                t = 8;
-                cpu_next.pc += 1;
-                reg_bc_write(reg_bc_read() + 1);
-                break;
-            case 0x04: // INC B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.b + 1;
-                flag_set_z(cpu_next.b);
-                flag_set_n(0);
-                flag_set_h((cpu.b & 0x0F) == 0x0F);
-                break;
-            case 0x05: // DEC B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.b - 1;
-                flag_set_z(cpu_next.b);
-                flag_set_n(1);
-                flag_set_h((cpu.b & 0x0F) == 0x00);
-                break;
-            case 0x06: // LD B,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.b = mem_read(cpu.pc+1);
-                break;
-            case 0x07: // RLCA
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = (cpu.a << 1) | (cpu.a >> 7);
-                flag_set_z(1);
-                flag_set_n(0);
-                flag_set_h(0);
-                flag_set_c(cpu.a >> 7);
-                break;
-            case 0x08: // LD [a16],SP
-                t = 20;
-                cpu_next.pc += 3;
-                mem_write_next16(mem_read16(cpu.pc+1), cpu.sp);
-                break;
-            case 0x09: // ADD HL,BC
-                t = 8;
-                cpu_next.pc += 1;
-                result16 = reg_hl_read() + reg_bc_read();
-                reg_hl_write(result16);
-                flag_set_n(0);
-                flag_set_h(((reg_hl_read() & 0x0FFF) + (reg_bc_read() & 0x0FFF)) > 0x0FFF);
-                flag_set_c(result16 < reg_hl_read());
-                break;
-            case 0x0A: // LD A,[BC];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.a = mem_read(reg_bc_read());
-                break;
-            case 0x0B: // DEC BC
-                t = 8;
-                cpu_next.pc += 1;
-                reg_bc_write(reg_bc_read() - 1);
-                break;
-            case 0x0C: // INC C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c += 1;
-                flag_set_z(cpu_next.c);
-                flag_set_n(0);
-                flag_set_h((cpu.c & 0x0F) == 0x0F);
-                break;
-            case 0x0D: // DEC C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c -= 1;
-                flag_set_z(cpu_next.c);
-                flag_set_n(1);
-                flag_set_h((cpu.c & 0x0F) == 0);
-                break;
-            case 0x0E: // LD C,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.c = mem_read(cpu.pc+1);
-                break;
-            case 0x0F: // RRCA
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = (cpu.a >> 1) | (cpu.a << 7);
-                flag_set_z(1);
-                flag_set_n(0);
-                flag_set_h(0);
-                flag_set_c(cpu.a & 1);
-                break;
-            case 0x10: // STOP
-                t = 4;
-                cpu_next.pc += 2;
-                cpu_next.stop = 1;
-                break;
-            case 0x11: // LD DE,n16
-                t = 12;
-                cpu_next.pc += 3;
-                reg_de_write(mem_read16(cpu.pc+1));
-                break;
-            case 0x12: // LD [DE], A
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_de_read(), cpu.a);
-                break;
-            case 0x13: // INC DE
-                t = 8;
-                cpu_next.pc += 1;
-                reg_de_write(reg_de_read() + 1);
-                break;
-            case 0x14: // INC D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d += 1;
-                flag_set_z(cpu_next.d);
-                flag_set_n(0);
-                flag_set_h((cpu.d & 0x0F) == 0x0F);
-                break;
-            case 0x15: // DEC D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.d - 1;
-                flag_set_z(cpu_next.d);
-                flag_set_n(1);
-                flag_set_h((cpu.d & 0x0F) == 0);
-                break;
-            case 0x16: // LD D,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.d = mem_read(cpu.pc+1);
-                break;
-            case 0x17: // RLA
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = (cpu.a << 1) + flag_get_c();
-                flag_set_z(1);
-                flag_set_n(0);
-                flag_set_h(0);
-                flag_set_c(cpu.a >> 7);
-                break;
-            case 0x18: // JR e8
-                t = 12;
-                cpu_next.pc += 2 + (int8_t)mem_read(cpu.pc+1);
-                break;
-            case 0x19: // ADD HL,DE
-                t = 8;
-                cpu_next.pc += 1;
-                result16 = reg_hl_read() + reg_de_read();
-                reg_hl_write(result16);
-                flag_set_n(0);
-                flag_set_h(((reg_hl_read() & 0x0FFF) + (reg_de_read() & 0x0FFF)) > 0x0FFF);
-                flag_set_c(result16 < reg_hl_read());
-                break;
-            case 0x1A: // LD A,[DE];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.a = mem_read(reg_de_read());
-                break;
-            case 0x1B: // DEC DE
-                t = 8;
-                cpu_next.pc += 1;
-                reg_de_write(reg_de_read() - 1);
-                break;
-            case 0x1C: // INC E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e += 1;
-                flag_set_z(cpu_next.e);
-                flag_set_n(0);
-                flag_set_h((cpu.e & 0x0F) == 0x0F);
-                break;
-            case 0x1D: // DEC E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e -= 1;
-                flag_set_z(cpu_next.e);
-                flag_set_n(1);
-                flag_set_h((cpu.e & 0x0F) == 0x00);
-                break;
-            case 0x1E: // LD E,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.e = mem_read(cpu.pc+1);
-                break;
-            case 0x1F: // RRA
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = (cpu.a >> 1) + ((uint8_t)flag_get_c() << 7);
-                flag_set_z(1);
-                flag_set_n(0);
-                flag_set_h(0);
-                flag_set_c(cpu.a & 1);
-                break;
-            case 0x20: // JR NZ,e8
-                if (flag_get_z()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 2;
-                } else { // Taken
-                    t = 12;
-                    cpu_next.pc += 2 + (int8_t)mem_read(cpu.pc+1);
-                }
-                break;
-            case 0x21: // LD HL,n16
-                t = 12;
-                cpu_next.pc += 3;
-                reg_hl_write(mem_read16(cpu.pc+1));
-                break;
-            case 0x22: // LD [HL+], A
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.a);
-                reg_hl_write(reg_hl_read() + 1);
-                break;
-            case 0x23: // INC HL
-                t = 8;
-                cpu_next.pc += 1;
-                reg_hl_write(reg_hl_read() + 1);
-                break;
-            case 0x24: // INC H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h += 1;
-                flag_set_z(cpu_next.h);
-                flag_set_n(0);
-                flag_set_h((cpu.h & 0x0F) == 0x0F);
-                break;
-            case 0x25: // DEC H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h -= 1;
-                flag_set_z(cpu_next.h);
-                flag_set_n(1);
-                flag_set_h((cpu.h & 0x0F) == 0x00);
-                break;
-            case 0x26: // LD H,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.h = mem_read(cpu.pc+1);
-                break;
-            case 0x27: // DAA
-                t = 4;
-                cpu_next.pc += 1;
-                uint8_t adj = 0;
-                if (flag_get_n()) {
-                    if (flag_get_h()) { adj += 0x6; }
-                    if (flag_get_c()) { adj += 0x60; }
-                    cpu_next.a -= adj;
-                } else {
-                    if (flag_get_h() || ((cpu.a & 0xF) > 0x9)) { adj += 0x6; }
-                    if (flag_get_c() || (cpu.a > 0x99)) {
-                        adj += 0x60;
-                        flag_set_c(1);
-                    }
-                    cpu_next.a += adj;
-                }
-                flag_set_z(cpu_next.a);
-                flag_set_h(0);
-                break;
-            case 0x28: // JR Z,e8
-                if (!flag_get_z()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 2;
-                } else { // Taken
-                    t = 12;
-                    cpu_next.pc += 2 + (int8_t)mem_read(cpu.pc+1);
-                }
-                break;
-            case 0x29: // ADD HL,HL
-                t = 8;
-                cpu_next.pc += 1;
-                result16 = reg_hl_read() + reg_hl_read();
-                reg_hl_write(result16);
-                flag_set_n(0);
-                flag_set_h(((reg_hl_read() & 0x0FFF) + (reg_hl_read() & 0x0FFF)) > 0x0FFF);
-                flag_set_c(result16 < reg_hl_read());
-                break;
-            case 0x2A: // LD A,[HL+]
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.a = mem_read(reg_hl_read());
-                reg_hl_write(reg_hl_read()+1);
-                break;
-            case 0x2B: // DEC HL
-                t = 8;
-                cpu_next.pc += 1;
-                reg_hl_write(reg_hl_read() - 1);
-                break;
-            case 0x2C: // INC L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l += 1;
-                flag_set_z(cpu_next.l);
-                flag_set_n(0);
-                flag_set_h((cpu.l & 0x0F) == 0x0F);
-                break;
-            case 0x2D: // DEC L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l -= 1;
-                flag_set_z(cpu_next.l);
-                flag_set_n(1);
-                flag_set_h((cpu.l & 0x0F) == 0x00);
-                break;
-            case 0x2E: // LD L,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.l = mem_read(cpu.pc+1);
-                break;
-            case 0x2F: // CPL
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = ~cpu.a;
-                flag_set_n(1);
-                flag_set_h(1);
-                break;
-            case 0x30: // JR NC,e8
-                if (flag_get_c()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 2;
-                } else { // Taken
-                    t = 12;
-                    cpu_next.pc += 2 + (int8_t)mem_read(cpu.pc+1);
-                }
-                break;
-            case 0x31: // LD SP,n16
-                t = 12;
-                cpu_next.pc += 3;
-                cpu_next.sp = mem_read16(cpu.pc+1);
-                break;
-            case 0x32: // LD [HL-],A
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.a);
-                reg_hl_write(reg_hl_read() - 1);
-                break;
-            case 0x33: // INC SP
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.sp += 1;
-                break;
-            case 0x34: // INC [HL]
-                t = 12;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                result = n8 + 1;
-                mem_write_next(reg_hl_read(), result);
-                flag_set_z(result);
-                flag_set_n(0);
-                flag_set_h((n8 & 0x0F) == 0x0F);
-                break;
-            case 0x35: // DEC [HL]
-                t = 12;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                result = n8 - 1;
-                mem_write_next(reg_hl_read(), result);
-                flag_set_z(result);
-                flag_set_n(1);
-                flag_set_h((n8 & 0x0F) == 0x00);
-                break;
-            case 0x36: // LD [HL],n8
-                t = 12;
-                cpu_next.pc += 2;
-                mem_write_next(reg_hl_read(), mem_read(cpu.pc+1));
-                break;
-            case 0x37: // SCF
-                t = 4;
-                cpu_next.pc += 1;
-                flag_set_n(0);
-                flag_set_h(0);
-                flag_set_c(1);
-                break;
-            case 0x38: // JR C,e8
-                if (!flag_get_c()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 2;
-                } else { // Taken
-                    t = 12;
-                    cpu_next.pc += 2 + (int8_t)mem_read(cpu.pc+1);
-                }
-                break;
-            case 0x39: // ADD HL,SP
-                t = 8;
-                cpu_next.pc += 1;
-                result16 = reg_hl_read() + cpu.sp;
-                reg_hl_write(result16);
-                flag_set_n(0);
-                flag_set_h(((reg_hl_read() & 0x0FFF) + (cpu.sp & 0x0FFF)) > 0x0FFF);
-                flag_set_c(result16 < reg_hl_read());
-                break;
-            case 0x3A: // LD A,[HL-]
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.a = mem_read(reg_hl_read());
-                reg_hl_write(reg_hl_read()-1);
-                break;
-            case 0x3B: // DEC SP
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.sp -= 1;
-                break;
-            case 0x3C: // INC A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a += 1;
-                flag_set_z(cpu_next.a);
-                flag_set_n(0);
-                flag_set_h((cpu.a & 0x0F) == 0x0F);
-                break;
-            case 0x3D: // DEC A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a -= 1;
-                flag_set_z(cpu_next.a);
-                flag_set_n(1);
-                flag_set_h((cpu.a & 0x0F) == 0);
-                break;
-            case 0x3E: // LD A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                cpu_next.a = mem_read(cpu.pc+1);
-                break;
-            case 0x3F: // CCF
-                t = 4;
-                cpu_next.pc += 1;
-                flag_set_n(0);
-                flag_set_h(0);
-                flag_set_c(!flag_get_c());
-                break;
-            case 0x40: // LD B,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.b;
-                break;
-            case 0x41: // LD B,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.c;
-                break;
-            case 0x42: // LD B,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.d;
-                break;
-            case 0x43: // LD B,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.e;
-                break;
-            case 0x44: // LD B,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.h;
-                break;
-            case 0x45: // LD B,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.l;
-                break;
-            case 0x46: // LD B,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.b = mem_read(reg_hl_read());
-                break;
-            case 0x47: // LD B,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.b = cpu.a;
-                break;
-            case 0x48: // LD C,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.b;
-                break;
-            case 0x49: // LD C,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.c;
-                break;
-            case 0x4A: // LD C,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.d;
-                break;
-            case 0x4B: // LD C,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.e;
-                break;
-            case 0x4C: // LD C,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.h;
-                break;
-            case 0x4D: // LD C,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.l;
-                break;
-            case 0x4E: // LD C,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.c = mem_read(reg_hl_read());
-                break;
-            case 0x4F: // LD C,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.c = cpu.a;
-                break;
-            case 0x50: // LD D,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.b;
-                break;
-            case 0x51: // LD D,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.c;
-                break;
-            case 0x52: // LD D,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.d;
-                break;
-            case 0x53: // LD D,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.e;
-                break;
-            case 0x54: // LD D,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.h;
-                break;
-            case 0x55: // LD D,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.l;
-                break;
-            case 0x56: // LD D,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.d = mem_read(reg_hl_read());
-                break;
-            case 0x57: // LD D,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.d = cpu.a;
-                break;
-            case 0x58: // LD E,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.b;
-                break;
-            case 0x59: // LD E,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.c;
-                break;
-            case 0x5A: // LD E,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.d;
-                break;
-            case 0x5B: // LD E,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.e;
-                break;
-            case 0x5C: // LD E,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.h;
-                break;
-            case 0x5D: // LD E,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.l;
-                break;
-            case 0x5E: // LD E,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.e = mem_read(reg_hl_read());
-                break;
-            case 0x5F: // LD E,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.e = cpu.a;
-                break;
-            case 0x60: // LD H,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.b;
-                break;
-            case 0x61: // LD H,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.c;
-                break;
-            case 0x62: // LD H,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.d;
-                break;
-            case 0x63: // LD H,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.e;
-                break;
-            case 0x64: // LD H,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.h;
-                break;
-            case 0x65: // LD H,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.l;
-                break;
-            case 0x66: // LD H,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.h = mem_read(reg_hl_read());
-                break;
-            case 0x67: // LD H,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.h = cpu.a;
-                break;
-            case 0x68: // LD L,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.b;
-                break;
-            case 0x69: // LD L,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.c;
-                break;
-            case 0x6A: // LD L,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.d;
-                break;
-            case 0x6B: // LD L,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.e;
-                break;
-            case 0x6C: // LD L,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.h;
-                break;
-            case 0x6D: // LD L,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.l;
-                break;
-            case 0x6E: // LD L,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.l = mem_read(reg_hl_read());
-                break;
-            case 0x6F: // LD L,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.l = cpu.a;
-                break;
-            case 0x70: // LD [HL],B
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.b);
-                break;
-            case 0x71: // LD [HL],C
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.c);
-                break;
-            case 0x72: // LD [HL],D
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.d);
-                break;
-            case 0x73: // LD [HL],E
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.e);
-                break;
-            case 0x74: // LD [HL],H
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.h);
-                break;
-            case 0x75: // LD [HL],L
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.l);
-                break;
-            case 0x76: // HALT
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.halt = 1;
-                break;
-            case 0x77: // LD [HL],A
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(reg_hl_read(), cpu.a);
-                break;
-            case 0x78: // LD A,B
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.b;
-                break;
-            case 0x79: // LD A,C
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.c;
-                break;
-            case 0x7A: // LD A,D
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.d;
-                break;
-            case 0x7B: // LD A,E
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.e;
-                break;
-            case 0x7C: // LD A,H
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.h;
-                break;
-            case 0x7D: // LD A,L
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.l;
-                break;
-            case 0x7E: // LD A,[HL];
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.a = mem_read(reg_hl_read());
-                break;
-            case 0x7F: // LD A,A
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.a = cpu.a;
-                break;
-            case 0x80: // ADD A,B
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.b);
-                break;
-            case 0x81: // ADD A,C
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.c);
-                break;
-            case 0x82: // ADD A,D
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.d);
-                break;
-            case 0x83: // ADD A,E
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.e);
-                break;
-            case 0x84: // ADD A,H
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.h);
-                break;
-            case 0x85: // ADD A,L
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.l);
-                break;
-            case 0x86: // ADD A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                add_a(&n8);
-                break;
-            case 0x87: // ADD A,A
-                t = 4;
-                cpu_next.pc += 1;
-                add_a(&cpu.a);
-                break;
-            case 0x88: // ADC A,B
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.b);
-                break;
-            case 0x89: // ADC A,C
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.c);
-                break;
-            case 0x8A: // ADC A,D
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.d);
-                break;
-            case 0x8B: // ADC A,E
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.e);
-                break;
-            case 0x8C: // ADC A,H
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.h);
-                break;
-            case 0x8D: // ADC A,L
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.l);
-                break;
-            case 0x8E: // ADC A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                adc_a(&n8);
-                break;
-            case 0x8F: // ADC A,A
-                t = 4;
-                cpu_next.pc += 1;
-                adc_a(&cpu.a);
-                break;
-            case 0x90: // SUB A,B
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.b);
-                break;
-            case 0x91: // SUB A,C
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.c);
-                break;
-            case 0x92: // SUB A,D
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.d);
-                break;
-            case 0x93: // SUB A,E
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.e);
-                break;
-            case 0x94: // SUB A,H
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.h);
-                break;
-            case 0x95: // SUB A,L
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.l);
-                break;
-            case 0x96: // SUB A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                sub_a(&n8);
-                break;
-            case 0x97: // SUB A,A
-                t = 4;
-                cpu_next.pc += 1;
-                sub_a(&cpu.a);
-                break;
-            case 0x98: // SBC A,B
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.b);
-                break;
-            case 0x99: // SBC A,C
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.c);
-                break;
-            case 0x9A: // SBC A,D
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.d);
-                break;
-            case 0x9B: // SBC A,E
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.e);
-                break;
-            case 0x9C: // SBC A,H
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.h);
-                break;
-            case 0x9D: // SBC A,L
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.l);
-                break;
-            case 0x9E: // SBC A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                sbc_a(&n8);
-                break;
-            case 0x9F: // SBC A,A
-                t = 4;
-                cpu_next.pc += 1;
-                sbc_a(&cpu.a);
-                break;
-            case 0xA0: // AND A,B
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.b);
-                break;
-            case 0xA1: // AND A,C
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.c);
-                break;
-            case 0xA2: // AND A,D
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.d);
-                break;
-            case 0xA3: // AND A,E
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.e);
-                break;
-            case 0xA4: // AND A,H
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.h);
-                break;
-            case 0xA5: // AND A,L
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.l);
-                break;
-            case 0xA6: // AND A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                and_a(&n8);
-                break;
-            case 0xA7: // AND A,A
-                t = 4;
-                cpu_next.pc += 1;
-                and_a(&cpu.a);
-                break;
-            case 0xA8: // XOR A,B
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.b);
-                break;
-            case 0xA9: // XOR A,C
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.c);
-                break;
-            case 0xAA: // XOR A,D
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.d);
-                break;
-            case 0xAB: // XOR A,E
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.e);
-                break;
-            case 0xAC: // XOR A,H
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.h);
-                break;
-            case 0xAD: // XOR A,L
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.l);
-                break;
-            case 0xAE: // XOR A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                xor_a(&n8);
-                break;
-            case 0xAF: // XOR A,A
-                t = 4;
-                cpu_next.pc += 1;
-                xor_a(&cpu.a);
-                break;
-            case 0xB0: // OR A,B
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.b);
-                break;
-            case 0xB1: // OR A,C
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.c);
-                break;
-            case 0xB2: // OR A,D
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.d);
-                break;
-            case 0xB3: // OR A,E
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.e);
-                break;
-            case 0xB4: // OR A,H
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.h);
-                break;
-            case 0xB5: // OR A,L
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.l);
-                break;
-            case 0xB6: // OR A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                or_a(&n8);
-                break;
-            case 0xB7: // OR A,A
-                t = 4;
-                cpu_next.pc += 1;
-                or_a(&cpu.a);
-                break;
-            case 0xB8: // CP A,B
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.b);
-                break;
-            case 0xB9: // CP A,C
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.c);
-                break;
-            case 0xBA: // CP A,D
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.d);
-                break;
-            case 0xBB: // CP A,E
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.e);
-                break;
-            case 0xBC: // CP A,H
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.h);
-                break;
-            case 0xBD: // CP A,L
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.l);
-                break;
-            case 0xBE: // CP A,[HL]
-                t = 8;
-                cpu_next.pc += 1;
-                n8 = mem_read(reg_hl_read());
-                cp_a(&n8);
-                break;
-            case 0xBF: // CP A,A
-                t = 4;
-                cpu_next.pc += 1;
-                cp_a(&cpu.a);
-                break;
-            case 0xC0: // RET NZ
-                if (flag_get_z()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 1;
-                } else { // Taken
-                    t = 20;
-                    cpu_next.pc = mem_read16(cpu.sp);
-                    cpu_next.sp += 2;
-                }
-                break;
-            case 0xC1: // POP BC
-                t = 12;
-                cpu_next.pc += 1;
-                reg_bc_write(mem_read16(cpu.sp));
-                cpu_next.sp += 2;
-                break;
-            case 0xC2: // JP NZ,a16
-                if (flag_get_z()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 16;
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xC3: // JP a16
-                t = 16;
-                cpu_next.pc = mem_read16(cpu.pc+1);
-                break;
-            case 0xC4: // CALL NZ,a16
-                if (flag_get_z()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 24;
-                    cpu_next.sp -= 2;
-                    mem_write_next16(cpu_next.sp, cpu.pc+3);
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xC5: // PUSH BC
-                t = 16;
-                cpu_next.pc += 1;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, reg_bc_read());
-                break;
-            case 0xC6: // ADD A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                cpu_next.a += n8;
-                flag_set_z(cpu_next.a);
-                flag_set_n(0);
-                flag_set_h(((cpu.a & 0x0F) + (n8 & 0x0F)) > 0x0F);
-                flag_set_c(cpu_next.a < cpu.a);
-                break;
-            case 0xC7: // RST $00
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0000;
-                break;
-            case 0xC8: // RET Z
-                if (!flag_get_z()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 1;
-                } else { // Taken
-                    t = 20;
-                    cpu_next.pc = mem_read16(cpu.sp);
-                    cpu_next.sp += 2;
-                }
-                break;
-            case 0xC9: // RET
-                t = 16;
-                cpu_next.pc = mem_read16(cpu.sp);
-                cpu_next.sp += 2;
-                break;
-            case 0xCA: // JP Z,a16
-                if (!flag_get_z()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 16;
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xCB: // PREFIX
-                cpu_next.pc += 2;
-                t = execute_prefix(mem_read(cpu.pc+1));
-                break;
-            case 0xCC: // CALL Z,a16
-                if (!flag_get_z()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 24;
-                    cpu_next.sp -= 2;
-                    mem_write_next16(cpu_next.sp, cpu.pc+3);
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xCD: // CALL a16
-                t = 24;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+3);
-                cpu_next.pc = mem_read16(cpu.pc+1);
-                break;
-            case 0xCE: // ADC A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                adc_a(&n8);
-                break;
-            case 0xCF: // RST $08
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0008;
-                break;
-            case 0xD0: // RET NC
-                if (flag_get_c()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 1;
-                } else { // Taken
-                    t = 20;
-                    cpu_next.pc = mem_read16(cpu.sp);
-                    cpu_next.sp += 2;
-                }
-                break;
-            case 0xD1: // POP DE
-                t = 12;
-                cpu_next.pc += 1;
-                reg_de_write(mem_read16(cpu.sp));
-                cpu_next.sp += 2;
-                break;
-            case 0xD2: // JP NC,a16
-                if (flag_get_c()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 16;
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xD4: // CALL NC,a16
-                if (flag_get_c()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 24;
-                    cpu_next.sp -= 2;
-                    mem_write_next16(cpu_next.sp, cpu.pc+3);
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xD5: // PUSH DE
-                t = 16;
-                cpu_next.pc += 1;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, reg_de_read());
-                break;
-            case 0xD6: // SUB A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                sub_a(&n8);
-                break;
-            case 0xD7: // RST $10
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0010;
-                break;
-            case 0xD8: // RET C
-                if (!flag_get_c()) { // Not taken
-                    t = 8;
-                    cpu_next.pc += 1;
-                } else { // Taken
-                    t = 20;
-                    cpu_next.pc = mem_read16(cpu.sp);
-                    cpu_next.sp += 2;
-                }
-                break;
-            case 0xD9: // RETI
-                t = 16;
-                cpu_next.pc = mem_read16(cpu.sp);
-                cpu_next.sp += 2;
-                cpu_next.ime = 1;
-                break;
-            case 0xDA: // JP C,a16
-                if (!flag_get_c()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 16;
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xDC: // CALL C,a16
-                if (!flag_get_c()) { // Not taken
-                    t = 12;
-                    cpu_next.pc += 3;
-                } else {
-                    t = 24;
-                    cpu_next.sp -= 2;
-                    mem_write_next16(cpu_next.sp, cpu.pc+3);
-                    cpu_next.pc = mem_read16(cpu.pc+1);
-                }
-                break;
-            case 0xDE: // SBC A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                sbc_a(&n8);
-                break;
-            case 0xDF: // RST $18
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0018;
-                break;
-            case 0xE0: // LDH [a8],A
-                t = 12;
-                cpu_next.pc += 2;
-                mem_write_next(0xFF00+(uint16_t)mem_read(cpu.pc+1), cpu.a);
-                break;
-            case 0xE1: // POP HL
-                t = 12;
-                cpu_next.pc += 1;
-                reg_hl_write(mem_read16(cpu.sp));
-                cpu_next.sp += 2;
-                break;
-            case 0xE2: // LDH [C],A
-                t = 8;
-                cpu_next.pc += 1;
-                mem_write_next(0xFF00+(uint16_t)cpu.c, cpu.a);
-                break;
-            case 0xE5: // PUSH HL
-                t = 16;
-                cpu_next.pc += 1;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, reg_hl_read());
-                break;
-            case 0xE6: // AND A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc + 1);
-                and_a(&n8);
-                break;
-            case 0xE7: // RST $20
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0020;
-                break;
-            case 0xE8: // ADD SP,e8
-                t = 16;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                cpu_next.sp += (int8_t)n8;
-                flag_set_z(1);
-                flag_set_n(0);
-                flag_set_h(((cpu.sp & 0x0F) + (n8 & 0x0F)) > 0x0F);
-                flag_set_c(((cpu.sp & 0xFF) + n8) > 0xFF);
-                break;
-            case 0xE9: // JP HL
-                t = 4;
-                cpu_next.pc = reg_hl_read();
-                break;
-            case 0xEA: // LD [a16],A
-                t = 16;
-                cpu_next.pc += 3;
-                mem_write_next(mem_read16(cpu.pc+1), cpu.a);
-                break;
-            case 0xEE: // XOR A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                xor_a(&n8);
-                break;
-            case 0xEF: // RST $28
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0028;
-                break;
-            case 0xF0: // LDH A,[a8]
-                t = 12;
-                cpu_next.pc += 2;
-                cpu_next.a = mem_read(0xFF00+(uint16_t)mem_read(cpu.pc+1));
-                break;
-            case 0xF1: // POP AF
-                t = 12;
-                cpu_next.pc += 1;
-                reg_af_write(mem_read16(cpu.sp) & 0xFFF0);
-                cpu_next.sp += 2;
-                break;
-            case 0xF2: // LDH A,[C]
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.a = mem_read(0xFF00+(uint16_t)cpu.c);
-                break;
-            case 0xF3: // DI
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.ime = 0;
-                break;
-            case 0xF5: // PUSH AF
-                t = 16;
-                cpu_next.pc += 1;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, reg_af_read() & 0xFFF0);
-                break;
-            case 0xF6: // OR A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc + 1);
-                or_a(&n8);
-                break;
-            case 0xF7: // RST $30
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0030;
-                break;
-            case 0xF8: // LD HL,SP+e8
-                t = 12;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                reg_hl_write(cpu.sp + (int8_t)n8);
-                flag_set_z(1);
-                flag_set_n(0);
-                flag_set_h(((cpu.sp & 0x0F) + (n8 & 0x0F)) > 0x0F);
-                flag_set_c(((cpu.sp & 0xFF) + n8) > 0xFF);
-                break;
-            case 0xF9: // LD SP,HL
-                t = 8;
-                cpu_next.pc += 1;
-                cpu_next.sp = reg_hl_read();
-                break;
-            case 0xFA: // LD A,[a16]
-                t = 16;
-                cpu_next.pc += 3;
-                cpu_next.a = mem_read(mem_read16(cpu.pc+1));
-                break;
-            case 0xFB: // EI
-                t = 4;
-                cpu_next.pc += 1;
-                cpu_next.ime_pending = 1;
-                break;
-            case 0xFE: // CP A,n8
-                t = 8;
-                cpu_next.pc += 2;
-                n8 = mem_read(cpu.pc+1);
-                result = cpu.a - n8;
-                flag_set_z(result);
-                flag_set_n(1);
-                flag_set_h((n8 & 0x0F) > (cpu.a & 0x0F));
-                flag_set_c(n8 > cpu.a);
-                break;
-            case 0xFF: // RST $38
-                t = 16;
-                cpu_next.sp -= 2;
-                mem_write_next16(cpu_next.sp, cpu.pc+1);
-                cpu_next.pc = 0x0038;
-                break;
-            default:
-                printf("Unknown OP 0x%X\n", cpu.op);
-                exit(1);
+    if (!interrupt && !gb->cpu.halt && !gb->cpu.stop) { // No interrupt triggered
+        // Operands, read along with the opcode unless the instruction crosses into another page
+        uint16_t imm16;
+        if (page != NULL && (pc & 0xFF) < 0xFE) {
+            imm16 = page[(pc & 0xFF) + 1] | (page[(pc & 0xFF) + 2] << 8);
+        } else if (cpu_ops[gb->cpu.op].length == 3) {
+            imm16 = mem_read16(gb, pc+1);
+        } else if (cpu_ops[gb->cpu.op].length == 2) {
+            imm16 = mem_read(gb, pc+1);
+        } else {
+            imm16 = 0;
         }
+
+        return cpu_execute_op(gb, gb->cpu.op, imm16);
     } else if (interrupt) { // Interrupt triggered
-        DEBUG_PRINTF_CPU("INT 0b%08b ", mem.iflag);
+        DEBUG_PRINTF_CPU("INT 0b%08b ", gb->mem.iflag);
 
-        cpu_next.halt = 0;
-        cpu_next.ime = 0;
+        gb->CPU_NEXT.halt = 0;
+        gb->CPU_NEXT.ime = 0;
         t = 20;
 
         // Determine call address
         uint16_t iaddress;
-        if (mem.iflag & mem.ie & INT_VBLANK) {
+        if (gb->mem.iflag & gb->mem.ie & INT_VBLANK) {
             iaddress = 0x0040;
-            mem.iflag &= ~INT_VBLANK;
-        } else if (mem.iflag & mem.ie & INT_STAT) {
+            gb->mem.iflag &= ~INT_VBLANK;
+        } else if (gb->mem.iflag & gb->mem.ie & INT_STAT) {
             iaddress = 0x0048;
-            mem.iflag &= ~INT_STAT;
-        } else if (mem.iflag & mem.ie & INT_TIMER) {
+            gb->mem.iflag &= ~INT_STAT;
+        } else if (gb->mem.iflag & gb->mem.ie & INT_TIMER) {
             iaddress = 0x0050;
-            mem.iflag &= ~INT_TIMER;
-        } else if (mem.iflag & mem.ie & INT_SERIAL) {
+            gb->mem.iflag &= ~INT_TIMER;
+        } else if (gb->mem.iflag & gb->mem.ie & INT_SERIAL) {
             iaddress = 0x0058;
-            mem.iflag &= ~INT_SERIAL;
-        } else if (mem.iflag & mem.ie & INT_JOYPAD) {
+            gb->mem.iflag &= ~INT_SERIAL;
+        } else if (gb->mem.iflag & gb->mem.ie & INT_JOYPAD) {
             iaddress = 0x0060;
-            mem.iflag &= ~INT_JOYPAD;
+            gb->mem.iflag &= ~INT_JOYPAD;
         } else {
-            printf("Unknown INT 0x%X\n", mem.iflag);
+            printf("Unknown INT 0x%X\n", gb->mem.iflag);
             exit(1);
         }
 
-        cpu_next.sp -= 2;
-        mem_write_next16(cpu_next.sp, cpu.pc);
-        cpu_next.pc = iaddress;
-    } else if (cpu.halt) {
+        cpu_push(gb, pc);
+        gb->CPU_NEXT.pc = iaddress;
+    } else if (gb->cpu.halt) {
         DEBUG_PRINTF_CPU("HALTED ");
         t = 4;
-        cpu_next.halt = !(bool)(mem.iflag & mem.ie); // TODO emulate HALT bug
-    } else if (cpu.stop) {
+        gb->CPU_NEXT.halt = !(bool)(gb->mem.iflag & gb->mem.ie); // TODO emulate HALT bug
+    } else if (gb->cpu.stop) {
         DEBUG_PRINTF_CPU("STOPPED ");
         t = 0;
     }
 
-    DEBUG_PRINTF_CPU("AF:0x%02X%02X BC:0x%02X%02X ", cpu_next.a,cpu_next.f,cpu_next.b,cpu_next.c);
-    DEBUG_PRINTF_CPU("DE:0x%02X%02X HL:0x%02X%02X ",cpu_next.d,cpu_next.e,cpu_next.h,cpu_next.l);
-    DEBUG_PRINTF_CPU("SP:0x%04X\n",cpu_next.sp);
+    DEBUG_PRINTF_CPU("AF:0x%02X%02X BC:0x%02X%02X ", gb->CPU_NEXT.a,flags_pack(&gb->CPU_NEXT),gb->CPU_NEXT.b,gb->CPU_NEXT.c);
+    DEBUG_PRINTF_CPU("DE:0x%02X%02X HL:0x%02X%02X ",gb->CPU_NEXT.d,gb->CPU_NEXT.e,gb->CPU_NEXT.h,gb->CPU_NEXT.l);
+    DEBUG_PRINTF_CPU("SP:0x%04X\n",gb->CPU_NEXT.sp);
 
     return t;
 }
 
-void cpu_writeback() {
+#ifndef CPU_REFERENCE
+// Common instruction sequences, each run by one handler instead of a trip through the run loop
+// per instruction. Every instruction still adds its cycles before the next one starts, and a
+// sequence stops wherever the interpreter would have taken an interrupt or reached the deadline.
+typedef enum {
+    FUSED_NONE, // Not a fused sequence, nothing ran
+    FUSED_STOP, // Stopped, PC is left for the run loop
+    FUSED_MORE, // Ran to the end, another sequence may follow
+    FUSED_AGAIN, // A counter jumped back to itself and goes round again
+} fused_t;
+
+// Opcodes a fused sequence can start with
+const bool cpu_op_fuses[256] = {
+    [0x2A] = true, // LD A,[HL+] / LD [DE],A / INC DE
+    [0x05] = true, [0x0D] = true, [0x15] = true, [0x1D] = true, // DEC r / JR NZ,e8
+    [0x25] = true, [0x2D] = true, [0x3D] = true,
+    [0x0B] = true, [0x1B] = true, // DEC rr / LD A,r / OR r' / JR NZ,e8
+    [0xF0] = true, // LDH A,[a8] / AND A,n8 / JR cc,e8
+    [0xC1] = true, [0xD1] = true, [0xE1] = true, [0xF1] = true, // POP rr...
+    [0xC5] = true, [0xD5] = true, [0xE5] = true, [0xF5] = true, // PUSH rr...
+};
+
+// Add an instruction's cycles, true if the next one may start
+static bool fused_next(gb_t *gb, uint8_t t) {
+    gb->sched.cycles += t;
+    return gb->sched.cycles < gb->sched.next && !(gb->cpu.ime && (gb->mem.ie & gb->mem.iflag));
+}
+
+// Register in bits 3-5 of an opcode, NULL for [HL]
+static uint8_t *fused_reg(cpu_t *cpu, uint8_t op) {
+    switch ((op >> 3) & 7) {
+        case 0: return &cpu->b;
+        case 1: return &cpu->c;
+        case 2: return &cpu->d;
+        case 3: return &cpu->e;
+        case 4: return &cpu->h;
+        case 5: return &cpu->l;
+        case 7: return &cpu->a;
+        default: return NULL;
+    }
+}
+
+// JR NZ,e8 at pc closing a counter that started at start
+static fused_t fused_jr_nz(gb_t *gb, uint16_t start, uint16_t pc, int8_t e8) {
+    gb->cpu.pc = pc + 2;
+    if (flag_get_z(gb)) { // Falls through
+        return fused_next(gb, cpu_ops[0x20].cycles) ? FUSED_MORE : FUSED_STOP;
+    }
+
+    gb->cpu.pc += e8;
+    if (!fused_next(gb, cpu_ops[0x20].taken)) {
+        return FUSED_STOP;
+    }
+
+    return gb->cpu.pc == start ? FUSED_AGAIN : FUSED_MORE;
+}
+
+// LD A,[HL+] / LD [DE],A / INC DE
+// Only from ROM, where the write can not change the code
+static fused_t fused_copy(gb_t *gb, const uint8_t *code, uint16_t *pc) {
+    if (code[1] != 0x12 || code[2] != 0x13 || gb->cpu.pc >= 0x8000) {
+        return FUSED_NONE;
+    }
+
+    uint8_t *page = gb->mem.read_page[gb->cpu.pc >> 8];
+    uint16_t hl = reg_hl_read(gb);
+    *pc = gb->cpu.pc;
+    gb->cpu.a = mem_read(gb, hl);
+    reg_hl_write(gb, hl + 1);
+    gb->cpu.pc += 1;
+    if (!fused_next(gb, cpu_ops[0x2A].cycles)) {
+        return FUSED_STOP;
+    }
+
+    *pc = gb->cpu.pc;
+    cpu_write(gb, reg_de_read(gb), gb->cpu.a);
+    gb->cpu.pc += 1;
+    if (!fused_next(gb, cpu_ops[0x12].cycles) || gb->mem.read_page[gb->cpu.pc >> 8] != page) {
+        return FUSED_STOP;
+    }
+
+    *pc = gb->cpu.pc;
+    reg_de_write(gb, reg_de_read(gb) + 1);
+    gb->cpu.pc += 1;
+    return fused_next(gb, cpu_ops[0x13].cycles) ? FUSED_MORE : FUSED_STOP;
+}
+
+// DEC r / JR NZ,e8
+static fused_t fused_dec_jr(gb_t *gb, const uint8_t *code, uint16_t *pc) {
+    uint8_t *reg = fused_reg(&gb->cpu, code[0]);
+    if (reg == NULL || code[1] != 0x20) {
+        return FUSED_NONE;
+    }
+
+    uint16_t start = gb->cpu.pc;
+    fused_t result;
+    do {
+        *pc = start;
+        uint8_t value = *reg - 1;
+        flag_set_z(gb, value);
+        flag_set_n(gb, 1);
+        flag_set_h_add(gb, *reg, 1, value);
+        *reg = value;
+        gb->cpu.pc = start + 1;
+        if (!fused_next(gb, cpu_ops[code[0]].cycles)) {
+            return FUSED_STOP;
+        }
+
+        *pc = start + 1;
+        result = fused_jr_nz(gb, start, start + 1, code[2]);
+    } while (result == FUSED_AGAIN);
+
+    return result;
+}
+
+// DEC rr / LD A,r / OR r' / JR NZ,e8, with r and r' the two halves of BC or DE
+static fused_t fused_dec16_jr(gb_t *gb, const uint8_t *code, uint16_t *pc) {
+    uint8_t *high = fused_reg(&gb->cpu, code[0] - 0x0B);
+    uint8_t *low = fused_reg(&gb->cpu, code[0] - 0x03);
+    uint8_t hi = (code[0] >> 3) & 6; // B or D, as an index into an LD or ALU row
+    bool halves = (code[1] == (0x78 | hi) && code[2] == (0xB1 | hi)) ||
+                  (code[1] == (0x79 | hi) && code[2] == (0xB0 | hi));
+    if (!halves || code[3] != 0x20) {
+        return FUSED_NONE;
+    }
+
+    uint16_t start = gb->cpu.pc;
+    fused_t result;
+    do {
+        *pc = start;
+        uint16_t value = ((*high << 8) | *low) - 1;
+        *high = value >> 8;
+        *low = value & 0xFF;
+        gb->cpu.pc = start + 1;
+        if (!fused_next(gb, cpu_ops[code[0]].cycles)) {
+            return FUSED_STOP;
+        }
+
+        *pc = start + 1;
+        gb->cpu.a = (code[1] & 1) ? *low : *high;
+        gb->cpu.pc = start + 2;
+        if (!fused_next(gb, cpu_ops[code[1]].cycles)) {
+            return FUSED_STOP;
+        }
+
+        *pc = start + 2;
+        or_a(gb, (code[1] & 1) ? *high : *low);
+        gb->cpu.pc = start + 3;
+        if (!fused_next(gb, cpu_ops[code[2]].cycles)) {
+            return FUSED_STOP;
+        }
+
+        *pc = start + 3;
+        result = fused_jr_nz(gb, start, start + 3, code[4]);
+    } while (result == FUSED_AGAIN);
+
+    return result;
+}
+
+// LDH A,[a8] / AND A,n8 / JR Z,e8 or JR NZ,e8
+// Always stops after the jump, so the run loop can still skip a polling loop
+static fused_t fused_poll(gb_t *gb, const uint8_t *code, uint16_t *pc) {
+    if (code[2] != 0xE6 || (code[4] != 0x20 && code[4] != 0x28)) {
+        return FUSED_NONE;
+    }
+
+    *pc = gb->cpu.pc;
+    gb->cpu.a = mem_read(gb, 0xFF00 + code[1]);
+    gb->cpu.pc += 2;
+    if (!fused_next(gb, cpu_ops[0xF0].cycles)) {
+        return FUSED_STOP;
+    }
+
+    *pc = gb->cpu.pc;
+    and_a(gb, code[3]);
+    gb->cpu.pc += 2;
+    if (!fused_next(gb, cpu_ops[0xE6].cycles)) {
+        return FUSED_STOP;
+    }
+
+    *pc = gb->cpu.pc;
+    gb->cpu.pc += 2;
+    uint8_t t = cpu_ops[code[4]].cycles;
+    if (flag_get_z(gb) == (code[4] == 0x28)) { // Taken
+        t = cpu_ops[code[4]].taken;
+        gb->cpu.pc += (int8_t)code[5];
+    }
+    gb->sched.cycles += t;
+    return FUSED_STOP;
+}
+
+// Two or more PUSH rr, or two or more POP rr, in a row
+// Pushes only from ROM, where the writes can not change the code
+static fused_t fused_stack(gb_t *gb, const uint8_t *code, uint16_t *pc) {
+    bool push = (code[0] & 0x0F) == 0x05;
+    if ((code[1] & 0xCF) != (code[0] & 0xCF) || (push && gb->cpu.pc >= 0x8000)) {
+        return FUSED_NONE;
+    }
+
+    uint8_t *page = gb->mem.read_page[gb->cpu.pc >> 8];
+    for (int i = 0; i < 4 && (code[i] & 0xCF) == (code[0] & 0xCF); i++) {
+        *pc = gb->cpu.pc;
+        gb->cpu.pc += 1;
+        if (push) {
+            switch (code[i]) {
+                case 0xC5: cpu_push(gb, reg_bc_read(gb)); break;
+                case 0xD5: cpu_push(gb, reg_de_read(gb)); break;
+                case 0xE5: cpu_push(gb, reg_hl_read(gb)); break;
+                default: cpu_push(gb, reg_af_read(gb) & 0xFFF0); break;
+            }
+            if (!fused_next(gb, cpu_ops[code[i]].cycles) || gb->mem.read_page[gb->cpu.pc >> 8] != page) {
+                return FUSED_STOP;
+            }
+        } else {
+            uint16_t value = mem_read16(gb, gb->cpu.sp);
+            gb->cpu.sp += 2;
+            switch (code[i]) {
+                case 0xC1: reg_bc_write(gb, value); break;
+                case 0xD1: reg_de_write(gb, value); break;
+                case 0xE1: reg_hl_write(gb, value); break;
+                default: reg_af_write(gb, value & 0xFFF0); break;
+            }
+            if (!fused_next(gb, cpu_ops[code[i]].cycles)) {
+                return FUSED_STOP;
+            }
+        }
+    }
+
+    return FUSED_MORE;
+}
+
+// Run fused sequences from PC for as long as they follow one another, pc is set to the last
+// instruction run. False if PC does not start one, the interpreter then runs it.
+bool cpu_execute_fused(gb_t *gb, uint16_t *pc) {
+    cpu_t *cpu = &gb->cpu;
+
+    // Sequences only start where the interpreter would run a plain instruction
+    if (cpu->halt || cpu->stop || cpu->ime_pending || (cpu->ime && (gb->mem.ie & gb->mem.iflag))) {
+        return false;
+    }
+
+    bool ran = false;
+    for (;;) {
+        // Every sequence fits in 6 bytes, all on the current page
+        uint8_t *page = gb->mem.read_page[cpu->pc >> 8];
+        if (page == NULL || (cpu->pc & 0xFF) > 0xFA) {
+            return ran;
+        }
+
+        const uint8_t *code = &page[cpu->pc & 0xFF];
+        fused_t result;
+        switch (code[0]) {
+            case 0x2A:
+                result = fused_copy(gb, code, pc);
+                break;
+            case 0x05: case 0x0D: case 0x15: case 0x1D: case 0x25: case 0x2D: case 0x3D:
+                result = fused_dec_jr(gb, code, pc);
+                break;
+            case 0x0B: case 0x1B:
+                result = fused_dec16_jr(gb, code, pc);
+                break;
+            case 0xF0:
+                result = fused_poll(gb, code, pc);
+                break;
+            case 0xC1: case 0xD1: case 0xE1: case 0xF1:
+            case 0xC5: case 0xD5: case 0xE5: case 0xF5:
+                result = fused_stack(gb, code, pc);
+                break;
+            default:
+                result = FUSED_NONE;
+                break;
+        }
+
+        if (result != FUSED_MORE) {
+            return ran || result == FUSED_STOP;
+        }
+        ran = true;
+    }
+}
+#endif
+
+// Polling loops may only read registers that change when a unit is caught up at a deadline,
+// or memory only the CPU writes
+static bool poll_address(uint16_t addr) {
+    return addr == 0xFF0F || addr == 0xFF41 || addr == 0xFF44 // IF, STAT, LY
+        || (addr >= 0xC000 && addr < 0xE000) // WRAM
+        || (addr >= 0xFF80 && addr < 0xFFFF); // HRAM
+}
+
+// Cycles per iteration if start..end is a polling loop ending in a jump back from end, else 0
+// A polling loop reads a polled address into A, tests it, and changes nothing but A and F
+int cpu_poll_loop(gb_t *gb, uint16_t start, uint16_t end) {
+    int t = 0;
+    uint16_t pc = start;
+    while (pc < end) {
+        uint8_t op = mem_read(gb, pc);
+        switch (op) {
+            case 0xF0: // LDH A,[a8]
+                if (!poll_address(0xFF00 + mem_read(gb, pc+1))) {
+                    return 0;
+                }
+                break;
+            case 0xFA: // LD A,[a16]
+                if (!poll_address(mem_read16(gb, pc+1))) {
+                    return 0;
+                }
+                break;
+            case 0xA7: // AND A,A
+            case 0xB7: // OR A,A
+            case 0xE6: // AND A,n8
+            case 0xEE: // XOR A,n8
+            case 0xF6: // OR A,n8
+            case 0xFE: // CP A,n8
+                break;
+            case 0xCB: // BIT u3,A
+                if ((mem_read(gb, pc+1) & 0b11000111) != 0b01000111) {
+                    return 0;
+                }
+                break;
+            default:
+                return 0;
+        }
+
+        const cpu_op_t *info = cpu_op_decode(op, mem_read(gb, pc+1));
+        t += info->cycles;
+        pc += info->length;
+    }
+
+    // JR cc,e8 back to the start, taken
+    uint8_t op = mem_read(gb, end);
+    if (pc != end || (op & 0b11100111) != 0x20 || (uint16_t)(end + 2 + (int8_t)mem_read(gb, end+1)) != start) {
+        return 0;
+    }
+
+    return t + cpu_ops[op].taken;
+}
+
+#ifdef CPU_REFERENCE
+void cpu_writeback(gb_t *gb) {
     // Commit mutated state
-    cpu = cpu_next;
-    if (cpu.ime_pending) {
-        cpu_next.ime = 1;
-        cpu_next.ime_pending = 0;
+    gb->cpu = gb->cpu_next;
+    if (gb->cpu.ime_pending) {
+        gb->cpu_next.ime = 1;
+        gb->cpu_next.ime_pending = 0;
     }
-    mem_writeback();
+    mem_writeback(gb);
+}
+#endif
+
+void cpu_continue(gb_t *gb) {
+    gb->CPU_NEXT.stop = 0;
 }
 
-void cpu_continue() {
-    cpu_next.stop = 0;
+// Pack the flags into F for anything outside the CPU looking at the registers
+void cpu_snapshot(gb_t *gb) {
+    gb->cpu.f = flags_pack(&gb->cpu);
 }
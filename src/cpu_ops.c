@@ -0,0 +1,223 @@
+#include <stdint.h>
+
+#include "cpu.h"
+
+// Regular rows, the low 3 bits of the opcode pick B, C, D, E, H, L, [HL], A
+
+// LD r,r' into dst, [HL] is read
+#define LD_HALF(op, dst) \
+    [op + 0] = {"LD " dst ",B", 1, 4, 4, 0}, \
+    [op + 1] = {"LD " dst ",C", 1, 4, 4, 0}, \
+    [op + 2] = {"LD " dst ",D", 1, 4, 4, 0}, \
+    [op + 3] = {"LD " dst ",E", 1, 4, 4, 0}, \
+    [op + 4] = {"LD " dst ",H", 1, 4, 4, 0}, \
+    [op + 5] = {"LD " dst ",L", 1, 4, 4, 0}, \
+    [op + 6] = {"LD " dst ",[HL]", 1, 8, 8, CPU_OP_READ}, \
+    [op + 7] = {"LD " dst ",A", 1, 4, 4, 0}
+
+// An ALU operation on A, [HL] is read
+#define ALU_HALF(op, name) \
+    [op + 0] = {name " A,B", 1, 4, 4, 0}, \
+    [op + 1] = {name " A,C", 1, 4, 4, 0}, \
+    [op + 2] = {name " A,D", 1, 4, 4, 0}, \
+    [op + 3] = {name " A,E", 1, 4, 4, 0}, \
+    [op + 4] = {name " A,H", 1, 4, 4, 0}, \
+    [op + 5] = {name " A,L", 1, 4, 4, 0}, \
+    [op + 6] = {name " A,[HL]", 1, 8, 8, CPU_OP_READ}, \
+    [op + 7] = {name " A,A", 1, 4, 4, 0}
+
+// Rotates, shifts, RES and SET after a CB prefix, [HL] is read and written back
+#define CB_HALF(op, name) \
+    [0x100 + op + 0] = {name "B", 2, 8, 8, 0}, \
+    [0x100 + op + 1] = {name "C", 2, 8, 8, 0}, \
+    [0x100 + op + 2] = {name "D", 2, 8, 8, 0}, \
+    [0x100 + op + 3] = {name "E", 2, 8, 8, 0}, \
+    [0x100 + op + 4] = {name "H", 2, 8, 8, 0}, \
+    [0x100 + op + 5] = {name "L", 2, 8, 8, 0}, \
+    [0x100 + op + 6] = {name "[HL]", 2, 16, 16, CPU_OP_READ | CPU_OP_WRITE}, \
+    [0x100 + op + 7] = {name "A", 2, 8, 8, 0}
+
+// BIT after a CB prefix, [HL] is only read
+#define CB_BIT_HALF(op, bit) \
+    [0x100 + op + 0] = {"BIT " bit ",B", 2, 8, 8, 0}, \
+    [0x100 + op + 1] = {"BIT " bit ",C", 2, 8, 8, 0}, \
+    [0x100 + op + 2] = {"BIT " bit ",D", 2, 8, 8, 0}, \
+    [0x100 + op + 3] = {"BIT " bit ",E", 2, 8, 8, 0}, \
+    [0x100 + op + 4] = {"BIT " bit ",H", 2, 8, 8, 0}, \
+    [0x100 + op + 5] = {"BIT " bit ",L", 2, 8, 8, 0}, \
+    [0x100 + op + 6] = {"BIT " bit ",[HL]", 2, 12, 12, CPU_OP_READ}, \
+    [0x100 + op + 7] = {"BIT " bit ",A", 2, 8, 8, 0}
+
+// Length and cycles include the prefix for CB prefixed instructions
+// PC is moved past the instruction before its handler runs, jumps then overwrite it
+const cpu_op_t cpu_ops[512] = {
+    [0x00] = {"NOP", 1, 4, 4, 0},
+    [0x01] = {"LD BC,n16", 3, 12, 12, 0},
+    [0x02] = {"LD [BC],A", 1, 8, 8, CPU_OP_WRITE},
+    [0x03] = {"INC BC", 1, 8, 8, 0},
+    [0x04] = {"INC B", 1, 4, 4, 0},
+    [0x05] = {"DEC B", 1, 4, 4, 0},
+    [0x06] = {"LD B,n8", 2, 8, 8, 0},
+    [0x07] = {"RLCA", 1, 4, 4, 0},
+    [0x08] = {"LD [a16],SP", 3, 20, 20, CPU_OP_WRITE},
+    [0x09] = {"ADD HL,BC", 1, 8, 8, 0},
+    [0x0A] = {"LD A,[BC]", 1, 8, 8, CPU_OP_READ},
+    [0x0B] = {"DEC BC", 1, 8, 8, 0},
+    [0x0C] = {"INC C", 1, 4, 4, 0},
+    [0x0D] = {"DEC C", 1, 4, 4, 0},
+    [0x0E] = {"LD C,n8", 2, 8, 8, 0},
+    [0x0F] = {"RRCA", 1, 4, 4, 0},
+    [0x10] = {"STOP", 2, 4, 4, CPU_OP_INTERPRET},
+    [0x11] = {"LD DE,n16", 3, 12, 12, 0},
+    [0x12] = {"LD [DE],A", 1, 8, 8, CPU_OP_WRITE},
+    [0x13] = {"INC DE", 1, 8, 8, 0},
+    [0x14] = {"INC D", 1, 4, 4, 0},
+    [0x15] = {"DEC D", 1, 4, 4, 0},
+    [0x16] = {"LD D,n8", 2, 8, 8, 0},
+    [0x17] = {"RLA", 1, 4, 4, 0},
+    [0x18] = {"JR e8", 2, 12, 12, CPU_OP_END},
+    [0x19] = {"ADD HL,DE", 1, 8, 8, 0},
+    [0x1A] = {"LD A,[DE]", 1, 8, 8, CPU_OP_READ},
+    [0x1B] = {"DEC DE", 1, 8, 8, 0},
+    [0x1C] = {"INC E", 1, 4, 4, 0},
+    [0x1D] = {"DEC E", 1, 4, 4, 0},
+    [0x1E] = {"LD E,n8", 2, 8, 8, 0},
+    [0x1F] = {"RRA", 1, 4, 4, 0},
+    [0x20] = {"JR NZ,e8", 2, 8, 12, CPU_OP_END},
+    [0x21] = {"LD HL,n16", 3, 12, 12, 0},
+    [0x22] = {"LD [HL+],A", 1, 8, 8, CPU_OP_WRITE},
+    [0x23] = {"INC HL", 1, 8, 8, 0},
+    [0x24] = {"INC H", 1, 4, 4, 0},
+    [0x25] = {"DEC H", 1, 4, 4, 0},
+    [0x26] = {"LD H,n8", 2, 8, 8, 0},
+    [0x27] = {"DAA", 1, 4, 4, 0},
+    [0x28] = {"JR Z,e8", 2, 8, 12, CPU_OP_END},
+    [0x29] = {"ADD HL,HL", 1, 8, 8, 0},
+    [0x2A] = {"LD A,[HL+]", 1, 8, 8, CPU_OP_READ},
+    [0x2B] = {"DEC HL", 1, 8, 8, 0},
+    [0x2C] = {"INC L", 1, 4, 4, 0},
+    [0x2D] = {"DEC L", 1, 4, 4, 0},
+    [0x2E] = {"LD L,n8", 2, 8, 8, 0},
+    [0x2F] = {"CPL", 1, 4, 4, 0},
+    [0x30] = {"JR NC,e8", 2, 8, 12, CPU_OP_END},
+    [0x31] = {"LD SP,n16", 3, 12, 12, 0},
+    [0x32] = {"LD [HL-],A", 1, 8, 8, CPU_OP_WRITE},
+    [0x33] = {"INC SP", 1, 8, 8, 0},
+    [0x34] = {"INC [HL]", 1, 12, 12, CPU_OP_READ | CPU_OP_WRITE},
+    [0x35] = {"DEC [HL]", 1, 12, 12, CPU_OP_READ | CPU_OP_WRITE},
+    [0x36] = {"LD [HL],n8", 2, 12, 12, CPU_OP_WRITE},
+    [0x37] = {"SCF", 1, 4, 4, 0},
+    [0x38] = {"JR C,e8", 2, 8, 12, CPU_OP_END},
+    [0x39] = {"ADD HL,SP", 1, 8, 8, 0},
+    [0x3A] = {"LD A,[HL-]", 1, 8, 8, CPU_OP_READ},
+    [0x3B] = {"DEC SP", 1, 8, 8, 0},
+    [0x3C] = {"INC A", 1, 4, 4, 0},
+    [0x3D] = {"DEC A", 1, 4, 4, 0},
+    [0x3E] = {"LD A,n8", 2, 8, 8, 0},
+    [0x3F] = {"CCF", 1, 4, 4, 0},
+
+    LD_HALF(0x40, "B"), LD_HALF(0x48, "C"),
+    LD_HALF(0x50, "D"), LD_HALF(0x58, "E"),
+    LD_HALF(0x60, "H"), LD_HALF(0x68, "L"),
+    [0x70] = {"LD [HL],B", 1, 8, 8, CPU_OP_WRITE},
+    [0x71] = {"LD [HL],C", 1, 8, 8, CPU_OP_WRITE},
+    [0x72] = {"LD [HL],D", 1, 8, 8, CPU_OP_WRITE},
+    [0x73] = {"LD [HL],E", 1, 8, 8, CPU_OP_WRITE},
+    [0x74] = {"LD [HL],H", 1, 8, 8, CPU_OP_WRITE},
+    [0x75] = {"LD [HL],L", 1, 8, 8, CPU_OP_WRITE},
+    [0x76] = {"HALT", 1, 4, 4, CPU_OP_INTERPRET},
+    [0x77] = {"LD [HL],A", 1, 8, 8, CPU_OP_WRITE},
+    LD_HALF(0x78, "A"),
+
+    ALU_HALF(0x80, "ADD"), ALU_HALF(0x88, "ADC"),
+    ALU_HALF(0x90, "SUB"), ALU_HALF(0x98, "SBC"),
+    ALU_HALF(0xA0, "AND"), ALU_HALF(0xA8, "XOR"),
+    ALU_HALF(0xB0, "OR"), ALU_HALF(0xB8, "CP"),
+
+    [0xC0] = {"RET NZ", 1, 8, 20, CPU_OP_READ | CPU_OP_END},
+    [0xC1] = {"POP BC", 1, 12, 12, CPU_OP_READ},
+    [0xC2] = {"JP NZ,a16", 3, 12, 16, CPU_OP_END},
+    [0xC3] = {"JP a16", 3, 16, 16, CPU_OP_END},
+    [0xC4] = {"CALL NZ,a16", 3, 12, 24, CPU_OP_WRITE | CPU_OP_END},
+    [0xC5] = {"PUSH BC", 1, 16, 16, CPU_OP_WRITE},
+    [0xC6] = {"ADD A,n8", 2, 8, 8, 0},
+    [0xC7] = {"RST $00", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xC8] = {"RET Z", 1, 8, 20, CPU_OP_READ | CPU_OP_END},
+    [0xC9] = {"RET", 1, 16, 16, CPU_OP_READ | CPU_OP_END},
+    [0xCA] = {"JP Z,a16", 3, 12, 16, CPU_OP_END},
+    [0xCB] = {"PREFIX", 2, 8, 8, 0},
+    [0xCC] = {"CALL Z,a16", 3, 12, 24, CPU_OP_WRITE | CPU_OP_END},
+    [0xCD] = {"CALL a16", 3, 24, 24, CPU_OP_WRITE | CPU_OP_END},
+    [0xCE] = {"ADC A,n8", 2, 8, 8, 0},
+    [0xCF] = {"RST $08", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xD0] = {"RET NC", 1, 8, 20, CPU_OP_READ | CPU_OP_END},
+    [0xD1] = {"POP DE", 1, 12, 12, CPU_OP_READ},
+    [0xD2] = {"JP NC,a16", 3, 12, 16, CPU_OP_END},
+    [0xD3] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xD4] = {"CALL NC,a16", 3, 12, 24, CPU_OP_WRITE | CPU_OP_END},
+    [0xD5] = {"PUSH DE", 1, 16, 16, CPU_OP_WRITE},
+    [0xD6] = {"SUB A,n8", 2, 8, 8, 0},
+    [0xD7] = {"RST $10", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xD8] = {"RET C", 1, 8, 20, CPU_OP_READ | CPU_OP_END},
+    [0xD9] = {"RETI", 1, 16, 16, CPU_OP_READ | CPU_OP_END},
+    [0xDA] = {"JP C,a16", 3, 12, 16, CPU_OP_END},
+    [0xDB] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xDC] = {"CALL C,a16", 3, 12, 24, CPU_OP_WRITE | CPU_OP_END},
+    [0xDD] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xDE] = {"SBC A,n8", 2, 8, 8, 0},
+    [0xDF] = {"RST $18", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xE0] = {"LDH [a8],A", 2, 12, 12, CPU_OP_WRITE},
+    [0xE1] = {"POP HL", 1, 12, 12, CPU_OP_READ},
+    [0xE2] = {"LDH [C],A", 1, 8, 8, CPU_OP_WRITE},
+    [0xE3] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xE4] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xE5] = {"PUSH HL", 1, 16, 16, CPU_OP_WRITE},
+    [0xE6] = {"AND A,n8", 2, 8, 8, 0},
+    [0xE7] = {"RST $20", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xE8] = {"ADD SP,e8", 2, 16, 16, 0},
+    [0xE9] = {"JP HL", 1, 4, 4, CPU_OP_END},
+    [0xEA] = {"LD [a16],A", 3, 16, 16, CPU_OP_WRITE},
+    [0xEB] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xEC] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xED] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xEE] = {"XOR A,n8", 2, 8, 8, 0},
+    [0xEF] = {"RST $28", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xF0] = {"LDH A,[a8]", 2, 12, 12, CPU_OP_READ},
+    [0xF1] = {"POP AF", 1, 12, 12, CPU_OP_READ},
+    [0xF2] = {"LDH A,[C]", 1, 8, 8, CPU_OP_READ},
+    [0xF3] = {"DI", 1, 4, 4, 0},
+    [0xF4] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xF5] = {"PUSH AF", 1, 16, 16, CPU_OP_WRITE},
+    [0xF6] = {"OR A,n8", 2, 8, 8, 0},
+    [0xF7] = {"RST $30", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+    [0xF8] = {"LD HL,SP+e8", 2, 12, 12, 0},
+    [0xF9] = {"LD SP,HL", 1, 8, 8, 0},
+    [0xFA] = {"LD A,[a16]", 3, 16, 16, CPU_OP_READ},
+    [0xFB] = {"EI", 1, 4, 4, CPU_OP_END},
+    [0xFC] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xFD] = {"-", 0, 0, 0, CPU_OP_INTERPRET},
+    [0xFE] = {"CP A,n8", 2, 8, 8, 0},
+    [0xFF] = {"RST $38", 1, 16, 16, CPU_OP_WRITE | CPU_OP_END},
+
+    CB_HALF(0x00, "RLC "), CB_HALF(0x08, "RRC "),
+    CB_HALF(0x10, "RL "), CB_HALF(0x18, "RR "),
+    CB_HALF(0x20, "SLA "), CB_HALF(0x28, "SRA "),
+    CB_HALF(0x30, "SWAP "), CB_HALF(0x38, "SRL "),
+    CB_BIT_HALF(0x40, "0"), CB_BIT_HALF(0x48, "1"),
+    CB_BIT_HALF(0x50, "2"), CB_BIT_HALF(0x58, "3"),
+    CB_BIT_HALF(0x60, "4"), CB_BIT_HALF(0x68, "5"),
+    CB_BIT_HALF(0x70, "6"), CB_BIT_HALF(0x78, "7"),
+    CB_HALF(0x80, "RES 0,"), CB_HALF(0x88, "RES 1,"),
+    CB_HALF(0x90, "RES 2,"), CB_HALF(0x98, "RES 3,"),
+    CB_HALF(0xA0, "RES 4,"), CB_HALF(0xA8, "RES 5,"),
+    CB_HALF(0xB0, "RES 6,"), CB_HALF(0xB8, "RES 7,"),
+    CB_HALF(0xC0, "SET 0,"), CB_HALF(0xC8, "SET 1,"),
+    CB_HALF(0xD0, "SET 2,"), CB_HALF(0xD8, "SET 3,"),
+    CB_HALF(0xE0, "SET 4,"), CB_HALF(0xE8, "SET 5,"),
+    CB_HALF(0xF0, "SET 6,"), CB_HALF(0xF8, "SET 7,"),
+};
+
+// The entry for an instruction from its first two bytes, next is only used after a CB prefix
+const cpu_op_t *cpu_op_decode(uint8_t op, uint8_t next) {
+    return op == 0xCB ? &cpu_ops[0x100 | next] : &cpu_ops[op];
+}
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "emu.h"
 #include "mem.h"
@@ -10,87 +11,274 @@
 #include "cartridge.h"
 #include "apu.h"
 #include "log.h"
+#include "sched.h"
+#include "gb.h"
 
 #ifdef CGB
 #include "cgb.h"
 #include "vdma.h"
 #endif
 
-gb_emu_t emu = {};
+#ifdef JIT
+#include "jit.h"
+#endif
+
+#ifdef AOT
+#include "aot.h"
+#endif
+
+gb_t *emu_create() {
+    gb_t *gb = calloc(1, sizeof(gb_t));
+    if (gb == NULL) {
+        return NULL;
+    }
+
+    sched_init(gb);
+    cpu_reset(gb);
+    mem_init(gb);
+    joypad_init(gb);
+    serial_init(gb);
+#ifdef JIT
+    jit_init(gb);
+#endif
 
-int emu_execute() {
-    uint8_t t = cpu_execute();
+    return gb;
+}
 
-    // CPU writeback SHOULD be done on the last T cycle, but that breaks a lot of timings.
-    // In the mean time, we do it immediately after CPU fetch/execute
-    // TODO Figure out why this is
-    cpu_writeback();
+void emu_destroy(gb_t *gb) {
+#ifdef JIT
+    jit_destroy(gb);
+#endif
+    free(gb);
+}
 
-    bool new_frame = ppu_execute(t);
-    bool new_audio = apu_execute(t);
-    timer_execute(t);
-    serial_execute(t);
+gb_emu_t *emu_get(gb_t *gb) {
+    return &gb->emu;
+}
 
+// Catch up every unit whose deadline has passed and let it pick the next one
+static int emu_dispatch(gb_t *gb) {
+    uint64_t now = gb->sched.cycles;
+
+    if (gb->sched.deadline[SCHED_PPU] <= now) {
+        ppu_sync(gb);
+        ppu_schedule(gb);
+    }
+    if (gb->sched.deadline[SCHED_APU] <= now) {
+        apu_sync(gb);
+        apu_schedule(gb);
+    }
+    if (gb->sched.deadline[SCHED_TIMER] <= now) {
+        timer_sync(gb);
+        timer_schedule(gb);
+    }
+    if (gb->sched.deadline[SCHED_SERIAL] <= now) {
+        serial_sync(gb);
+        serial_schedule(gb);
+    }
 #ifdef CGB
-    cgb_execute(t);
-    vdma_execute(t);
+    if (gb->sched.deadline[SCHED_VDMA] <= now) {
+        vdma_execute(gb);
+    }
 #endif
 
     int result = EMU_EVENT_NONE;
 
-    if (new_frame) {
-        if (emu.frame_callback != 0) { emu.frame_callback(ppu.fb); }
-        result |= EMU_EVENT_FRAME;
+    if (gb->sched.deadline[SCHED_EMU] <= now) {
+        result = gb->sched.events;
+        gb->sched.events = EMU_EVENT_NONE;
+        sched_set(gb, SCHED_EMU, SCHED_NEVER);
     }
 
-    if (new_audio) {
-        if (emu.audio_callback != 0) { emu.audio_callback(apu.buffer, EMU_AUDIO_BUFFER_SIZE*2); }
-        result |= EMU_EVENT_AUDIO;
+    if (result & EMU_EVENT_FRAME) {
+        if (gb->emu.frame_callback != 0) { gb->emu.frame_callback(gb, gb->ppu.fb); }
     }
 
-    emu.ppu_enabled = ppu_enabled();
-    emu.apu_enabled = apu_enabled();
+    if (result & EMU_EVENT_AUDIO) {
+        if (gb->emu.audio_callback != 0) { gb->emu.audio_callback(gb, gb->apu.buffer, EMU_AUDIO_BUFFER_SIZE*2); }
+        if (gb->emu.audio_float_callback != 0) { gb->emu.audio_float_callback(gb, gb->apu.buffer_float, EMU_AUDIO_BUFFER_SIZE*2); }
+    }
 
     return result;
 }
 
+// The CPU is stopped (t = 0), bring every unit up to date and let it react
+static void emu_stop(gb_t *gb) {
+    ppu_sync(gb);
+    apu_sync(gb);
+    timer_sync(gb);
+    serial_sync(gb);
+
+    ppu_execute(gb, 0);
+    timer_execute(gb, 0);
+#ifdef CGB
+    cgb_execute(gb, 0);
+#endif
+
+    // The speed may have changed, which moves every deadline
+    ppu_schedule(gb);
+    apu_schedule(gb);
+    timer_schedule(gb);
+    serial_schedule(gb);
+}
+
+// Polling loop seen since the last deadline
+typedef struct {
+    uint16_t pc; // Loop start
+    uint16_t branch; // Jump back to the start
+    int length; // Cycles per iteration, 0 if not a polling loop
+    uint64_t cycles; // When the start was last reached
+    uint8_t a;
+    uint8_t f;
+    bool ime;
+} emu_poll_t;
+
+// The CPU just jumped back from branch, skip whole iterations of a polling loop
+// Nothing a polling loop reads changes before the next deadline, so once an iteration leaves
+// the CPU as it found it every iteration until then would too
+static void emu_poll(gb_t *gb, emu_poll_t *poll, uint64_t window, uint16_t branch) {
+    cpu_snapshot(gb);
+
+    bool repeat = false;
+    if (gb->cpu.pc != poll->pc || branch != poll->branch) {
+        poll->pc = gb->cpu.pc;
+        poll->branch = branch;
+        poll->length = cpu_poll_loop(gb, gb->cpu.pc, branch);
+    } else {
+        // The last iteration ran alone and saw settled registers, STAT lags a dot behind a deadline
+        repeat = gb->sched.cycles - poll->cycles == (uint64_t)poll->length && poll->cycles >= window + 4 &&
+                 gb->cpu.a == poll->a && gb->cpu.f == poll->f && gb->cpu.ime == poll->ime;
+    }
+
+    if (poll->length == 0) {
+        return;
+    }
+
+    poll->cycles = gb->sched.cycles;
+    poll->a = gb->cpu.a;
+    poll->f = gb->cpu.f;
+    poll->ime = gb->cpu.ime;
+
+    // A pending interrupt would be taken on the next instruction instead
+    if (!repeat || (gb->cpu.ime && (gb->mem.ie & gb->mem.iflag))) {
+        return;
+    }
+
+    // Every skipped instruction must still start before the deadline
+    uint64_t count = (gb->sched.next - gb->sched.cycles) / poll->length;
+    gb->sched.cycles += count * poll->length;
+    poll->cycles = gb->sched.cycles;
+}
+
 // Run until an event is triggered
 // Any event will cause execution to stop
 // The event bits flipped during execution are returned
-int emu_run_to(int mask) {
+int emu_run_to(gb_t *gb, int mask) {
     int result = EMU_EVENT_NONE;
 
-    while (!(result & mask) && emu.running) {
-        result |= emu_execute();
+#ifdef JIT
+    jit_claim(gb);
+#endif
+
+    while (!(result & mask) && gb->emu.running) {
+        // Run the CPU straight up to the earliest deadline
+        // Units are only caught up there, or when the CPU touches them
+        emu_poll_t poll = {0};
+        uint64_t window = gb->sched.cycles;
+
+        while (gb->sched.cycles < gb->sched.next) {
+            uint16_t pc = gb->cpu.pc;
+
+#ifndef CPU_REFERENCE
+            // A compiled block or a fused sequence runs up to a jump or the deadline, pc is its last instruction
+            bool compiled = false;
+#ifdef AOT
+            compiled = aot_run(gb, &pc);
+#endif
+#ifdef JIT
+            compiled = compiled || jit_run(gb, &pc);
+#endif
+            uint8_t *page = gb->mem.read_page[pc >> 8];
+            if (compiled || (page != NULL && cpu_op_fuses[page[pc & 0xFF]] && cpu_execute_fused(gb, &pc))) {
+                if (gb->cpu.pc < pc && gb->sched.cycles < gb->sched.next) {
+                    emu_poll(gb, &poll, window, pc);
+                }
+                continue;
+            }
+#endif
+
+            uint8_t t = cpu_execute(gb);
+
+#ifdef CPU_REFERENCE
+            // CPU writeback SHOULD be done on the last T cycle, but that breaks a lot of timings.
+            // In the mean time, we do it immediately after CPU fetch/execute
+            // TODO Figure out why this is
+            cpu_writeback(gb);
+#endif
+
+            if (t == 0) {
+                emu_stop(gb);
+                break;
+            }
+
+            gb->sched.cycles += t;
+
+            // Only a unit caught up at a deadline can raise an interrupt, so a halted CPU
+            // would just step 4 cycles at a time until then. Skip those steps.
+            if (gb->cpu.halt && !(gb->mem.iflag & gb->mem.ie) && gb->sched.cycles < gb->sched.next) {
+                gb->sched.cycles += (gb->sched.next - gb->sched.cycles + 3) & ~(uint64_t)3;
+            }
+
+            // A jump back may close a polling loop
+            if (gb->cpu.pc < pc && gb->sched.cycles < gb->sched.next) {
+                emu_poll(gb, &poll, window, pc);
+            }
+        }
+
+        result |= emu_dispatch(gb);
     }
 
+#ifdef JIT
+    jit_release(gb);
+#endif
+
+    gb->emu.ppu_enabled = ppu_enabled(gb);
+    gb->emu.apu_enabled = apu_enabled(gb);
+    cpu_snapshot(gb);
+
     return result;
 }
 
-void emu_load_bootrom(uint8_t *data, size_t size) {
-    mem_load_bootrom(data, size);
+void emu_load_bootrom(gb_t *gb, uint8_t *data, size_t size) {
+    mem_load_bootrom(gb, data, size);
+}
+
+void emu_load_rom(gb_t *gb, uint8_t *data, size_t size) {
+    cartridge_load_rom(gb, data, size);
 }
 
-void emu_load_rom(uint8_t *data, size_t size) {
-    cartridge_load_rom(data, size);
+void emu_load_sav(gb_t *gb, uint8_t *data, size_t size) {
+    cartridge_load_ram(gb, data, size);
 }
 
-void emu_load_sav(uint8_t *data, size_t size) {
-    cartridge_load_ram(data, size);
+size_t emu_get_sav_size(gb_t *gb) {
+    return cartridge_get_ram_size(gb);
 }
 
-size_t emu_get_sav_size() {
-    return cartridge_get_ram_size();
+size_t emu_get_title(gb_t *gb, char *title) {
+    return cartridge_get_title(gb, title);
 }
 
-size_t emu_get_title(char *title) {
-    return cartridge_get_title(title);
+// Headless frontends can turn audio off, the APU then only keeps what the game can read
+void emu_set_audio(gb_t *gb, bool enabled) {
+    apu_set_audio(gb, enabled);
+    gb->emu.apu_enabled = apu_enabled(gb);
 }
 
-void emu_joypad_down(uint8_t mask) {
-    joypad_down(mask);
+void emu_joypad_down(gb_t *gb, uint8_t mask) {
+    joypad_down(gb, mask);
 }
 
-void emu_joypad_up(uint8_t mask) {
-    joypad_up(mask);
+void emu_joypad_up(gb_t *gb, uint8_t mask) {
+    joypad_up(gb, mask);
 }
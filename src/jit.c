@@ -0,0 +1,400 @@
+#ifdef JIT
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "JIT=1 needs an x86-64 Linux host"
+#endif
+
+#ifdef CPU_REFERENCE
+#error "JIT=1 updates the CPU in place and can not be combined with CPU_REFERENCE=1"
+#endif
+
+// mmap flags and getpid are not part of C2x
+#define _DEFAULT_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "jit.h"
+#include "cpu.h"
+#include "mem.h"
+#include "gb.h"
+
+// Hot blocks of cartridge ROM are translated to x86-64 and run in place of the interpreter.
+// ROM is never written, so a block only goes stale when its bank is switched out. Blocks are
+// keyed by the host address of their code, and every instruction that writes memory is followed
+// by a check that the page is still mapped. Code in RAM is always interpreted.
+//
+// Simple register instructions and LDH/LD A,[n16] are translated directly, memory accesses call
+// mem_read and mem_write. Everything else calls cpu_execute_op with the operands already decoded.
+// Like the interpreter loop, a block stops as soon as it reaches a deadline or an interrupt is
+// due, and it ends with the first jump, call or return.
+
+#define JIT_BUFFER_SIZE 0x400000
+#define JIT_BLOCK_LENGTH 64 // Instructions
+#define JIT_INSTRUCTION_SIZE_MAX 160 // Bytes of native code
+#define JIT_BLOCK_SIZE_MAX ((JIT_BLOCK_LENGTH * JIT_INSTRUCTION_SIZE_MAX) + 32)
+
+// Field of gb, which native code keeps in r12
+#define GB(field) ((int32_t)offsetof(gb_t, field))
+
+// Registers by the low 3 bits of an opcode, 6 is [HL]
+static const int32_t reg_offset[8] = {
+    GB(cpu.b), GB(cpu.c), GB(cpu.d), GB(cpu.e), GB(cpu.h), GB(cpu.l), -1, GB(cpu.a),
+};
+
+#define REX_W 0x08
+#define RAX 0
+#define RCX 1
+#define RDX 2
+
+typedef struct {
+    uint8_t *start;
+    uint8_t *p;
+    uint8_t *exit; // Epilogue, returns the address of the last instruction run
+} jit_emit_t;
+
+// Shared by every instance in the process, only written when BOYO_PERF_MAP is set
+static FILE *perf_map;
+static pthread_once_t perf_map_once = PTHREAD_ONCE_INIT;
+
+static void put8(jit_emit_t *e, uint8_t value) {
+    *e->p++ = value;
+}
+
+static void put16(jit_emit_t *e, uint16_t value) {
+    memcpy(e->p, &value, 2);
+    e->p += 2;
+}
+
+static void put32(jit_emit_t *e, uint32_t value) {
+    memcpy(e->p, &value, 4);
+    e->p += 4;
+}
+
+static void put64(jit_emit_t *e, uint64_t value) {
+    memcpy(e->p, &value, 8);
+    e->p += 8;
+}
+
+// Instruction with an [r12 + disp32] operand, two byte opcodes are given as 0x0FXX
+static void emit_gb(jit_emit_t *e, uint8_t rex, uint16_t opcode, int reg, int32_t disp) {
+    put8(e, 0x41 | rex); // REX.B selects r12
+    if (opcode > 0xFF) {
+        put8(e, opcode >> 8);
+    }
+    put8(e, opcode & 0xFF);
+    put8(e, 0x84 | (reg << 3)); // disp32 with a SIB byte
+    put8(e, 0x24); // r12, no index
+    put32(e, disp);
+}
+
+static void emit_store8(jit_emit_t *e, int32_t disp, uint8_t value) {
+    emit_gb(e, 0, 0xC6, 0, disp); // mov byte [gb+disp], imm8
+    put8(e, value);
+}
+
+// Leave the block when the last test set the condition code
+static void emit_exit_if(jit_emit_t *e, uint8_t cc) {
+    put8(e, 0x0F);
+    put8(e, 0x80 | cc);
+    put32(e, (uint32_t)(e->exit - (e->p + 4)));
+}
+
+static void emit_call(jit_emit_t *e, void *fn) {
+    put8(e, 0x48); put8(e, 0xB8); put64(e, (uintptr_t)fn); // mov rax, fn
+    put8(e, 0xFF); put8(e, 0xD0); // call rax
+}
+
+// Flags of AND, XOR and OR, the result is in al
+static void emit_logic_flags(jit_emit_t *e, uint8_t h) {
+    emit_gb(e, 0, 0x88, RAX, GB(cpu.a));
+    emit_gb(e, 0, 0x88, RAX, GB(cpu.flag_z));
+    emit_store8(e, GB(cpu.flag_n), 0);
+    emit_store8(e, GB(cpu.flag_h), h);
+    emit_store8(e, GB(cpu.flag_c), 0);
+}
+
+// Translate an instruction that needs no interpreter, false if there is no translation
+static bool emit_native(jit_emit_t *e, uint8_t op, uint16_t imm16) {
+    int src = op & 0b111;
+    int dst = (op >> 3) & 0b111;
+
+    if (op == 0x00) { // NOP
+        return true;
+    }
+
+    if (op >= 0x40 && op < 0x80 && op != 0x76 && src != 6 && dst != 6) { // LD r,r'
+        if (src != dst) {
+            emit_gb(e, 0, 0x0FB6, RAX, reg_offset[src]); // movzx eax, byte [src]
+            emit_gb(e, 0, 0x88, RAX, reg_offset[dst]);
+        }
+        return true;
+    }
+
+    if (op < 0x40 && dst != 6 && src >= 4 && src <= 6) {
+        if (src == 6) { // LD r,n8
+            emit_store8(e, reg_offset[dst], imm16 & 0xFF);
+            return true;
+        }
+
+        // INC r and DEC r, H is the carry into bit 4 of r ^ 1 ^ result
+        emit_gb(e, 0, 0x0FB6, RAX, reg_offset[dst]);
+        put8(e, 0x8D); put8(e, 0x48); put8(e, src == 4 ? 0x01 : 0xFF); // lea ecx, [rax +/- 1]
+        emit_gb(e, 0, 0x88, RCX, reg_offset[dst]);
+        emit_gb(e, 0, 0x88, RCX, GB(cpu.flag_z));
+        emit_store8(e, GB(cpu.flag_n), src == 5);
+        put8(e, 0x31); put8(e, 0xC8); // xor eax, ecx
+        put8(e, 0x34); put8(e, 0x01); // xor al, 1
+        emit_gb(e, 0, 0x88, RAX, GB(cpu.flag_h));
+        return true;
+    }
+
+    // AND, XOR and OR with a register or n8
+    static const uint8_t logic_reg[3] = {0x22, 0x32, 0x0A};
+    static const uint8_t logic_imm[3] = {0x24, 0x34, 0x0C};
+    if ((op >= 0xA0 && op < 0xB8 && src != 6) || op == 0xE6 || op == 0xEE || op == 0xF6) {
+        int fn = op < 0xC0 ? (op - 0xA0) >> 3 : (op - 0xE6) >> 3;
+        emit_gb(e, 0, 0x8A, RAX, GB(cpu.a)); // mov al, [a]
+        if (op < 0xC0) {
+            emit_gb(e, 0, logic_reg[fn], RAX, reg_offset[src]);
+        } else {
+            put8(e, logic_imm[fn]);
+            put8(e, imm16 & 0xFF);
+        }
+        emit_logic_flags(e, fn == 0 ? 0x10 : 0);
+        return true;
+    }
+
+    if (op == 0xF0 || op == 0xFA) { // LDH A,[n8] and LD A,[n16]
+        put8(e, 0x4C); put8(e, 0x89); put8(e, 0xE7); // mov rdi, r12
+        put8(e, 0xBE); put32(e, op == 0xF0 ? 0xFF00 | (imm16 & 0xFF) : imm16); // mov esi, addr
+        emit_call(e, (void *)mem_read);
+        emit_gb(e, 0, 0x88, RAX, GB(cpu.a));
+        return true;
+    }
+
+    if (op == 0xE0 || op == 0xEA) { // LDH [n8],A and LD [n16],A
+        put8(e, 0x4C); put8(e, 0x89); put8(e, 0xE7);
+        put8(e, 0xBE); put32(e, op == 0xE0 ? 0xFF00 | (imm16 & 0xFF) : imm16);
+        emit_gb(e, 0, 0x0FB6, RDX, GB(cpu.a)); // movzx edx, byte [a]
+        emit_call(e, (void *)mem_write);
+        return true;
+    }
+
+    return false;
+}
+
+static void perf_map_open() {
+    if (getenv("BOYO_PERF_MAP") == NULL) {
+        return;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+    perf_map = fopen(path, "w");
+}
+
+static void perf_map_add(gb_t *gb, const uint8_t *start, size_t size, const uint8_t *host, uint16_t pc) {
+    pthread_once(&perf_map_once, perf_map_open);
+    if (perf_map == NULL) {
+        return;
+    }
+
+    // Instances on other threads write here too, keep each line whole
+    size_t bank = (host - gb->cartridge.rom) / 0x4000;
+    flockfile(perf_map);
+    fprintf(perf_map, "%lx %zx boyo_rom%03zX_%04X\n", (unsigned long)(uintptr_t)start, size, bank, pc);
+    fflush(perf_map);
+    funlockfile(perf_map);
+}
+
+// Translate the block starting at pc, NULL if its first instruction has to be interpreted
+static jit_code_t jit_compile(gb_t *gb, uint16_t pc, uint8_t *page) {
+    gb_jit_t *jit = gb->jit.cache;
+    jit_emit_t e;
+    e.start = &jit->buffer[jit->used];
+    e.p = e.start;
+
+    // Epilogue first, so every exit is a jump back to a known address
+    e.exit = e.p;
+    put8(&e, 0x48); put8(&e, 0x83); put8(&e, 0xC4); put8(&e, 0x08); // add rsp, 8
+    put8(&e, 0x89); put8(&e, 0xD8); // mov eax, ebx
+    put8(&e, 0x5B); // pop rbx
+    put8(&e, 0x41); put8(&e, 0x5C); // pop r12
+    put8(&e, 0xC3); // ret
+
+    uint8_t *entry = e.p;
+    put8(&e, 0x41); put8(&e, 0x54); // push r12
+    put8(&e, 0x53); // push rbx
+    put8(&e, 0x48); put8(&e, 0x83); put8(&e, 0xEC); put8(&e, 0x08); // sub rsp, 8
+    put8(&e, 0x49); put8(&e, 0x89); put8(&e, 0xFC); // mov r12, rdi
+
+    uint16_t start = pc;
+    int count = 0;
+    while (count < JIT_BLOCK_LENGTH && (pc >> 8) == (start >> 8)) {
+        int offset = pc & 0xFF;
+        uint8_t op = page[offset];
+        const cpu_op_t *info = &cpu_ops[op];
+        int length = info->length;
+        if ((info->flags & CPU_OP_INTERPRET) || offset + length > MEM_PAGE_SIZE) {
+            break;
+        }
+
+        uint16_t imm16 = 0;
+        if (length >= 2) {
+            imm16 = page[offset + 1];
+        }
+        if (length == 3) {
+            imm16 |= page[offset + 2] << 8;
+        }
+
+        put8(&e, 0xBB); put32(&e, pc); // mov ebx, pc
+
+        bool native = emit_native(&e, op, imm16);
+        if (native) {
+            emit_gb(&e, REX_W, 0x83, 0, GB(sched.cycles)); // add qword [cycles], t
+            put8(&e, info->cycles);
+            put8(&e, 0x66); // mov word [pc], next
+            emit_gb(&e, 0, 0xC7, 0, GB(cpu.pc));
+            put16(&e, pc + length);
+        } else {
+            put8(&e, 0x4C); put8(&e, 0x89); put8(&e, 0xE7); // mov rdi, r12
+            put8(&e, 0xBE); put32(&e, op); // mov esi, op
+            put8(&e, 0xBA); put32(&e, imm16); // mov edx, imm16
+            emit_call(&e, (void *)cpu_execute_op);
+            put8(&e, 0x0F); put8(&e, 0xB6); put8(&e, 0xC0); // movzx eax, al
+            emit_gb(&e, REX_W, 0x01, RAX, GB(sched.cycles)); // add [cycles], rax
+        }
+
+        count++;
+        pc += length;
+        if (info->flags & CPU_OP_END) {
+            break;
+        }
+
+        // A bank switch moves the rest of the block away
+        if (cpu_op_decode(op, imm16 & 0xFF)->flags & CPU_OP_WRITE) {
+            put8(&e, 0x48); put8(&e, 0xB8); put64(&e, (uintptr_t)page); // mov rax, page
+            emit_gb(&e, REX_W, 0x39, RAX, GB(mem.read_page) + (start >> 8) * sizeof(uint8_t *));
+            emit_exit_if(&e, 0x5); // jne
+        }
+
+        // Anything touching memory may have caught a unit up and raised an interrupt
+        if (!native || (info->flags & (CPU_OP_READ | CPU_OP_WRITE))) {
+            emit_gb(&e, 0, 0x80, 7, GB(cpu.ime)); // cmp byte [ime], 0
+            put8(&e, 0);
+            put8(&e, 0x74); put8(&e, 22); // je past the check
+            emit_gb(&e, 0, 0x8A, RAX, GB(mem.ie)); // mov al, [ie]
+            emit_gb(&e, 0, 0x22, RAX, GB(mem.iflag)); // and al, [iflag]
+            emit_exit_if(&e, 0x5); // jnz
+        }
+
+        emit_gb(&e, REX_W, 0x8B, RAX, GB(sched.cycles)); // mov rax, [cycles]
+        emit_gb(&e, REX_W, 0x3B, RAX, GB(sched.next)); // cmp rax, [next]
+        emit_exit_if(&e, 0x3); // jae
+    }
+
+    if (count == 0) {
+        return NULL;
+    }
+
+    put8(&e, 0xE9); put32(&e, (uint32_t)(e.exit - (e.p + 4))); // jmp exit
+
+    jit->used += e.p - e.start;
+    perf_map_add(gb, e.start, e.p - e.start, &page[start & 0xFF], start);
+    return (jit_code_t)entry;
+}
+
+void jit_init(gb_t *gb) {
+    gb->jit.cache = &gb->jit;
+
+    void *buffer = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        printf("JIT disabled, no executable memory\n");
+        return;
+    }
+    gb->jit.buffer = buffer;
+}
+
+// Look blocks up in owner's cache from now on, owner has to run the same ROM and outlive gb
+// Blocks only depend on the ROM, each instance still checks its own banks before running one
+// Only one instance at a time runs from a cache, see jit_claim
+void jit_share(gb_t *gb, gb_t *owner) {
+    jit_destroy(gb);
+    gb->jit.cache = owner->jit.cache;
+}
+
+void jit_destroy(gb_t *gb) {
+    if (gb->jit.buffer != NULL) {
+        munmap(gb->jit.buffer, JIT_BUFFER_SIZE);
+        gb->jit.buffer = NULL;
+    }
+}
+
+// Take the cache for one emu_run_to, running compiles, replaces and throws away blocks
+// An instance sharing a cache that another thread is running from right now interprets instead
+void jit_claim(gb_t *gb) {
+    bool busy = false;
+    gb->jit.claimed = atomic_compare_exchange_strong_explicit(&gb->jit.cache->busy, &busy, true,
+                                                              memory_order_acquire, memory_order_relaxed);
+}
+
+void jit_release(gb_t *gb) {
+    if (gb->jit.claimed) {
+        atomic_store_explicit(&gb->jit.cache->busy, false, memory_order_release);
+        gb->jit.claimed = false;
+    }
+}
+
+// Run the compiled block at PC if there is one, pc is set to the last instruction it ran
+bool jit_run(gb_t *gb, uint16_t *pc) {
+    cpu_t *cpu = &gb->cpu;
+    gb_jit_t *jit = gb->jit.cache;
+
+    // Blocks only start where the interpreter would run a plain instruction
+    if (!gb->jit.claimed || jit->buffer == NULL || cpu->halt || cpu->stop || cpu->ime_pending ||
+        (cpu->ime && (gb->mem.ie & gb->mem.iflag))) {
+        return false;
+    }
+
+    uint8_t *page = gb->mem.read_page[cpu->pc >> 8];
+    if (cpu->pc >= 0x8000 || page == NULL) {
+        return false;
+    }
+
+    const uint8_t *host = &page[cpu->pc & 0xFF];
+    size_t offset = host - gb->cartridge.rom;
+    jit_block_t *block = &jit->blocks[(offset ^ (offset >> 12)) & (JIT_BLOCKS - 1)];
+    if (block->host != host || block->pc != cpu->pc) {
+        *block = (jit_block_t){.host = host, .pc = cpu->pc};
+    }
+
+    if (block->code == NULL) {
+        if (block->interpret || ++block->hits < JIT_HOT) {
+            return false;
+        }
+
+        // Out of space, start over
+        if (jit->used + JIT_BLOCK_SIZE_MAX > JIT_BUFFER_SIZE) {
+            memset(jit->blocks, 0, sizeof(jit->blocks));
+            jit->used = 0;
+            *block = (jit_block_t){.host = host, .pc = cpu->pc};
+        }
+
+        block->code = jit_compile(gb, cpu->pc, page);
+        if (block->code == NULL) {
+            block->interpret = true;
+            return false;
+        }
+    }
+
+    *pc = block->code(gb);
+    return true;
+}
+
+#endif
@@ -11,8 +11,7 @@
 #include "apu.h"
 #include "log.h"
 #include "emu.h"
-
-#define MEM_WRITE_NEXT_LEN 4
+#include "gb.h"
 
 #ifdef CGB
 #include "cgb.h"
@@ -20,106 +19,142 @@
 #define CGB_WRAM_BANK 0b00000111
 #endif
 
-mem_t mem = {};
+static bool bootrom_page(int page) {
+#ifdef CGB
+    return page == 0x00 || (page >= 0x02 && page <= 0x08);
+#else
+    return page == 0x00;
+#endif
+}
+
+static void mem_map_wram(gb_t *gb) {
+#ifdef CGB
+    uint8_t *bank = &gb->mem.wram[0x1000 + (gb->mem.wram_bank * 0x1000)];
+#else
+    uint8_t *bank = &gb->mem.wram[0x1000];
+#endif
+    mem_map(gb, 0xC0, 0x10, gb->mem.wram, gb->mem.wram);
+    mem_map(gb, 0xD0, 0x10, bank, bank);
+    mem_map(gb, 0xE0, 0x1E, gb->mem.wram, gb->mem.wram); // Echo RAM
+}
+
+void mem_init(gb_t *gb) {
+    // Cartridge pages are mapped when the ROM is loaded
+    mem_map_wram(gb);
+    mem_map(gb, 0x80, 0x20, gb->ppu.vram, NULL); // VRAM writes have to catch the PPU up first
+}
+
+void mem_map(gb_t *gb, int page, int count, uint8_t *read, uint8_t *write) {
+    for (int i = 0; i < count; i++) {
+        // The bootrom overlays the cartridge until it is disabled
+        bool overlay = !gb->mem.bootrom_disable && bootrom_page(page + i);
+        gb->mem.read_page[page + i] = (read != NULL && !overlay) ? read + (i * MEM_PAGE_SIZE) : NULL;
+        gb->mem.write_page[page + i] = (write != NULL) ? write + (i * MEM_PAGE_SIZE) : NULL;
+    }
+}
 
-uint8_t mem_io_read(uint8_t addr) {
+uint8_t mem_io_read(gb_t *gb, uint8_t addr) {
     DEBUG_PRINTF_MEM("IO READ:0x%X ", addr);
 
     if (addr == 0x00) {
-        return joypad_io_read(addr);
+        return joypad_io_read(gb, addr);
     } else if (addr <= 0x02) {
-        return serial_io_read(addr);
+        return serial_io_read(gb, addr);
     } else if ((addr >= 0x04) && (addr <= 0x07)) {
-        return timer_io_read(addr);
+        return timer_io_read(gb, addr);
     } else if (addr == 0x0F) {
-        return mem.iflag | 0b11100000;
+        return gb->mem.iflag | 0b11100000;
     } else if (addr <= 0x2F) {
-        return apu_io_read(addr);
+        return apu_io_read(gb, addr);
     } else if (addr <= 0x3F) {
-        return apu_wave_read(addr);
+        return apu_wave_read(gb, addr);
     } else if (addr <= 0x4B || addr == 0x4F || (addr >= 0x68 && addr <= 0x6B)) {
-        return ppu_io_read(addr);
+        return ppu_io_read(gb, addr);
 #ifdef CGB
     } else if (addr == 0x4D) {
-        return cgb_io_read(addr);
+        return cgb_io_read(gb, addr);
     } else if (addr >= 0x51 && addr <= 0x55) {
-        return vdma_io_read(addr);
+        return vdma_io_read(gb, addr);
     } else if (addr == 0x70) {
-        return ((mem.wram_bank + 1) & CGB_WRAM_BANK) | ~CGB_WRAM_BANK;
+        return ((gb->mem.wram_bank + 1) & CGB_WRAM_BANK) | ~CGB_WRAM_BANK;
+    } else if (addr == 0x76 || addr == 0x77) {
+        return apu_io_read(gb, addr);
 #endif
     } else {
         return 0;
     }
 }
 
-void mem_io_write(uint8_t addr, uint8_t data) {
+void mem_io_write(gb_t *gb, uint8_t addr, uint8_t data) {
     DEBUG_PRINTF_MEM("IO WRITE:0x%X 0x%X\n", addr, data);
 
     if (addr == 0x00) {
-      joypad_io_write(addr, data);
+      joypad_io_write(gb, addr, data);
     } else if (addr <= 0x02) {
-        serial_io_write(addr, data);
+        serial_io_write(gb, addr, data);
     } else if ((addr >= 0x04) && (addr <= 0x07)) {
-        timer_io_write(addr, data);
+        timer_io_write(gb, addr, data);
     } else if (addr == 0x0F) {
-        mem.iflag = data;
+        gb->mem.iflag = data;
     } else if (addr <= 0x2F) {
-        apu_io_write(addr, data);
+        apu_io_write(gb, addr, data);
     } else if (addr <= 0x3F) {
-        apu_wave_write(addr, data);
+        apu_wave_write(gb, addr, data);
     } else if (addr <= 0x4B || addr == 0x4F || (addr >= 0x68 && addr <= 0x6B)) {
-        ppu_io_write(addr, data);
+        ppu_io_write(gb, addr, data);
     } else if ((addr == 0x50) && data) {
         DEBUG_PRINTF_MEM("BOOTROM DISABLED\n");
-        mem.bootrom_disable = 1;
+        gb->mem.bootrom_disable = 1;
+        cartridge_map(gb);
 #ifdef CGB
     } else if (addr == 0x4D) {
-        cgb_io_write(addr, data);
+        cgb_io_write(gb, addr, data);
     } else if (addr >= 0x51 && addr <= 0x55) {
-        vdma_io_write(addr, data);
+        vdma_io_write(gb, addr, data);
     } else if (addr == 0x70) {
         uint8_t bank = data & CGB_WRAM_BANK;
         if (!bank) { bank = 1; }
-        mem.wram_bank = bank - 1;
+        gb->mem.wram_bank = bank - 1;
+        mem_map_wram(gb);
 #endif
     }
 }
 
-uint8_t mem_read(uint16_t addr) {
-    if (!mem.bootrom_disable && (addr <= 0x00FF)) {
-        return mem.bootrom[addr];
+static uint8_t mem_read_slow(gb_t *gb, uint16_t addr) {
+    if (!gb->mem.bootrom_disable && (addr <= 0x00FF)) {
+        return gb->mem.bootrom[addr];
 #ifdef CGB
-    } else if (!mem.bootrom_disable && (addr >= 0x0200) && (addr <= 0x08FF)) {
-        return mem.bootrom[addr];
+    } else if (!gb->mem.bootrom_disable && (addr >= 0x0200) && (addr <= 0x08FF)) {
+        return gb->mem.bootrom[addr];
 #endif
     } else if (addr <= 0x7FFF) {
-        return cartridge_read(addr);
+        return cartridge_read(gb, addr);
     } else if (addr <= 0x9FFF) {
-        return ppu_vram_read(addr);
+        return ppu_vram_read(gb, addr);
     } else if (addr <= 0xBFFF) {
-        return cartridge_read(addr);
+        return cartridge_read(gb, addr);
     } else if (addr <= 0xDFFF) {
 #ifdef CGB
         if (addr <= 0xCFFF) {
-            return mem.wram[addr-0xC000];
+            return gb->mem.wram[addr-0xC000];
         } else {
-            return mem.wram[(addr-0xC000)+(mem.wram_bank*0x1000)];
+            return gb->mem.wram[(addr-0xC000)+(gb->mem.wram_bank*0x1000)];
         }
 #else
-        return mem.wram[addr-0xC000];
+        return gb->mem.wram[addr-0xC000];
 #endif
     } else if (addr <= 0xFDFF) {
-        return mem.wram[addr-0xE000];
+        return gb->mem.wram[addr-0xE000];
     } else if (addr <= 0xFE9F) {
-        return mem.oam[addr-0xFE00];
+        return gb->mem.oam[addr-0xFE00];
     } else if (addr <= 0xFEFF) {
         return 0;
     } else if (addr <= 0xFF7F) {
-        return mem_io_read(addr & 0x00FF);
+        return mem_io_read(gb, addr & 0x00FF);
     } else if (addr <= 0xFFFE) {
-        return mem.hram[addr-0xFF80];
+        return gb->mem.hram[addr-0xFF80];
     } else if (addr == 0xFFFF) {
-        return mem.ie;
+        return gb->mem.ie;
     } else {
         printf("Unknown read address 0x%X\n", addr);
         exit(1);
@@ -127,65 +162,85 @@ uint8_t mem_read(uint16_t addr) {
     }
 }
 
-void mem_write(uint16_t addr, uint8_t data) {
+static void mem_write_slow(gb_t *gb, uint16_t addr, uint8_t data) {
     if (addr <= 0x7FFF) {
-        cartridge_write(addr, data);
+        cartridge_write(gb, addr, data);
     } else if (addr <= 0x9FFF) {
-        ppu_vram_write(addr, data);
+        ppu_vram_write(gb, addr, data);
     } else if (addr <= 0xBFFF) {
-        cartridge_write(addr, data);
+        cartridge_write(gb, addr, data);
     } else if (addr <= 0xDFFF) {
 #ifdef CGB
         if (addr <= 0xCFFF) {
-            mem.wram[addr-0xC000] = data;
+            gb->mem.wram[addr-0xC000] = data;
         } else {
-            mem.wram[(addr-0xC000)+(mem.wram_bank*0x1000)] = data;
+            gb->mem.wram[(addr-0xC000)+(gb->mem.wram_bank*0x1000)] = data;
         }
 #else
-        mem.wram[addr-0xC000] = data;
+        gb->mem.wram[addr-0xC000] = data;
 #endif
     } else if (addr <= 0xFDFF) {
-        mem.wram[addr-0xE000] = data;
+        gb->mem.wram[addr-0xE000] = data;
     } else if (addr <= 0xFE9F) {
-        mem.oam[addr-0xFE00] = data;
+        ppu_sync(gb);
+        gb->mem.oam[addr-0xFE00] = data;
     } else if (addr <= 0xFEFF) {
         // Do nothing
     } else if (addr <= 0xFF7F) {
-        mem_io_write(addr & 0x00FF, data);
+        mem_io_write(gb, addr & 0x00FF, data);
     } else if (addr <= 0xFFFE) {
-        mem.hram[addr-0xFF80] = data;
+        gb->mem.hram[addr-0xFF80] = data;
     } else if (addr == 0xFFFF) {
-        mem.ie = data;
+        gb->mem.ie = data;
     } else {
         printf("Unknown write address 0x%X, data 0x%X\n", addr, data);
         exit(1);
     }
 }
 
-uint16_t mem_read16(uint16_t addr) {
-    return ((uint16_t)mem_read(addr+1) << 8) + (uint16_t)mem_read(addr);
+uint8_t mem_read(gb_t *gb, uint16_t addr) {
+    uint8_t *page = gb->mem.read_page[addr >> 8];
+    if (page != NULL) {
+        return page[addr & 0xFF];
+    }
+    return mem_read_slow(gb, addr);
+}
+
+void mem_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    uint8_t *page = gb->mem.write_page[addr >> 8];
+    if (page != NULL) {
+        page[addr & 0xFF] = data;
+        return;
+    }
+    mem_write_slow(gb, addr, data);
+}
+
+uint16_t mem_read16(gb_t *gb, uint16_t addr) {
+    // Both bytes on the same mapped page, skip the second lookup
+    uint8_t *page = gb->mem.read_page[addr >> 8];
+    if (page != NULL && (addr & 0xFF) != 0xFF) {
+        return ((uint16_t)page[(addr & 0xFF) + 1] << 8) + (uint16_t)page[addr & 0xFF];
+    }
+    return ((uint16_t)mem_read(gb, addr+1) << 8) + (uint16_t)mem_read(gb, addr);
 }
 
-void mem_write16(uint16_t addr, uint16_t data) {
-    mem_write(addr, data & 0x00FF);
-    mem_write(addr + 1, (data & 0xFF00) >> 8);
+void mem_write16(gb_t *gb, uint16_t addr, uint16_t data) {
+    mem_write(gb, addr, data & 0x00FF);
+    mem_write(gb, addr + 1, (data & 0xFF00) >> 8);
 }
 
-void mem_load_bootrom(uint8_t *data, size_t size) {
+void mem_load_bootrom(gb_t *gb, uint8_t *data, size_t size) {
     if (size > EMU_BOOTROM_SIZE_MAX) {
         printf("MEM: BOOTROM too big!\n");
         exit(1);
     }
 
-    mem.bootrom = data;
+    gb->mem.bootrom = data;
 }
 
-// Memory write log, to be commited at t = 0
-static mem_write_t mem_writes[MEM_WRITE_NEXT_LEN] = {};
-int mem_writes_i = 0;
-
-void mem_write_next(uint16_t addr, uint8_t data) {
-    if (mem_writes_i >= MEM_WRITE_NEXT_LEN) {
+#ifdef CPU_REFERENCE
+void mem_write_next(gb_t *gb, uint16_t addr, uint8_t data) {
+    if (gb->mem.writes_i >= MEM_WRITE_NEXT_LEN) {
         printf("Memory write next length exceeded!");
         exit(1);
     }
@@ -193,18 +248,19 @@ void mem_write_next(uint16_t addr, uint8_t data) {
         .addr = addr,
         .data = data
     };
-    mem_writes[mem_writes_i] = write;
-    mem_writes_i++;
+    gb->mem.writes[gb->mem.writes_i] = write;
+    gb->mem.writes_i++;
 }
 
-void mem_write_next16(uint16_t addr, uint16_t data) {
-    mem_write_next(addr, data & 0x00FF);
-    mem_write_next(addr + 1, (data & 0xFF00) >> 8);
+void mem_write_next16(gb_t *gb, uint16_t addr, uint16_t data) {
+    mem_write_next(gb, addr, data & 0x00FF);
+    mem_write_next(gb, addr + 1, (data & 0xFF00) >> 8);
 }
 
-void mem_writeback() {
-    for (int i = 0; i < mem_writes_i; i++) {
-            mem_write(mem_writes[i].addr, mem_writes[i].data);
+void mem_writeback(gb_t *gb) {
+    for (int i = 0; i < gb->mem.writes_i; i++) {
+            mem_write(gb, gb->mem.writes[i].addr, gb->mem.writes[i].data);
     }
-    mem_writes_i = 0;
+    gb->mem.writes_i = 0;
 }
+#endif
@@ -0,0 +1,190 @@
+#include <stdint.h>
+
+#include "mix.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define MIX_X86
+#include <immintrin.h>
+#endif
+
+static void (*stereo_kernel)(float *out, const int32_t (*levels)[MIX_CHANNELS], int count, const float *gain_left, const float *gain_right);
+static void (*to_s16_kernel)(int16_t *out, const float *mix, int count);
+static void (*to_f32_kernel)(float *out, const float *mix, int count);
+
+// Sums go channel 1 to 4 in every version so they all round the same
+static void stereo_scalar(float *out, const int32_t (*levels)[MIX_CHANNELS], int count, const float *gain_left, const float *gain_right) {
+    for (int i = 0; i < count; i++) {
+        float left = (float)levels[i][0] * gain_left[0];
+        float right = (float)levels[i][0] * gain_right[0];
+        for (int ch = 1; ch < MIX_CHANNELS; ch++) {
+            left += (float)levels[i][ch] * gain_left[ch];
+            right += (float)levels[i][ch] * gain_right[ch];
+        }
+        out[i * 2] = left;
+        out[(i * 2) + 1] = right;
+    }
+}
+
+static void to_s16_scalar(int16_t *out, const float *mix, int count) {
+    for (int i = 0; i < count; i++) {
+        float sample = mix[i];
+        if (sample > INT16_MAX) { sample = INT16_MAX; }
+        if (sample < INT16_MIN) { sample = INT16_MIN; }
+        out[i] = (int16_t)sample;
+    }
+}
+
+static void to_f32_scalar(float *out, const float *mix, int count) {
+    for (int i = 0; i < count; i++) {
+        float sample = mix[i] * (1.0f / 32768.0f);
+        if (sample > 1.0f) { sample = 1.0f; }
+        if (sample < -1.0f) { sample = -1.0f; }
+        out[i] = sample;
+    }
+}
+
+#ifdef MIX_X86
+// SSE2 is always there on x86-64
+static void stereo_sse2(float *out, const int32_t (*levels)[MIX_CHANNELS], int count, const float *gain_left, const float *gain_right) {
+    const __m128 left1 = _mm_set1_ps(gain_left[0]);
+    const __m128 left2 = _mm_set1_ps(gain_left[1]);
+    const __m128 left3 = _mm_set1_ps(gain_left[2]);
+    const __m128 left4 = _mm_set1_ps(gain_left[3]);
+    const __m128 right1 = _mm_set1_ps(gain_right[0]);
+    const __m128 right2 = _mm_set1_ps(gain_right[1]);
+    const __m128 right3 = _mm_set1_ps(gain_right[2]);
+    const __m128 right4 = _mm_set1_ps(gain_right[3]);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        // Four samples of four channels, transposed to one channel of four samples per register
+        __m128 ch1 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)levels[i]));
+        __m128 ch2 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)levels[i+1]));
+        __m128 ch3 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)levels[i+2]));
+        __m128 ch4 = _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)levels[i+3]));
+        _MM_TRANSPOSE4_PS(ch1, ch2, ch3, ch4);
+
+        __m128 left = _mm_mul_ps(ch1, left1);
+        left = _mm_add_ps(left, _mm_mul_ps(ch2, left2));
+        left = _mm_add_ps(left, _mm_mul_ps(ch3, left3));
+        left = _mm_add_ps(left, _mm_mul_ps(ch4, left4));
+        __m128 right = _mm_mul_ps(ch1, right1);
+        right = _mm_add_ps(right, _mm_mul_ps(ch2, right2));
+        right = _mm_add_ps(right, _mm_mul_ps(ch3, right3));
+        right = _mm_add_ps(right, _mm_mul_ps(ch4, right4));
+
+        _mm_storeu_ps(&out[i * 2], _mm_unpacklo_ps(left, right));
+        _mm_storeu_ps(&out[(i * 2) + 4], _mm_unpackhi_ps(left, right));
+    }
+
+    stereo_scalar(&out[i * 2], &levels[i], count - i, gain_left, gain_right);
+}
+
+static void to_s16_sse2(int16_t *out, const float *mix, int count) {
+    // Clamp before converting, anything past the int32 range would come out as INT32_MIN
+    const __m128 high = _mm_set1_ps(INT16_MAX);
+    const __m128 low = _mm_set1_ps(INT16_MIN);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(&mix[i]), high), low));
+        __m128i b = _mm_cvttps_epi32(_mm_max_ps(_mm_min_ps(_mm_loadu_ps(&mix[i+4]), high), low));
+        _mm_storeu_si128((__m128i *)&out[i], _mm_packs_epi32(a, b));
+    }
+
+    to_s16_scalar(&out[i], &mix[i], count - i);
+}
+
+static void to_f32_sse2(float *out, const float *mix, int count) {
+    const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minus_one = _mm_set1_ps(-1.0f);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(&mix[i]), scale);
+        _mm_storeu_ps(&out[i], _mm_max_ps(_mm_min_ps(v, one), minus_one));
+    }
+
+    to_f32_scalar(&out[i], &mix[i], count - i);
+}
+
+__attribute__((target("avx2")))
+static void stereo_avx2(float *out, const int32_t (*levels)[MIX_CHANNELS], int count, const float *gain_left, const float *gain_right) {
+    const __m256 left1 = _mm256_set1_ps(gain_left[0]);
+    const __m256 left2 = _mm256_set1_ps(gain_left[1]);
+    const __m256 left3 = _mm256_set1_ps(gain_left[2]);
+    const __m256 left4 = _mm256_set1_ps(gain_left[3]);
+    const __m256 right1 = _mm256_set1_ps(gain_right[0]);
+    const __m256 right2 = _mm256_set1_ps(gain_right[1]);
+    const __m256 right3 = _mm256_set1_ps(gain_right[2]);
+    const __m256 right4 = _mm256_set1_ps(gain_right[3]);
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Two samples per register, the transpose works within 128 bit lanes so the low lane
+        // ends up with samples 0, 2, 4, 6 and the high lane with 1, 3, 5, 7
+        __m256 a = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)levels[i]));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)levels[i+2]));
+        __m256 c = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)levels[i+4]));
+        __m256 d = _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i *)levels[i+6]));
+
+        __m256 ab_lo = _mm256_unpacklo_ps(a, b);
+        __m256 ab_hi = _mm256_unpackhi_ps(a, b);
+        __m256 cd_lo = _mm256_unpacklo_ps(c, d);
+        __m256 cd_hi = _mm256_unpackhi_ps(c, d);
+        __m256 ch1 = _mm256_shuffle_ps(ab_lo, cd_lo, 0b01000100);
+        __m256 ch2 = _mm256_shuffle_ps(ab_lo, cd_lo, 0b11101110);
+        __m256 ch3 = _mm256_shuffle_ps(ab_hi, cd_hi, 0b01000100);
+        __m256 ch4 = _mm256_shuffle_ps(ab_hi, cd_hi, 0b11101110);
+
+        __m256 left = _mm256_mul_ps(ch1, left1);
+        left = _mm256_add_ps(left, _mm256_mul_ps(ch2, left2));
+        left = _mm256_add_ps(left, _mm256_mul_ps(ch3, left3));
+        left = _mm256_add_ps(left, _mm256_mul_ps(ch4, left4));
+        __m256 right = _mm256_mul_ps(ch1, right1);
+        right = _mm256_add_ps(right, _mm256_mul_ps(ch2, right2));
+        right = _mm256_add_ps(right, _mm256_mul_ps(ch3, right3));
+        right = _mm256_add_ps(right, _mm256_mul_ps(ch4, right4));
+
+        // Left/right pairs of samples 0, 2 | 1, 3 and 4, 6 | 5, 7, swap the middle pairs into order
+        __m256d lo = _mm256_castps_pd(_mm256_unpacklo_ps(left, right));
+        __m256d hi = _mm256_castps_pd(_mm256_unpackhi_ps(left, right));
+        _mm256_storeu_ps(&out[i * 2], _mm256_castpd_ps(_mm256_permute4x64_pd(lo, 0b11011000)));
+        _mm256_storeu_ps(&out[(i * 2) + 8], _mm256_castpd_ps(_mm256_permute4x64_pd(hi, 0b11011000)));
+    }
+
+    stereo_sse2(&out[i * 2], &levels[i], count - i, gain_left, gain_right);
+}
+#endif
+
+// Picked once when the library is loaded, like the pixel kernels
+__attribute__((constructor))
+static void mix_init() {
+    stereo_kernel = stereo_scalar;
+    to_s16_kernel = to_s16_scalar;
+    to_f32_kernel = to_f32_scalar;
+
+#ifdef MIX_X86
+    stereo_kernel = stereo_sse2;
+    to_s16_kernel = to_s16_sse2;
+    to_f32_kernel = to_f32_sse2;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        stereo_kernel = stereo_avx2;
+    }
+#endif
+}
+
+void mix_stereo(float *out, const int32_t (*levels)[MIX_CHANNELS], int count, const float *gain_left, const float *gain_right) {
+    stereo_kernel(out, levels, count, gain_left, gain_right);
+}
+
+void mix_to_s16(int16_t *out, const float *mix, int count) {
+    to_s16_kernel(out, mix, count);
+}
+
+void mix_to_f32(float *out, const float *mix, int count) {
+    to_f32_kernel(out, mix, count);
+}
@@ -0,0 +1,176 @@
+#include <stdint.h>
+
+#include "pixel.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define PIXEL_X86
+#include <immintrin.h>
+#endif
+
+static void (*decode_kernel)(uint8_t *out, uint8_t *out_flip, const uint8_t *data);
+static void (*map_dmg_kernel)(uint8_t *out, const uint8_t *index, int count, uint8_t palette);
+static void (*map_cgb_kernel)(uint16_t *out, const uint8_t *index, int count, const uint8_t *palette_data);
+
+static void decode_scalar(uint8_t *out, uint8_t *out_flip, const uint8_t *data) {
+    for (int y = 0; y < 8; y++) {
+        uint8_t byte_l = data[y * 2];
+        uint8_t byte_h = data[(y * 2) + 1];
+
+        for (int x = 0; x < 8; x++) {
+            uint8_t index = (((byte_h >> (7 - x)) & 1) << 1) | ((byte_l >> (7 - x)) & 1);
+            out[(y * 8) + x] = index;
+            out_flip[(y * 8) + (7 - x)] = index;
+        }
+    }
+}
+
+static void map_dmg_scalar(uint8_t *out, const uint8_t *index, int count, uint8_t palette) {
+    for (int i = 0; i < count; i++) {
+        out[i] = (palette >> (index[i] * 2)) & 0b00000011;
+    }
+}
+
+static void map_cgb_scalar(uint16_t *out, const uint8_t *index, int count, const uint8_t *palette_data) {
+    for (int i = 0; i < count; i++) {
+        uint8_t address = index[i] * 2;
+        out[i] = palette_data[address] | (palette_data[address+1] << 8);
+    }
+}
+
+#ifdef PIXEL_X86
+// SSE2 is always there on x86-64
+static void decode_sse2(uint8_t *out, uint8_t *out_flip, const uint8_t *data) {
+    // Bit tested by each output byte, low bitplane in the low half and high in the high half
+    const __m128i mask = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i mask_flip = _mm_set_epi8(-128, 64, 32, 16, 8, 4, 2, 1, -128, 64, 32, 16, 8, 4, 2, 1);
+    const __m128i weight = _mm_set_epi8(2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1, 1);
+
+    // Spread each row to 8 copies of the low byte followed by 8 copies of the high byte
+    __m128i d = _mm_loadu_si128((const __m128i *)data);
+    __m128i bytes[2] = {_mm_unpacklo_epi8(d, d), _mm_unpackhi_epi8(d, d)};
+    for (int i = 0; i < 2; i++) {
+        __m128i words[2] = {_mm_unpacklo_epi16(bytes[i], bytes[i]), _mm_unpackhi_epi16(bytes[i], bytes[i])};
+        for (int j = 0; j < 2; j++) {
+            __m128i rows[2] = {_mm_unpacklo_epi32(words[j], words[j]), _mm_unpackhi_epi32(words[j], words[j])};
+            for (int k = 0; k < 2; k++) {
+                int y = (i * 4) + (j * 2) + k;
+
+                __m128i bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(rows[k], mask), mask), weight);
+                bits = _mm_or_si128(bits, _mm_srli_si128(bits, 8));
+                _mm_storel_epi64((__m128i *)&out[y * 8], bits);
+
+                bits = _mm_and_si128(_mm_cmpeq_epi8(_mm_and_si128(rows[k], mask_flip), mask_flip), weight);
+                bits = _mm_or_si128(bits, _mm_srli_si128(bits, 8));
+                _mm_storel_epi64((__m128i *)&out_flip[y * 8], bits);
+            }
+        }
+    }
+}
+
+static void map_dmg_sse2(uint8_t *out, const uint8_t *index, int count, uint8_t palette) {
+    // No byte shuffle in SSE2, select each shade by comparing against the index
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi8(2);
+    const __m128i three = _mm_set1_epi8(3);
+    const __m128i shade1 = _mm_set1_epi8((palette >> 2) & 0b00000011);
+    const __m128i shade2 = _mm_set1_epi8((palette >> 4) & 0b00000011);
+    const __m128i shade3 = _mm_set1_epi8((palette >> 6) & 0b00000011);
+    const __m128i shade0 = _mm_set1_epi8(palette & 0b00000011);
+
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)&index[i]);
+        __m128i m1 = _mm_cmpeq_epi8(v, one);
+        __m128i m2 = _mm_cmpeq_epi8(v, two);
+        __m128i m3 = _mm_cmpeq_epi8(v, three);
+        __m128i m0 = _mm_andnot_si128(_mm_or_si128(m1, _mm_or_si128(m2, m3)), _mm_set1_epi8(-1));
+
+        __m128i r = _mm_and_si128(m0, shade0);
+        r = _mm_or_si128(r, _mm_and_si128(m1, shade1));
+        r = _mm_or_si128(r, _mm_and_si128(m2, shade2));
+        r = _mm_or_si128(r, _mm_and_si128(m3, shade3));
+        _mm_storeu_si128((__m128i *)&out[i], r);
+    }
+
+    map_dmg_scalar(&out[i], &index[i], count - i, palette);
+}
+
+__attribute__((target("avx2")))
+static void map_dmg_avx2(uint8_t *out, const uint8_t *index, int count, uint8_t palette) {
+    // The four shades as a table for the byte shuffle
+    const __m256i table = _mm256_setr_epi8(
+        palette & 3, (palette >> 2) & 3, (palette >> 4) & 3, (palette >> 6) & 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        palette & 3, (palette >> 2) & 3, (palette >> 4) & 3, (palette >> 6) & 3, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&index[i]);
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_shuffle_epi8(table, v));
+    }
+
+    map_dmg_sse2(&out[i], &index[i], count - i, palette);
+}
+
+__attribute__((target("avx2")))
+static void map_cgb_avx2(uint16_t *out, const uint8_t *index, int count, const uint8_t *palette_data) {
+    // Split the 32 colors into low and high byte tables, 16 entries per shuffle
+    uint8_t low[32], high[32];
+    for (int i = 0; i < 32; i++) {
+        low[i] = palette_data[i * 2];
+        high[i] = palette_data[(i * 2) + 1];
+    }
+    const __m256i low0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&low[0]));
+    const __m256i low1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&low[16]));
+    const __m256i high0 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&high[0]));
+    const __m256i high1 = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)&high[16]));
+    const __m256i bit4 = _mm256_set1_epi8(16);
+
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)&index[i]);
+        __m256i upper = _mm256_cmpeq_epi8(_mm256_and_si256(v, bit4), bit4);
+
+        __m256i l = _mm256_blendv_epi8(_mm256_shuffle_epi8(low0, v), _mm256_shuffle_epi8(low1, v), upper);
+        __m256i h = _mm256_blendv_epi8(_mm256_shuffle_epi8(high0, v), _mm256_shuffle_epi8(high1, v), upper);
+
+        // Interleaving works within 128 bit lanes, put the halves back in order
+        __m256i a = _mm256_unpacklo_epi8(l, h);
+        __m256i b = _mm256_unpackhi_epi8(l, h);
+        _mm256_storeu_si256((__m256i *)&out[i], _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i *)&out[i+16], _mm256_permute2x128_si256(a, b, 0x31));
+    }
+
+    map_cgb_scalar(&out[i], &index[i], count - i, palette_data);
+}
+#endif
+
+// Picked once when the library is loaded, every instance and thread shares the choice
+__attribute__((constructor))
+static void pixel_init() {
+    decode_kernel = decode_scalar;
+    map_dmg_kernel = map_dmg_scalar;
+    map_cgb_kernel = map_cgb_scalar;
+
+#ifdef PIXEL_X86
+    decode_kernel = decode_sse2;
+    map_dmg_kernel = map_dmg_sse2;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        map_dmg_kernel = map_dmg_avx2;
+        map_cgb_kernel = map_cgb_avx2;
+    }
+#endif
+}
+
+void pixel_decode(uint8_t *out, uint8_t *out_flip, const uint8_t *data) {
+    decode_kernel(out, out_flip, data);
+}
+
+void pixel_map_dmg(uint8_t *out, const uint8_t *index, int count, uint8_t palette) {
+    map_dmg_kernel(out, index, count, palette);
+}
+
+void pixel_map_cgb(uint16_t *out, const uint8_t *index, int count, const uint8_t *palette_data) {
+    map_cgb_kernel(out, index, count, palette_data);
+}
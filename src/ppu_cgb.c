@@ -5,7 +5,10 @@
 #include "ppu.h"
 #include "mem.h"
 #include "log.h"
+#include "pixel.h"
 #include "cgb.h"
+#include "sched.h"
+#include "gb.h"
 
 #define PPU_MODE_HBLANK     0
 #define PPU_MODE_VBLANK     1
@@ -51,320 +54,412 @@
 #define RGB555_GREEN    5
 #define RGB555_BLUE     10
 
-ppu_t ppu = {};
+// Decode the bitplanes of a tile into color indices
+static void tile_decode(gb_t *gb, int tile) {
+    uint8_t *data = &gb->ppu.vram[((tile / PPU_TILES) * 0x2000) + ((tile % PPU_TILES) * 16)];
 
-uint8_t tile_pixel(uint8_t x, uint8_t y, uint8_t tile_id, bool bg_win, bool bank) {
-    // Get tile data address
-    uint16_t tile_address;
-    if (!bg_win || (ppu.lcdc & LCDC_BG_WIN_TILE_DATA)) {
-        tile_address = (tile_id * 16);
+    pixel_decode(&gb->ppu.tile_cache[tile][0][0][0], &gb->ppu.tile_cache[tile][1][0][0], data);
+
+    gb->ppu.tile_dirty[tile] = false;
+}
+
+// Color indices of one row of a tile
+static const uint8_t *tile_row(gb_t *gb, uint8_t y, uint8_t tile_id, bool bg_win, bool bank, bool x_flip) {
+    // Get tile number, BG/WIN may use signed indices from 0x9000
+    int tile;
+    if (!bg_win || (gb->ppu.lcdc & LCDC_BG_WIN_TILE_DATA)) {
+        tile = tile_id;
     } else {
-        tile_address = 0x1000 + ((int8_t)tile_id * 16);
+        tile = 256 + (int8_t)tile_id;
     }
 
     if (bank) {
-        tile_address += 0x2000;
+        tile += PPU_TILES;
     }
 
-    // Get the high/low bytes
-    uint8_t byte_l = ppu.vram[tile_address + (y * 2)];
-    uint8_t byte_h = ppu.vram[tile_address + 1 + (y * 2)];
-
-    // Get each bit
-    bool h = (byte_h >> (7 - x)) & 1;
-    bool l = (byte_l >> (7 - x)) & 1;
+    if (gb->ppu.tile_dirty[tile]) {
+        tile_decode(gb, tile);
+    }
 
-    // Combine
-    return (h << 1) + l;
+    return gb->ppu.tile_cache[tile][x_flip][y];
 }
 
-uint16_t map_palette_bg(uint8_t palette, uint8_t index) {
+uint16_t map_palette_obj(gb_t *gb, uint8_t palette, uint8_t index) {
     // Get the palette address
     uint8_t address = (palette * 8) + (index * 2);
     // Combine the high and low bytes at the address
-    uint16_t color = ppu.bgpd[address] | (ppu.bgpd[address+1] << 8);
+    uint16_t color = gb->ppu.obpd[address] | (gb->ppu.obpd[address+1] << 8);
     // Return the value
     return color;
 }
 
-uint16_t map_palette_obj(uint8_t palette, uint8_t index) {
-    // Get the palette address
-    uint8_t address = (palette * 8) + (index * 2);
-    // Combine the high and low bytes at the address
-    uint16_t color = ppu.obpd[address] | (ppu.obpd[address+1] << 8);
-    // Return the value
-    return color;
-}
+// OAM scan, pick the first objects in OAM order that cover this line
+static void oam_scan(gb_t *gb) {
+    int y = gb->ppu.ly + 16;
+    int obj_y_size = (gb->ppu.lcdc & LCDC_OBJ_SIZE) ? 16 : 8;
 
-void draw() {
-    uint16_t pixel_color = 0;
-    uint8_t pixel_index_bg_win = 0;
-    uint8_t priority_bg_win = 0;
+    gb->ppu.obj_count = 0;
+    for (int i = 0; i < 0xA0 && gb->ppu.obj_count < PPU_LINE_OBJS; i += 4) {
+        int obj_y = gb->mem.oam[i];
+        if (y < obj_y || y >= obj_y+obj_y_size) {
+            continue;
+        }
 
-    // Background
-    if (true) {//(ppu.lcdc & LCDC_BG_WIN_ENABLE) {
-        // Get scrolled x/y values
-        int x = (ppu.lx + ppu.scx) % 256;
-        int y = (ppu.ly + ppu.scy) % 256;
+        ppu_obj_t obj = {
+            .x = gb->mem.oam[i+1],
+            .tile = gb->mem.oam[i+2],
+            .row = y - obj_y,
+            .flags = gb->mem.oam[i+3]
+        };
 
-        // Get tile map area
-        uint16_t tile_map_addr = (ppu.lcdc & LCDC_BG_TILEMAP) ? 0x1C00 : 0x1800;
+        // Bit 0 of tile index is ignored for 8x16 objects
+        if (obj_y_size == 16) {
+            obj.tile &= 0b11111110;
+        }
 
-        // Obtain tile index
-        uint16_t tile_address = ((y/8) * 32 + (x/8)) + tile_map_addr;
-        uint8_t tile_id = ppu.vram[tile_address];
+        if (obj.flags & OBJ_Y_FLIP) {
+            obj.row = (obj_y_size - 1) - obj.row;
+        }
 
-        // Get BG map attributes
-        uint8_t attributes = ppu.vram[tile_address + 0x2000];
-        bool tile_bank = attributes & BG_ATTR_BANK;
-        priority_bg_win |= attributes & BG_ATTR_PRIORITY;
+        // OAM order is priority order
+        gb->ppu.objs[gb->ppu.obj_count++] = obj;
+    }
+}
 
-        if (attributes & BG_ATTR_X_FLIP) {
-            x = 7 - (x % 8);
-        }
+// Decode a run of tile map entries into palette * 4 + color indices, one row fetch per tile
+static void render_tiles(gb_t *gb, uint8_t *index, bool *priority, int start, int end, int x, int y, uint16_t tile_map_addr) {
+    int lx = start;
+    while (lx < end) {
+        // Obtain tile index
+        uint16_t tile_address = (((y/8) % 32) * 32 + ((x/8) % 32)) + tile_map_addr;
+        uint8_t tile_id = gb->ppu.vram[tile_address];
 
-        if (attributes & BG_ATTR_Y_FLIP) {
-            y = 7 - (y % 8);
+        // Get BG map attributes
+        uint8_t attributes = gb->ppu.vram[tile_address + 0x2000];
+        uint8_t tile_y = (attributes & BG_ATTR_Y_FLIP) ? 7 - (y % 8) : y % 8;
+        const uint8_t *row = tile_row(gb, tile_y, tile_id, 1, attributes & BG_ATTR_BANK, attributes & BG_ATTR_X_FLIP);
+        uint8_t palette = (attributes & BG_ATTR_PALETTE) * 4;
+
+        // Rest of this tile
+        for (int tile_x = x % 8; tile_x < 8 && lx < end; tile_x++) {
+            index[lx] = palette + row[tile_x];
+            priority[lx] = attributes & BG_ATTR_PRIORITY;
+            lx++;
+            x++;
         }
+    }
+}
 
-        pixel_index_bg_win = tile_pixel(x % 8, y % 8, tile_id, 1, tile_bank);
-        pixel_color = map_palette_bg(attributes & BG_ATTR_PALETTE, pixel_index_bg_win);
+// Render the current line from ppu.lx up to (not including) end
+// Registers only change between calls, so a line may be drawn in several pieces
+static void render(gb_t *gb, int end) {
+    int start = gb->ppu.lx;
+    if (start >= end) {
+        return;
     }
 
-    // Window
-    if /*((ppu.lcdc & LCDC_BG_WIN_ENABLE)*/(true && (ppu.lcdc & LCDC_WIN_ENABLE)) {
-        if (ppu.lx >= (ppu.wx - 7) && ppu.ly >= ppu.wy) {
-            // Get window x/y values
-            int x = ppu.lx - (ppu.wx - 7);
-            int y = ppu.ly - ppu.wy;
-
-            // Get tile map area
-            uint16_t tile_map_addr = (ppu.lcdc & LCDC_WIN_TILEMAP) ? 0x1C00 : 0x1800;
-
-            // Obtain tile index
-            uint16_t tile_address = ((y/8) * 32 + (x/8)) + tile_map_addr;
-            uint8_t tile_id = ppu.vram[tile_address];
-
-            // Get BG map attributes
-            uint8_t attributes = ppu.vram[tile_address + 0x2000];
-            bool tile_bank = attributes & BG_ATTR_BANK;
-            priority_bg_win |= attributes & BG_ATTR_PRIORITY;
-
-            if (attributes & BG_ATTR_X_FLIP) {
-                x = 7 - (x % 8);
-            }
+    uint16_t *line = &gb->ppu.fb[gb->ppu.ly * 160];
+    uint8_t index[160]; // BG/WIN palette * 4 + color index
+    bool priority[160]; // BG/WIN attribute priority
 
-            if (attributes & BG_ATTR_Y_FLIP) {
-                y = 7 - (y % 8);
-            }
+    // Background, always drawn on CGB
+    int x = (start + gb->ppu.scx) % 256;
+    int y = (gb->ppu.ly + gb->ppu.scy) % 256;
+    uint16_t tile_map_addr = (gb->ppu.lcdc & LCDC_BG_TILEMAP) ? 0x1C00 : 0x1800;
+    render_tiles(gb, index, priority, start, end, x, y, tile_map_addr);
 
-            pixel_index_bg_win = tile_pixel(x % 8, y % 8, tile_id, 1, tile_bank);
-            pixel_color = map_palette_bg(attributes & BG_ATTR_PALETTE, pixel_index_bg_win);
-        }
+    // Window
+    int win_x = gb->ppu.wx - 7;
+    if ((gb->ppu.lcdc & LCDC_WIN_ENABLE) && gb->ppu.ly >= gb->ppu.wy && win_x < end) {
+        int win_start = (win_x > start) ? win_x : start;
+        tile_map_addr = (gb->ppu.lcdc & LCDC_WIN_TILEMAP) ? 0x1C00 : 0x1800;
+        render_tiles(gb, index, priority, win_start, end, win_start - win_x, gb->ppu.ly - gb->ppu.wy, tile_map_addr);
     }
 
-    // Objects
-    if (ppu.lcdc & LCDC_OBJ_ENABLE) {
-        int x = ppu.lx + 8;
-        int y = ppu.ly + 16;
-        int obj_y_size = (ppu.lcdc & LCDC_OBJ_SIZE) ? 16 : 8;
-        for (int i = 0; i < 0xA0; i += 4) {
-            int obj_y = mem.oam[i];
-            int obj_x = mem.oam[i+1];
-            int obj_tile = mem.oam[i+2];
-            int obj_flags = mem.oam[i+3];
-
-            // Bit 0 of tile index is ignored for 8x16 objects
-            if (obj_y_size == 16) {
-                obj_tile &= 0b11111110;
-            }
-
-            bool priority_enable = false;
-            priority_enable |= pixel_index_bg_win == 0;
-            priority_enable |= (ppu.lcdc & LCDC_BG_WIN_ENABLE) == 0;
-            priority_enable |= (!priority_bg_win && !(obj_flags & OBJ_PRIORITY));
+    pixel_map_cgb(&line[start], &index[start], end - start, gb->ppu.bgpd);
 
-            bool object_in_pos = y >= obj_y && y < obj_y+obj_y_size && x >= obj_x && x < obj_x+8;
+    // Objects, the first opaque pixel in priority order wins
+    if (gb->ppu.lcdc & LCDC_OBJ_ENABLE) {
+        bool taken[160] = {0};
+        for (int i = 0; i < gb->ppu.obj_count; i++) {
+            ppu_obj_t *obj = &gb->ppu.objs[i];
+            if (obj->x-8 >= end || obj->x <= start) {
+                continue;
+            }
 
-            if (priority_enable && object_in_pos) {
-                uint8_t tile_x = x - obj_x;
-                uint8_t tile_y = y - obj_y;
+            // Rows 8-15 of 8x16 objects come from the next tile
+            const uint8_t *row = tile_row(gb, obj->row % 8, obj->tile + (obj->row / 8), 0, obj->flags & OBJ_BANK, obj->flags & OBJ_X_FLIP);
 
-                if (obj_flags & OBJ_X_FLIP) {
-                    tile_x = 7 - tile_x;
+            for (int tile_x = 0; tile_x < 8; tile_x++) {
+                int lx = obj->x - 8 + tile_x;
+                if (lx < start || lx >= end || taken[lx]) {
+                    continue;
                 }
 
-                if (obj_flags & OBJ_Y_FLIP) {
-                    tile_y = (obj_y_size - 1) - tile_y;
-                }
+                uint8_t pixel_index = row[tile_x];
 
-                uint8_t pixel_index = tile_pixel(tile_x, tile_y, obj_tile, 0, obj_flags & OBJ_BANK);
+                // Pixel index 0 == transparent
+                if (pixel_index == 0) {
+                    continue;
+                }
+                taken[lx] = true;
 
-                uint8_t palette = (obj_flags & OBJ_DMG_PALETTE) ? ppu.obp1 : ppu.obp0;
+                bool priority_enable = false;
+                priority_enable |= (index[lx] & 0b00000011) == 0;
+                priority_enable |= (gb->ppu.lcdc & LCDC_BG_WIN_ENABLE) == 0;
+                priority_enable |= (!priority[lx] && !(obj->flags & OBJ_PRIORITY));
 
-                // Pixel index 0 == transparent
-                if (pixel_index != 0) {
-                    pixel_color = map_palette_obj(obj_flags & OBJ_CGB_PALLETE, pixel_index);
+                if (priority_enable) {
+                    line[lx] = map_palette_obj(gb, obj->flags & OBJ_CGB_PALLETE, pixel_index);
                 }
             }
         }
     }
 
-    ppu.fb[(ppu.ly * 160) + ppu.lx] = pixel_color;
+    gb->ppu.lx = end;
 }
 
-bool ppu_execute(uint8_t t) {
-    // Do one dot per t
+bool ppu_execute(gb_t *gb, int t) {
+    // One dot per t, stepped a span at a time between mode and line boundaries
     bool new_frame = false;
 
-    if (cgb_speed() == CGB_SPEED_DOUBLE) {
+    if (cgb_speed(gb) == CGB_SPEED_DOUBLE) {
         t /= 2;
     }
 
-    if (ppu.lcdc & LCDC_PPU_ENABLE) {
-        for (int i = 0; i < t; i++) {
+    if (gb->ppu.lcdc & LCDC_PPU_ENABLE) {
+        while (t > 0) {
             // Helper variables
-            int dot_x = ppu.dot % 456;
-            int dot_y = ppu.dot / 456;
+            int dot_x = gb->ppu.dot % 456;
+            int dot_y = gb->ppu.dot / 456;
 
             // Set registers
-            ppu.ly = dot_y;
-            ppu.stat = (ppu.stat & ~STAT_PPU_MODE) | (ppu.mode & STAT_PPU_MODE); // PPU mode
-            ppu.stat = (ppu.stat & ~STAT_LYC_LY) | ((ppu.lyc == ppu.ly) ? STAT_LYC_LY : 0); // LYC == LY
+            gb->ppu.ly = dot_y;
+            gb->ppu.stat = (gb->ppu.stat & ~STAT_PPU_MODE) | (gb->ppu.mode & STAT_PPU_MODE); // PPU mode
+            gb->ppu.stat = (gb->ppu.stat & ~STAT_LYC_LY) | ((gb->ppu.lyc == gb->ppu.ly) ? STAT_LYC_LY : 0); // LYC == LY
 
             // STAT line is common between all sources and only triggers on high transition
             // Defer final value until all sources are calculated
-            bool stat_int_trans = (ppu.lyc == ppu.ly) && (ppu.stat & STAT_LYC_INT);
+            bool stat_int_trans = (gb->ppu.lyc == gb->ppu.ly) && (gb->ppu.stat & STAT_LYC_INT);
 
             // State transitions/timing
             if (dot_y < 144) {
                 if (dot_x == 0) {
-                    ppu.mode = PPU_MODE_OAM;
+                    gb->ppu.mode = PPU_MODE_OAM;
                 } else if (dot_x == 80) {
-                    ppu.mode = PPU_MODE_DRAWING;
+                    oam_scan(gb);
+                    gb->ppu.mode = PPU_MODE_DRAWING;
+                    gb->ppu.lx = 0;
                 } else if (dot_x == 252+80) {
-                    ppu.mode = PPU_MODE_HBLANK;
+                    // Finish the line before leaving mode 3
+                    render(gb, 160);
+                    gb->ppu.mode = PPU_MODE_HBLANK;
                 }
             } else if (dot_y == 144 && dot_x == 0) {
-                ppu.mode = PPU_MODE_VBLANK;
-                mem.iflag |= INT_VBLANK;
+                gb->ppu.mode = PPU_MODE_VBLANK;
+                gb->mem.iflag |= INT_VBLANK;
             }
 
             // PPU mode
-            switch (ppu.mode) {
+            switch (gb->ppu.mode) {
                 case PPU_MODE_HBLANK:
-                    stat_int_trans |= ppu.stat & STAT_HBLANK_INT;
+                    stat_int_trans |= gb->ppu.stat & STAT_HBLANK_INT;
                     break;
                 case PPU_MODE_VBLANK:
-                    stat_int_trans |= ppu.stat & STAT_VBLANK_INT;
+                    stat_int_trans |= gb->ppu.stat & STAT_VBLANK_INT;
                     break;
                 case PPU_MODE_OAM:
-                    stat_int_trans |= ppu.stat & STAT_OAM_INT;
-                    break;
-                case PPU_MODE_DRAWING:
-                    ppu.lx = dot_x - 80;
-                    if (ppu.lx < 160) {
-                        draw();
-                    }
+                    stat_int_trans |= gb->ppu.stat & STAT_OAM_INT;
                     break;
             }
 
-            if (!ppu.stat_int && stat_int_trans) {
-                mem.iflag |= INT_STAT;
+            if (!gb->ppu.stat_int && stat_int_trans) {
+                gb->mem.iflag |= INT_STAT;
+            }
+            gb->ppu.stat_int = stat_int_trans;
+
+            // Nothing else changes until the next boundary, skip the dots up to it
+            int span = 456 - dot_x;
+            if (dot_y < 144 && dot_x < 80) {
+                span = 80 - dot_x;
+            } else if (dot_y < 144 && dot_x < 252+80) {
+                span = 252+80 - dot_x;
+            }
+            if (span > t) {
+                span = t;
             }
-            ppu.stat_int = stat_int_trans;
 
-            ppu.dot++;
-            if (ppu.dot >= 70224) {
-                ppu.dot = 0;
+            // STAT mode bits follow a mode change one dot later
+            if (span > 1) {
+                gb->ppu.stat = (gb->ppu.stat & ~STAT_PPU_MODE) | (gb->ppu.mode & STAT_PPU_MODE);
+            }
+
+            t -= span;
+            gb->ppu.dot += span;
+            if (gb->ppu.dot >= 70224) {
+                gb->ppu.dot = 0;
                 new_frame = true;
             }
         }
+
+        // Catch up the pixels of the dots run so far, in case a register changes next
+        if (gb->ppu.mode == PPU_MODE_DRAWING) {
+            int end = (gb->ppu.dot % 456) - 80;
+            render(gb, (end < 160) ? end : 160);
+        }
     } else {
-        ppu.dot = 0;
-        ppu.mode = 0;
-        ppu.ly = 0;
-        ppu.stat &= ~(STAT_PPU_MODE | STAT_LYC_LY);
+        gb->ppu.dot = 0;
+        gb->ppu.mode = 0;
+        gb->ppu.ly = 0;
+        gb->ppu.stat &= ~(STAT_PPU_MODE | STAT_LYC_LY);
     }
 
     return new_frame;
 }
 
-bool ppu_enabled() {
-    return ppu.lcdc & LCDC_PPU_ENABLE;
+// Master clock cycles per dot
+static int dot_cycles(gb_t *gb) {
+    return (cgb_speed(gb) == CGB_SPEED_DOUBLE) ? 2 : 1;
 }
 
-void oam_dma(uint8_t data) {
+void ppu_sync(gb_t *gb) {
+    int t = gb->sched.cycles - gb->ppu.cycles;
+    if (t == 0) {
+        return;
+    }
+    gb->ppu.cycles = gb->sched.cycles;
+
+    if (ppu_execute(gb, t)) {
+        sched_raise(gb, EMU_EVENT_FRAME);
+    }
+}
+
+void ppu_schedule(gb_t *gb) {
+    if (!(gb->ppu.lcdc & LCDC_PPU_ENABLE)) {
+        sched_set(gb, SCHED_PPU, SCHED_NEVER);
+        return;
+    }
+
+    int dot_x = gb->ppu.dot % 456;
+    int dot_y = gb->ppu.dot / 456;
+    int line = gb->ppu.dot - dot_x;
+
+    // Next dot that can change the mode, LY or the STAT line
+    int next;
+    if (dot_x == 0) {
+        next = gb->ppu.dot;
+    } else if (dot_y < 144 && dot_x <= 80) {
+        next = line + 80;
+    } else if (dot_y < 144 && dot_x <= 252+80) {
+        next = line + 252+80;
+    } else {
+        next = line + 456;
+    }
+
+    // Or the last dot of the frame
+    if (next >= 70224) {
+        next = 70223;
+    }
+
+    sched_set(gb, SCHED_PPU, gb->ppu.cycles + ((next - gb->ppu.dot + 1) * dot_cycles(gb)));
+}
+
+bool ppu_enabled(gb_t *gb) {
+    return gb->ppu.lcdc & LCDC_PPU_ENABLE;
+}
+
+void oam_dma(gb_t *gb, uint8_t data) {
     DEBUG_PRINTF_PPU("OAM DMA:0x%X00\n", data);
     for (uint16_t i = 0; i <= 0x9F; i++) {
         uint16_t data_addr = ((uint16_t)data << 8) + i;
-        mem.oam[i] = mem_read(data_addr);
+        gb->mem.oam[i] = mem_read(gb, data_addr);
     }
 }
 
-uint8_t ppu_io_read(uint8_t addr) {
+uint8_t ppu_io_read(gb_t *gb, uint8_t addr) {
+    ppu_sync(gb);
+
     switch (addr) {
-        case 0x40: return ppu.lcdc; break;
-        case 0x41: return ppu.stat | STAT_UNUSED; break;
-        case 0x42: return ppu.scy; break;
-        case 0x43: return ppu.scx; break;
-        case 0x44: return ppu.ly; break;
-        case 0x45: return ppu.lyc; break;
-        case 0x46: return ppu.dma; break;
-        case 0x47: return ppu.bgp; break;
-        case 0x48: return ppu.obp0; break;
-        case 0x49: return ppu.obp1; break;
-        case 0x4A: return ppu.wy; break;
-        case 0x4B: return ppu.wx; break;
-        case 0x4F: return ppu.vram_bank; break;
-        case 0x68: return ppu.bgpi | PI_UNUSED; break;
-        case 0x69: return ppu.bgpd[ppu.bgpi & PI_ADDRESS]; break;
-        case 0x6A: return ppu.obpi | PI_UNUSED; break;
-        case 0x6B: return ppu.obpd[ppu.obpi & PI_ADDRESS]; break;
+        case 0x40: return gb->ppu.lcdc; break;
+        case 0x41: return gb->ppu.stat | STAT_UNUSED; break;
+        case 0x42: return gb->ppu.scy; break;
+        case 0x43: return gb->ppu.scx; break;
+        case 0x44: return gb->ppu.ly; break;
+        case 0x45: return gb->ppu.lyc; break;
+        case 0x46: return gb->ppu.dma; break;
+        case 0x47: return gb->ppu.bgp; break;
+        case 0x48: return gb->ppu.obp0; break;
+        case 0x49: return gb->ppu.obp1; break;
+        case 0x4A: return gb->ppu.wy; break;
+        case 0x4B: return gb->ppu.wx; break;
+        case 0x4F: return gb->ppu.vram_bank; break;
+        case 0x68: return gb->ppu.bgpi | PI_UNUSED; break;
+        case 0x69: return gb->ppu.bgpd[gb->ppu.bgpi & PI_ADDRESS]; break;
+        case 0x6A: return gb->ppu.obpi | PI_UNUSED; break;
+        case 0x6B: return gb->ppu.obpd[gb->ppu.obpi & PI_ADDRESS]; break;
         default: return 0; break;
     }
 }
 
-void ppu_io_write(uint8_t addr, uint8_t data) {
+void ppu_io_write(gb_t *gb, uint8_t addr, uint8_t data) {
+    ppu_sync(gb);
+
     switch (addr) {
-        case 0x40: ppu.lcdc = data; break;
-        case 0x41: ppu.stat = data; break;
-        case 0x42: ppu.scy = data; break;
-        case 0x43: ppu.scx = data; break;
-        case 0x44: ppu.ly = data; break;
-        case 0x45: ppu.lyc = data; break;
-        case 0x46: oam_dma(data); break;
-        case 0x47: ppu.bgp = data; break;
-        case 0x48: ppu.obp0 = data; break;
-        case 0x49: ppu.obp1 = data; break;
-        case 0x4A: ppu.wy = data; break;
-        case 0x4B: ppu.wx = data; break;
-        case 0x4F: ppu.vram_bank = data & 1; break;
-        case 0x68: ppu.bgpi = data; break;
+        case 0x40: gb->ppu.lcdc = data; break;
+        case 0x41: gb->ppu.stat = data; break;
+        case 0x42: gb->ppu.scy = data; break;
+        case 0x43: gb->ppu.scx = data; break;
+        case 0x44: gb->ppu.ly = data; break;
+        case 0x45: gb->ppu.lyc = data; break;
+        case 0x46: oam_dma(gb, data); break;
+        case 0x47: gb->ppu.bgp = data; break;
+        case 0x48: gb->ppu.obp0 = data; break;
+        case 0x49: gb->ppu.obp1 = data; break;
+        case 0x4A: gb->ppu.wy = data; break;
+        case 0x4B: gb->ppu.wx = data; break;
+        case 0x4F:
+            gb->ppu.vram_bank = data & 1;
+            mem_map(gb, 0x80, 0x20, &gb->ppu.vram[gb->ppu.vram_bank * 0x2000], NULL);
+            break;
+        case 0x68: gb->ppu.bgpi = data; break;
         case 0x69:
-            ppu.bgpd[ppu.bgpi & PI_ADDRESS] = data;
-            if (ppu.bgpi & PI_INCREMENT) {
-                ppu.bgpi = PI_INCREMENT | ((ppu.bgpi & PI_ADDRESS) + 1);
+            gb->ppu.bgpd[gb->ppu.bgpi & PI_ADDRESS] = data;
+            if (gb->ppu.bgpi & PI_INCREMENT) {
+                gb->ppu.bgpi = PI_INCREMENT | ((gb->ppu.bgpi & PI_ADDRESS) + 1);
             }
             break;
-        case 0x6A: ppu.obpi = data; break;
+        case 0x6A: gb->ppu.obpi = data; break;
         case 0x6B:
-            ppu.obpd[ppu.obpi & PI_ADDRESS] = data;
-            if (ppu.obpi & PI_INCREMENT) {
-                ppu.obpi = PI_INCREMENT | ((ppu.obpi & PI_ADDRESS) + 1);
+            gb->ppu.obpd[gb->ppu.obpi & PI_ADDRESS] = data;
+            if (gb->ppu.obpi & PI_INCREMENT) {
+                gb->ppu.obpi = PI_INCREMENT | ((gb->ppu.obpi & PI_ADDRESS) + 1);
             }
             break;
     }
+
+    // Any register can move the STAT line, look again on the next dot
+    sched_set(gb, SCHED_PPU, gb->ppu.cycles + dot_cycles(gb));
 }
 
-uint8_t ppu_vram_read(uint16_t addr) {
-    addr -= 0x8000 - (ppu.vram_bank * 0x2000);
-    return ppu.vram[addr];
+uint8_t ppu_vram_read(gb_t *gb, uint16_t addr) {
+    addr -= 0x8000 - (gb->ppu.vram_bank * 0x2000);
+    return gb->ppu.vram[addr];
 }
 
-void ppu_vram_write(uint16_t addr, uint8_t data) {
-    addr -= 0x8000 - (ppu.vram_bank * 0x2000);
-    ppu.vram[addr] = data;
+void ppu_vram_write(gb_t *gb, uint16_t addr, uint8_t data) {
+    ppu_sync(gb);
+    addr -= 0x8000 - (gb->ppu.vram_bank * 0x2000);
+    if (gb->ppu.vram[addr] != data) {
+        gb->ppu.vram[addr] = data;
+        ppu_tile_dirty(gb, addr);
+    }
+}
+
+void ppu_tile_dirty(gb_t *gb, uint16_t index) {
+    // Only tile data is cached, not the tile maps
+    if ((index & 0x1FFF) < PPU_TILES * 16) {
+        gb->ppu.tile_dirty[((index / 0x2000) * PPU_TILES) + ((index & 0x1FFF) / 16)] = true;
+    }
 }
 
 #endif
@@ -0,0 +1,30 @@
+#include <stdint.h>
+
+#include "sched.h"
+#include "gb.h"
+
+void sched_init(gb_t *gb) {
+    // Everything is due straight away so each unit gets to schedule itself
+    gb->sched = (gb_sched_t){0};
+}
+
+void sched_set(gb_t *gb, sched_event_t event, uint64_t cycles) {
+    if (cycles > gb->sched.cycles + SCHED_SPAN_MAX) {
+        cycles = gb->sched.cycles + SCHED_SPAN_MAX;
+    }
+    gb->sched.deadline[event] = cycles;
+
+    // There are only a handful of event sources, a linear scan beats keeping a heap
+    uint64_t next = SCHED_NEVER;
+    for (int i = 0; i < SCHED_COUNT; i++) {
+        if (gb->sched.deadline[i] < next) {
+            next = gb->sched.deadline[i];
+        }
+    }
+    gb->sched.next = next;
+}
+
+void sched_raise(gb_t *gb, int event) {
+    gb->sched.events |= event;
+    sched_set(gb, SCHED_EMU, gb->sched.cycles);
+}
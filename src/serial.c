@@ -3,33 +3,56 @@
 
 #include "serial.h"
 #include "mem.h"
+#include "sched.h"
+#include "gb.h"
 
 #define SC_CLOCK_SELECT     0b00000001
 #define SC_TRANSFER_ENABLE  0b10000000
 #define SC_UNUSED           0b01111110
 
-gb_serial_t serial = {
-    .sb = 0xFF
-};
-
-void serial_execute(uint8_t t) {
-    for (int i = 0; i < t; i++) {
-        // Only do anything if the master/internal clock is enabled
-        if ((serial.sc & SC_TRANSFER_ENABLE) && (serial.sc & SC_CLOCK_SELECT)) {
-            serial.counter += 1;
-            if (serial.counter >= 512) { // 8192 Hz
-                mem.iflag |= INT_SERIAL;
-                serial.sc &= ~SC_TRANSFER_ENABLE;
-                serial.counter = 0;
-            }
-        }
+void serial_init(gb_t *gb) {
+    gb->serial = (gb_serial_t){
+        .sb = 0xFF
+    };
+}
+
+void serial_execute(gb_t *gb, int t) {
+    // Only do anything if the master/internal clock is enabled
+    if (!(gb->serial.sc & SC_TRANSFER_ENABLE) || !(gb->serial.sc & SC_CLOCK_SELECT)) {
+        return;
+    }
+
+    gb->serial.counter += t;
+    if (gb->serial.counter >= 512) { // 8192 Hz
+        gb->mem.iflag |= INT_SERIAL;
+        gb->serial.sc &= ~SC_TRANSFER_ENABLE;
+        gb->serial.counter = 0;
+    }
+}
+
+void serial_sync(gb_t *gb) {
+    int t = gb->sched.cycles - gb->serial.cycles;
+    if (t == 0) {
+        return;
     }
+    gb->serial.cycles = gb->sched.cycles;
+    serial_execute(gb, t);
 }
 
-uint8_t serial_io_read(uint8_t addr) {
+void serial_schedule(gb_t *gb) {
+    if ((gb->serial.sc & SC_TRANSFER_ENABLE) && (gb->serial.sc & SC_CLOCK_SELECT)) {
+        sched_set(gb, SCHED_SERIAL, gb->serial.cycles + (512 - gb->serial.counter));
+    } else {
+        sched_set(gb, SCHED_SERIAL, SCHED_NEVER);
+    }
+}
+
+uint8_t serial_io_read(gb_t *gb, uint8_t addr) {
+    serial_sync(gb);
+
     switch (addr) {
-        case 0x01: return serial.sb; break;
-        case 0x02: return serial.sc | SC_UNUSED; break;
+        case 0x01: return gb->serial.sb; break;
+        case 0x02: return gb->serial.sc | SC_UNUSED; break;
         default:
             printf("Bad serial IO read");
             return 0;
@@ -37,15 +60,19 @@ uint8_t serial_io_read(uint8_t addr) {
     }
 }
 
-void serial_io_write(uint8_t addr, uint8_t data) {
+void serial_io_write(gb_t *gb, uint8_t addr, uint8_t data) {
+    serial_sync(gb);
+
     switch (addr) {
         case 0x01: /* Ignore SB writes */ break;
         case 0x02:
-            serial.sc = data;
-            serial.counter = 0;
+            gb->serial.sc = data;
+            gb->serial.counter = 0;
             break;
         default:
             printf("Bad serial IO write");
             break;
     }
+
+    serial_schedule(gb);
 }
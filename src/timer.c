@@ -1,5 +1,8 @@
 #include "timer.h"
 #include "mem.h"
+#include "apu.h"
+#include "sched.h"
+#include "gb.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -7,52 +10,95 @@
 #define TAC_CLOCK   0b00000011
 #define TAC_ENABLE  0b00000100
 
-gb_timer_t timer = {};
-
-void timer_execute(uint8_t t) {
-    // Loop through T-cycles
-    for (int i = 0; i < t; i++) {
-        timer.counter += 1;
-
-        // DIV
-        timer.div = ((timer.counter >> 8) & 0xFF);
-
-        // TIMA
-        // Select the clock bit
-        uint8_t bit;
-        switch (timer.tac & TAC_CLOCK) {
-            case 0: bit = 9; break;
-            case 1: bit = 3; break;
-            case 2: bit = 5; break;
-            case 3: bit = 7; break;
-        }
-
-        bool clock = ((timer.counter >> bit) & 1) && (timer.tac & TAC_ENABLE);
-
-        // Execute on falling edge
-        if (!clock && timer.clock_last) {
-            timer.tima += 1;
-            if (timer.tima == 0) {
-                timer.tima = timer.tma;
-                mem.iflag |= INT_TIMER;
-            }
-        }
-
-        timer.clock_last = clock;
+static uint8_t clock_bit(gb_t *gb) {
+    switch (gb->timer.tac & TAC_CLOCK) {
+        case 0: return 9; break;
+        case 1: return 3; break;
+        case 2: return 5; break;
+        default: return 7; break;
+    }
+}
+
+// Count TIMA up by increments, reloading TMA and raising the interrupt on every overflow
+static void timer_tima(gb_t *gb, uint64_t increments) {
+    if (increments < (uint64_t)(0x100 - gb->timer.tima)) {
+        gb->timer.tima += increments;
+        return;
     }
 
+    // First overflow, after that every 0x100 - TMA increments
+    increments -= 0x100 - gb->timer.tima;
+    gb->timer.tima = gb->timer.tma + (increments % (0x100 - gb->timer.tma));
+    gb->mem.iflag |= INT_TIMER;
+}
+
+void timer_execute(gb_t *gb, int t) {
     if (t == 0) {
         // The clock stopped, reset counter
-        timer.counter = 0;
+        gb->timer.counter = 0;
+        return;
+    }
+
+    // Select the clock bit
+    uint8_t bit = clock_bit(gb);
+    bool enable = gb->timer.tac & TAC_ENABLE;
+
+    // The first T-cycle on its own, a TAC or DIV write can leave clock_last out of step with the counter
+    uint64_t start = (uint16_t)(gb->timer.counter + 1);
+    bool clock = ((start >> bit) & 1) && enable;
+    uint64_t increments = !clock && gb->timer.clock_last;
+
+    // TIMA counts the falling edges of the selected bit, one every time the counter passes a
+    // multiple of twice the bit. The counter wraps at a multiple of that too.
+    uint64_t end = start + (t - 1);
+    if (enable) {
+        increments += (end >> (bit + 1)) - (start >> (bit + 1));
+    }
+    timer_tima(gb, increments);
+
+    gb->timer.counter = end;
+    gb->timer.div = ((gb->timer.counter >> 8) & 0xFF);
+    gb->timer.clock_last = ((gb->timer.counter >> bit) & 1) && enable;
+}
+
+void timer_sync(gb_t *gb) {
+    int t = gb->sched.cycles - gb->timer.cycles;
+    if (t == 0) {
+        return;
     }
+    gb->timer.cycles = gb->sched.cycles;
+    timer_execute(gb, t);
 }
 
-uint8_t timer_io_read(uint8_t addr) {
+void timer_schedule(gb_t *gb) {
+    uint64_t ticks;
+    uint8_t bit = clock_bit(gb);
+    bool next_bit = ((gb->timer.counter + 1) >> bit) & 1;
+
+    if (gb->timer.clock_last && !(next_bit && (gb->timer.tac & TAC_ENABLE))) {
+        // Falling edge on the very next tick, also covers TAC/DIV write glitches
+        ticks = 1;
+    } else if (gb->timer.tac & TAC_ENABLE) {
+        // Next falling edge is when the counter rolls over the selected bit
+        ticks = (2 << bit) - (gb->timer.counter & ((2 << bit) - 1));
+    } else {
+        sched_set(gb, SCHED_TIMER, SCHED_NEVER);
+        return;
+    }
+
+    // Every following edge is a full period apart, TIMA overflows on the last one
+    ticks += (uint64_t)(0xFF - gb->timer.tima) * (2 << bit);
+    sched_set(gb, SCHED_TIMER, gb->timer.cycles + ticks);
+}
+
+uint8_t timer_io_read(gb_t *gb, uint8_t addr) {
+    timer_sync(gb);
+
     switch (addr) {
-        case 0x04: return timer.div; break;
-        case 0x05: return timer.tima; break;
-        case 0x06: return timer.tma; break;
-        case 0x07: return timer.tac; break;
+        case 0x04: return gb->timer.div; break;
+        case 0x05: return gb->timer.tima; break;
+        case 0x06: return gb->timer.tma; break;
+        case 0x07: return gb->timer.tac; break;
         default:
             printf("Bad timer IO read");
             return 0;
@@ -60,18 +106,24 @@ uint8_t timer_io_read(uint8_t addr) {
     }
 }
 
-void timer_io_write(uint8_t addr, uint8_t data) {
+void timer_io_write(gb_t *gb, uint8_t addr, uint8_t data) {
+    // The APU frame sequencer is clocked from DIV, let it see the old counter first
+    apu_sync(gb);
+    timer_sync(gb);
+
     switch (addr) {
         case 0x04:
-            timer.div = 0;
-            timer.counter = 0;
+            gb->timer.div = 0;
+            gb->timer.counter = 0;
             break;
-        case 0x05: timer.tima = data; break;
-        case 0x06: timer.tma = data; break;
-        case 0x07: timer.tac = data; break;
+        case 0x05: gb->timer.tima = data; break;
+        case 0x06: gb->timer.tma = data; break;
+        case 0x07: gb->timer.tac = data; break;
         default:
             printf("Bad timer IO write");
             break;
     }
+
+    timer_schedule(gb);
 }
 
@@ -0,0 +1,337 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emu.h"
+#include "cpu.h"
+
+// Static recompiler, writes the code it can find in a ROM as C for a null frontend built with AOT=rom.c
+//
+// Code is followed from the entry point and the RST and interrupt vectors. The switchable bank is
+// only followed from code in the same bank, or from bank 0 right after a constant was written to
+// the MBC bank register. Anything else (code in RAM, computed jumps, banks it can not see being
+// switched in) is left to the interpreter, which runs until it reaches an address found here.
+
+#define BANK_SIZE 0x4000
+
+typedef struct {
+    int bank;
+    uint16_t addr;
+} entry_t;
+
+static uint8_t rom[EMU_ROM_SIZE_MAX];
+static int banks;
+
+static bool *code; // Instruction starts found so far, BANK_SIZE per bank
+static entry_t *work;
+static int work_len;
+static int work_size;
+
+static FILE *out;
+
+static const char *reg_name[8] = {"b", "c", "d", "e", "h", "l", NULL, "a"};
+
+// CPU addresses of a bank, bank 0 is fixed at 0x0000 and the rest switch in at 0x4000
+static uint16_t bank_start(int bank) {
+    return bank == 0 ? 0x0000 : 0x4000;
+}
+
+static bool in_bank(int bank, int addr) {
+    return addr >= bank_start(bank) && addr < bank_start(bank) + BANK_SIZE;
+}
+
+static bool *code_at(int bank, uint16_t addr) {
+    return &code[(bank * BANK_SIZE) + (addr & (BANK_SIZE - 1))];
+}
+
+static uint8_t rom_at(int bank, uint16_t addr) {
+    return rom[(bank * BANK_SIZE) + (addr & (BANK_SIZE - 1))];
+}
+
+static void add(int bank, int addr) {
+    if (!in_bank(bank, addr) || *code_at(bank, addr)) {
+        return;
+    }
+
+    if (work_len == work_size) {
+        work_size = work_size ? work_size * 2 : 256;
+        work = realloc(work, work_size * sizeof(entry_t));
+        if (work == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+    }
+    work[work_len++] = (entry_t){bank, addr};
+}
+
+// Jump or call target seen from bank, switch is the bank last written to the MBC or -1
+static void add_target(int bank, int switch_bank, int addr) {
+    if (addr < 0x4000) {
+        add(0, addr);
+    } else if (addr < 0x8000) {
+        if (bank != 0) {
+            add(bank, addr);
+        } else if (switch_bank > 0) {
+            add(switch_bank, addr);
+        }
+    }
+}
+
+// Mark every instruction from addr to the first unconditional jump
+static void trace(int bank, uint16_t addr) {
+    int a = -1; // Constant loaded into A
+    int switch_bank = -1;
+
+    while (in_bank(bank, addr) && !*code_at(bank, addr)) {
+        uint8_t op = rom_at(bank, addr);
+        int length = cpu_ops[op].length;
+        if (length == 0 || !in_bank(bank, addr + length - 1)) {
+            return;
+        }
+
+        *code_at(bank, addr) = true;
+
+        uint16_t imm16 = 0;
+        if (length >= 2) {
+            imm16 = rom_at(bank, addr + 1);
+        }
+        if (length == 3) {
+            imm16 |= rom_at(bank, addr + 2) << 8;
+        }
+
+        // LD A,n8 then LD [$2000-$3FFF],A selects a bank
+        if (op == 0x3E) {
+            a = imm16;
+        } else if (op == 0xEA && imm16 >= 0x2000 && imm16 < 0x4000 && a >= 0) {
+            switch_bank = (a % banks) == 0 ? 1 : a % banks;
+        } else if (op != 0x00 && op != 0xE0 && op != 0xEA) {
+            a = -1;
+        }
+
+        switch (op) {
+            case 0x18: case 0x20: case 0x28: case 0x30: case 0x38: // JR
+                add_target(bank, switch_bank, addr + 2 + (int8_t)imm16);
+                break;
+            case 0xC2: case 0xC3: case 0xCA: case 0xD2: case 0xDA: // JP
+            case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC: // CALL
+                add_target(bank, switch_bank, imm16);
+                break;
+            case 0xC7: case 0xCF: case 0xD7: case 0xDF: case 0xE7: case 0xEF: case 0xF7: case 0xFF: // RST
+                add_target(bank, switch_bank, op & 0x38);
+                break;
+        }
+
+        // Nothing falls through JR, JP, JP HL, RET and RETI
+        if (op == 0x18 || op == 0xC3 || op == 0xE9 || op == 0xC9 || op == 0xD9) {
+            return;
+        }
+
+        addr += length;
+    }
+}
+
+// Instructions written out in C, the rest call cpu_execute_op. Matches the JIT's inline set.
+static bool emit_native(uint8_t op, uint16_t imm16) {
+    int src = op & 0b111;
+    int dst = (op >> 3) & 0b111;
+
+    if (op == 0x00) { // NOP
+        return true;
+    }
+
+    if (op >= 0x40 && op < 0x80 && op != 0x76 && src != 6 && dst != 6) { // LD r,r'
+        if (src != dst) {
+            fprintf(out, "            gb->cpu.%s = gb->cpu.%s;\n", reg_name[dst], reg_name[src]);
+        }
+        return true;
+    }
+
+    if (op < 0x40 && dst != 6 && src >= 4 && src <= 6) {
+        if (src == 6) { // LD r,n8
+            fprintf(out, "            gb->cpu.%s = 0x%02X;\n", reg_name[dst], imm16 & 0xFF);
+            return true;
+        }
+
+        // INC r and DEC r
+        const char *r = reg_name[dst];
+        fprintf(out, "            {\n");
+        fprintf(out, "                uint8_t result = gb->cpu.%s %s 1;\n", r, src == 4 ? "+" : "-");
+        fprintf(out, "                gb->cpu.flag_h = gb->cpu.%s ^ 1 ^ result;\n", r);
+        fprintf(out, "                gb->cpu.%s = result;\n", r);
+        fprintf(out, "                gb->cpu.flag_z = result;\n");
+        fprintf(out, "                gb->cpu.flag_n = %d;\n", src == 5);
+        fprintf(out, "            }\n");
+        return true;
+    }
+
+    // AND, XOR and OR with a register or n8
+    static const char *logic[3] = {"&", "^", "|"};
+    if ((op >= 0xA0 && op < 0xB8 && src != 6) || op == 0xE6 || op == 0xEE || op == 0xF6) {
+        int fn = op < 0xC0 ? (op - 0xA0) >> 3 : (op - 0xE6) >> 3;
+        if (op < 0xC0) {
+            fprintf(out, "            gb->cpu.a %s= gb->cpu.%s;\n", logic[fn], reg_name[src]);
+        } else {
+            fprintf(out, "            gb->cpu.a %s= 0x%02X;\n", logic[fn], imm16 & 0xFF);
+        }
+        fprintf(out, "            gb->cpu.flag_z = gb->cpu.a;\n");
+        fprintf(out, "            gb->cpu.flag_n = 0;\n");
+        fprintf(out, "            gb->cpu.flag_h = 0x%02X;\n", fn == 0 ? 0x10 : 0);
+        fprintf(out, "            gb->cpu.flag_c = 0;\n");
+        return true;
+    }
+
+    if (op == 0xF0 || op == 0xFA) { // LDH A,[n8] and LD A,[n16]
+        fprintf(out, "            gb->cpu.a = mem_read(gb, 0x%04X);\n", op == 0xF0 ? 0xFF00 | (imm16 & 0xFF) : imm16);
+        return true;
+    }
+
+    if (op == 0xE0 || op == 0xEA) { // LDH [n8],A and LD [n16],A
+        fprintf(out, "            mem_write(gb, 0x%04X, gb->cpu.a);\n", op == 0xE0 ? 0xFF00 | (imm16 & 0xFF) : imm16);
+        return true;
+    }
+
+    return false;
+}
+
+// One function per bank, entered at any instruction found in it through a switch on PC
+static void emit_bank(int bank) {
+    fprintf(out, "static int bank_%03X(gb_t *gb) {\n", bank);
+    fprintf(out, "    switch (gb->cpu.pc) {\n");
+
+    for (int addr = bank_start(bank); addr < bank_start(bank) + BANK_SIZE; addr++) {
+        uint8_t op = rom_at(bank, addr);
+        if (!*code_at(bank, addr) || (cpu_ops[op].flags & CPU_OP_INTERPRET)) {
+            continue;
+        }
+
+        const cpu_op_t *info = cpu_op_decode(op, rom_at(bank, addr + 1));
+        int length = cpu_ops[op].length;
+        uint16_t imm16 = 0;
+        if (length >= 2) {
+            imm16 = rom_at(bank, addr + 1);
+        }
+        if (length == 3) {
+            imm16 |= rom_at(bank, addr + 2) << 8;
+        }
+
+        fprintf(out, "        case 0x%04X: //", addr);
+        for (int i = 0; i < length; i++) {
+            fprintf(out, " %02X", rom_at(bank, addr + i));
+        }
+        fprintf(out, "%*s  %s\n", 3 * (3 - length), "", info->mnemonic);
+
+        bool native = emit_native(op, imm16);
+        if (native) {
+            fprintf(out, "            AOT_NEXT(0x%04X, %d, %d);\n", addr, length, info->cycles);
+        } else {
+            fprintf(out, "            AOT_OP(0x%02X, 0x%04X);\n", op, imm16);
+        }
+
+        // Falling into the next case only works if it is the next instruction
+        int next = addr + length;
+        bool falls = !(info->flags & CPU_OP_END) && in_bank(bank, next) && *code_at(bank, next) &&
+                     !(cpu_ops[rom_at(bank, next)].flags & CPU_OP_INTERPRET);
+        for (int i = 1; i < length; i++) {
+            falls = falls && !*code_at(bank, addr + i); // A jump into the middle of this one
+        }
+
+        if (falls && (info->flags & CPU_OP_WRITE)) {
+            fprintf(out, "            AOT_MAPPED(0x%04X, 0x%03X);\n", addr, bank);
+        }
+        if (falls && (!native || (info->flags & (CPU_OP_READ | CPU_OP_WRITE)))) {
+            fprintf(out, "            AOT_INTERRUPT(0x%04X);\n", addr);
+        }
+        if (falls) {
+            fprintf(out, "            AOT_DEADLINE(0x%04X);\n", addr);
+            fprintf(out, "            [[fallthrough]];\n");
+        } else {
+            fprintf(out, "            return 0x%04X;\n", addr);
+        }
+    }
+
+    fprintf(out, "        default:\n");
+    fprintf(out, "            return -1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s rom.gb rom.c\n", argv[0]);
+        return 1;
+    }
+
+    FILE *file = fopen(argv[1], "rb");
+    if (!file) {
+        printf("Could not open cartridge rom %s\n", argv[1]);
+        return 1;
+    }
+    size_t size = fread(rom, 1, EMU_ROM_SIZE_MAX, file);
+    fclose(file);
+
+    banks = size / BANK_SIZE;
+    if (banks < 2) {
+        printf("Cartridge rom %s is too small\n", argv[1]);
+        return 1;
+    }
+
+    code = calloc(banks * BANK_SIZE, sizeof(bool));
+    if (code == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // Entry point, RST and interrupt vectors
+    add(0, 0x0100);
+    for (int addr = 0x00; addr <= 0x60; addr += 8) {
+        add(0, addr);
+    }
+
+    while (work_len > 0) {
+        entry_t entry = work[--work_len];
+        trace(entry.bank, entry.addr);
+    }
+
+    out = fopen(argv[2], "w");
+    if (!out) {
+        printf("Could not open %s\n", argv[2]);
+        return 1;
+    }
+
+    fprintf(out, "// Generated by boyo-aot from %s, do not edit\n\n", argv[1]);
+    fprintf(out, "#include <stdint.h>\n\n");
+    fprintf(out, "#include \"aot.h\"\n");
+    fprintf(out, "#include \"cpu.h\"\n");
+    fprintf(out, "#include \"mem.h\"\n");
+    fprintf(out, "#include \"gb.h\"\n\n");
+    fprintf(out, "const uint16_t aot_checksum = 0x%02X%02X;\n\n", rom[0x14E], rom[0x14F]);
+
+    bool *found = calloc(banks, sizeof(bool));
+    for (int bank = 0; bank < banks; bank++) {
+        for (int addr = 0; addr < BANK_SIZE && !found[bank]; addr++) {
+            found[bank] = code[(bank * BANK_SIZE) + addr];
+        }
+        if (found[bank]) {
+            emit_bank(bank);
+        }
+    }
+
+    fprintf(out, "int aot_execute(gb_t *gb, int bank) {\n");
+    fprintf(out, "    switch (bank) {\n");
+    for (int bank = 0; bank < banks; bank++) {
+        if (found[bank]) {
+            fprintf(out, "        case 0x%03X: return bank_%03X(gb);\n", bank, bank);
+        }
+    }
+    fprintf(out, "        default: return -1;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "}\n");
+
+    fclose(out);
+    free(found);
+    free(code);
+    free(work);
+    return 0;
+}